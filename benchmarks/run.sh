@@ -0,0 +1,25 @@
+#!/bin/sh
+# Compiles the lhpCompiler, lhpBench and the benchmark pages, then measures each page with its recorded requests.
+# One JSON line is printed per page (tagged with the commit), so results from different commits can be compared.
+# Usage: benchmarks/run.sh [lhpBench options]...
+# LHP_BENCH_PROFILE chooses the build profile of the pages (release by default) and LHP_BENCH_DIR where they are built.
+set -e
+source_dir=$(cd "$(dirname "$0")/.." && pwd)
+build_dir=${LHP_BENCH_DIR:-/tmp/lhpBench-build}
+profile=${LHP_BENCH_PROFILE:-release}
+commit=$(git -C "$source_dir" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+mkdir -p "$build_dir"
+cp "$source_dir"/benchmarks/*.lhp "$source_dir"/benchmarks/*.requests "$build_dir"
+gcc -O2 "$source_dir/lhpCompiler.c" -o "$build_dir/lhpCompiler" -lz
+gcc -O2 -std=c99 "$source_dir/lhpBench.c" -o "$build_dir/lhpBench" -pthread
+
+cd "$build_dir"
+for page in *.lhp; do
+    name=${page%.lhp}
+    if ! ./lhpCompiler -p "$profile" "$page" > /dev/null; then
+        echo "Error compiling $page, see $build_dir/LHP.log" >&2
+        exit 1
+    fi
+    ./lhpBench "$@" "$name.exe" "$name.requests" | sed "s/^{/{\"commit\":\"$commit\",\"profile\":\"$profile\",/"
+done
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Checks that a threaded page run by its supervisor (-k) retires a worker as soon as it is spent. The page grows past
+# LHP_MAX_RSS on its first request, so that worker must stop (every thread of it, including the one waiting in
+# FCGX_Accept_r for a request that never comes) and the supervisor must start another in its place.
+# Usage: benchmarks/supervisor.sh
+# LHP_BENCH_DIR chooses where the page is built.
+set -e
+source_dir=$(cd "$(dirname "$0")/.." && pwd)
+build_dir=${LHP_BENCH_DIR:-/tmp/lhpBench-build}
+socket="$build_dir/supervisor.sock"
+
+mkdir -p "$build_dir"
+gcc -O2 "$source_dir/lhpCompiler.c" -o "$build_dir/lhpCompiler" -lz
+gcc -O2 -std=c99 "$source_dir/lhpBench.c" -o "$build_dir/lhpBench" -pthread
+
+cd "$build_dir"
+cat > supervisor.lhp <<'PAGE'
+#include <stdlib.h>
+#include <string.h>
+<html><head><title>Supervisor</title></head>
+<body>
+<£lhp
+    int main(void){
+        char *block = malloc(64 << 20);
+        if(block != NULL){
+            memset(block, 1, 64 << 20);
+            free(block);
+        }
+        printf("<p>Grown by 64MB</p>\n");
+        return 0;
+    }
+£>
+</body></html>
+PAGE
+if ! ./lhpCompiler -f -k -t 4 supervisor.lhp > /dev/null; then
+    echo "Error compiling supervisor.lhp, see $build_dir/LHP.log" >&2
+    exit 1
+fi
+
+LHP_LISTEN="$socket" LHP_MAX_WORKERS=1 LHP_MAX_RSS=32 ./supervisor.exe &
+supervisor=$!
+trap 'kill $supervisor 2> /dev/null' EXIT
+sleep 1
+first=$(pgrep -P $supervisor)
+./lhpBench -a "$socket" -c 1 -n 1 -w 0 > /dev/null
+
+# Give the worker a few seconds to stop and be replaced.
+for attempt in 1 2 3 4 5 6 7 8 9 10; do
+    sleep 0.5
+    worker=$(pgrep -P $supervisor || true)
+    if [ -n "$worker" ] && [ "$worker" != "$first" ]; then
+        echo "Worker $first retired after growing past LHP_MAX_RSS, and worker $worker took over."
+        exit 0
+    fi
+done
+echo "Worker $first was not retired after growing past LHP_MAX_RSS." >&2
+exit 1
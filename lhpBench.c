@@ -0,0 +1,844 @@
+/****************************************************************************
+ *                                                                          *
+ * Copyright (C) 2020 by Iqra Haq                                           *
+ *                                                                          *
+ * This file is the source code for the prototype software of               *
+ * my university project: the lhpCompiler.                                  *
+ *                                                                          *
+ * lhpCompiler is software that you can redistribute                        *
+ * and/or modify under the terms of the MIT License.                        *
+ *                                                                          *
+ * lhpCompiler is distributed in the hope that it will be useful            *
+ * for my university project and/or further research purposes               *
+ * but WITHOUT ANY WARRANTY AND LIABILITY.                                  *
+ * See the following link for more details:                                 *
+ * https://github.com/Iqrahaq/lhpCompiler/blob/master/LICENSE               *
+ *                                                                          *
+ ****************************************************************************/
+
+/**
+ * @file lhpBench.c
+ * @author Iqra Haq
+ * @brief This file contains the source code for lhpBench, which measures how quickly an EXE File made by the lhpCompiler
+ * answers requests. The page is started on a Unix domain socket (as a web server would start it) and sent requests by
+ * a small FastCGI client, from several connections at once, and the throughput and latencies are reported as JSON or CSV.
+ */
+
+// These are the necessary pre-processor directives required for the library functions used by lhpBench.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+// The parts of the FastCGI protocol used by the client (see the FastCGI specification).
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+#define FCGI_HEADER_LENGTH 8
+#define FCGI_MAX_CONTENT 65535
+
+// The request ID used on every connection (each connection only has one request at a time).
+#define BENCH_REQUEST_ID 1
+
+// Latencies are also counted in a histogram with a bucket for each power of two microseconds.
+#define BENCH_HISTOGRAM_BUCKETS 32
+
+/**
+ * A request from the request mix, already encoded as the FastCGI records that send it.
+ */
+struct bench_request {
+    unsigned char *records;
+    size_t length;
+};
+
+/**
+ * The options given by the user.
+ */
+struct bench_options {
+    // Number of connections sending requests at once.
+    long concurrency;
+    // Number of requests to measure (when no duration is given).
+    long requests;
+    // Number of seconds to send requests for (0 to send a fixed number of requests instead).
+    double duration;
+    // Number of requests sent (and not measured) before measuring starts.
+    long warmup;
+    // Whether connections are kept open between requests (FCGI_KEEP_CONN).
+    int keep_connection;
+    // Whether the results are printed as CSV rather than JSON.
+    int csv;
+    // The socket of a page that is already running, or NULL to start the page given.
+    const char *attach_socket;
+};
+
+/**
+ * A connection to the page, with a buffer for reading the records of its responses.
+ */
+struct bench_connection {
+    int descriptor;
+    size_t start;
+    size_t end;
+    unsigned char buffer[65536];
+};
+
+/**
+ * The state of a thread sending requests, including the latencies it measured.
+ */
+struct bench_worker {
+    pthread_t thread;
+    unsigned long long *latencies;
+    size_t latency_count;
+    size_t latency_capacity;
+    unsigned long long bytes;
+    unsigned long long errors;
+};
+
+// The shared state of the benchmark, set up before the worker threads are started.
+const char *socket_path = NULL;
+struct bench_options options = { 0 };
+struct bench_request *request_mix = NULL;
+size_t request_mix_count = 0;
+// The number of requests handed out so far (including the warmup), and when measuring stops in duration mode.
+// The worker threads read and write these with atomic operations only.
+long next_request = 0;
+unsigned long long measure_start = 0;
+unsigned long long measure_end = 0;
+
+/**
+ * This function returns the time from a monotonic clock, in nanoseconds.
+ *
+ * @author Iqra Haq
+ * \return unsigned long long - The time in nanoseconds.
+ */
+unsigned long long now_nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+/**
+ * This function adds data to the end of a growing buffer.
+ *
+ * @author Iqra Haq
+ * @param[out] buffer - The buffer to add to.
+ * @param[out] length - The length of the buffer.
+ * @param[out] capacity - The capacity of the buffer.
+ * @param[in] data - The data to add.
+ * @param[in] data_length - The length of the data.
+ * \return int - Error status.
+ */
+int append_bytes(unsigned char **buffer, size_t *length, size_t *capacity, const void *data, size_t data_length)
+{
+    if(data_length == 0){
+        return 0;
+    }
+    if(*length + data_length > *capacity){
+        size_t new_capacity = (*capacity > 0) ? *capacity * 2 : 1024;
+        while(new_capacity < *length + data_length){
+            new_capacity *= 2;
+        }
+        unsigned char *new_buffer = realloc(*buffer, new_capacity);
+        if(new_buffer == NULL){
+            return 1;
+        }
+        *buffer = new_buffer;
+        *capacity = new_capacity;
+    }
+    memcpy(*buffer + *length, data, data_length);
+    *length += data_length;
+    return 0;
+}
+
+/**
+ * This function adds FastCGI records of a type holding the given content (split into as many records as it needs,
+ * followed by an empty record to end the stream).
+ *
+ * @author Iqra Haq
+ * @param[out] buffer - The buffer to add the records to.
+ * @param[out] length - The length of the buffer.
+ * @param[out] capacity - The capacity of the buffer.
+ * @param[in] type - The type of the records.
+ * @param[in] content - The content of the stream.
+ * @param[in] content_length - The length of the content.
+ * \return int - Error status.
+ */
+int append_stream(unsigned char **buffer, size_t *length, size_t *capacity, int type, const unsigned char *content, size_t content_length)
+{
+    size_t offset = 0;
+    while(1){
+        size_t chunk = content_length - offset;
+        if(chunk > FCGI_MAX_CONTENT){
+            chunk = FCGI_MAX_CONTENT;
+        }
+        unsigned char header[FCGI_HEADER_LENGTH] = { FCGI_VERSION_1, (unsigned char)type, 0, BENCH_REQUEST_ID, (unsigned char)(chunk >> 8), (unsigned char)(chunk & 0xff), 0, 0 };
+        if(append_bytes(buffer, length, capacity, header, sizeof(header)) != 0 || append_bytes(buffer, length, capacity, content + offset, chunk) != 0){
+            return 1;
+        }
+        offset += chunk;
+        // The last record of the stream is always empty.
+        if(chunk == 0){
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function adds the length of a FastCGI name or value, as one byte if it is short or four bytes otherwise.
+ *
+ * @author Iqra Haq
+ * @param[out] buffer - The buffer to add the length to.
+ * @param[out] length - The length of the buffer.
+ * @param[out] capacity - The capacity of the buffer.
+ * @param[in] value_length - The length to add.
+ * \return int - Error status.
+ */
+int append_pair_length(unsigned char **buffer, size_t *length, size_t *capacity, size_t value_length)
+{
+    if(value_length < 128){
+        unsigned char byte = (unsigned char)value_length;
+        return append_bytes(buffer, length, capacity, &byte, 1);
+    }
+    unsigned char bytes[4] = { (unsigned char)((value_length >> 24) | 0x80), (unsigned char)(value_length >> 16), (unsigned char)(value_length >> 8), (unsigned char)value_length };
+    return append_bytes(buffer, length, capacity, bytes, 4);
+}
+
+/**
+ * This function encodes a request as the FastCGI records that send it: the start of the request, its CGI variables and its body.
+ *
+ * @author Iqra Haq
+ * @param[in] variables - The CGI variables of the request ("NAME=value").
+ * @param[in] variable_count - The number of CGI variables.
+ * @param[in] body - The body of the request (NULL if it hasn't got one).
+ * @param[out] request - The encoded request.
+ * \return int - Error status.
+ */
+int encode_request(char **variables, size_t variable_count, const char *body, struct bench_request *request)
+{
+    unsigned char *params = NULL;
+    size_t params_length = 0;
+    size_t params_capacity = 0;
+    size_t capacity = 0;
+    int status = 0;
+    request->records = NULL;
+    request->length = 0;
+
+    // The variables are sent as name and value pairs, each preceded by its lengths.
+    for(size_t i = 0; i < variable_count && status == 0; i++){
+        const char *equals = strchr(variables[i], '=');
+        size_t name_length = (size_t)(equals - variables[i]);
+        size_t value_length = strlen(equals + 1);
+        status |= append_pair_length(&params, &params_length, &params_capacity, name_length);
+        status |= append_pair_length(&params, &params_length, &params_capacity, value_length);
+        status |= append_bytes(&params, &params_length, &params_capacity, variables[i], name_length);
+        status |= append_bytes(&params, &params_length, &params_capacity, equals + 1, value_length);
+    }
+
+    unsigned char begin[FCGI_HEADER_LENGTH * 2] = { FCGI_VERSION_1, FCGI_BEGIN_REQUEST, 0, BENCH_REQUEST_ID, 0, 8, 0, 0,
+                                                    0, FCGI_RESPONDER, options.keep_connection ? FCGI_KEEP_CONN : 0, 0, 0, 0, 0, 0 };
+    if(status == 0){
+        status |= append_bytes(&request->records, &request->length, &capacity, begin, sizeof(begin));
+        status |= append_stream(&request->records, &request->length, &capacity, FCGI_PARAMS, params, params_length);
+        status |= append_stream(&request->records, &request->length, &capacity, FCGI_STDIN, (const unsigned char *)body, (body != NULL) ? strlen(body) : 0);
+    }
+    free(params);
+    return status;
+}
+
+/**
+ * This function loads the request mix from a requests file, in the same format the lhpCompiler replays for profile-guided
+ * optimisation: one request per block of "NAME=value" lines, with blocks separated by an empty line, "#" comments and
+ * LHP_BODY giving the body of the request. Requests are sent in the order they appear in the file, over and over.
+ *
+ * @author Iqra Haq
+ * @param[in] requests_file_name - The name of the requests file (NULL for a single GET request).
+ * \return int - Error status.
+ */
+int load_request_mix(const char *requests_file_name)
+{
+    FILE *requests_file = NULL;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_length;
+    int at_end = 0;
+    int status = 0;
+    if(requests_file_name != NULL){
+        requests_file = fopen(requests_file_name, "r");
+        if(requests_file == NULL){
+            fprintf(stderr, "Error reading %s, please try again...\n", requests_file_name);
+            return 1;
+        }
+    }
+
+    while(!at_end && status == 0){
+        // Collect the CGI variables of the next request, leaving room for the ones added if the recording left them out.
+        char **variables = NULL;
+        size_t variable_count = 0;
+        char *body = NULL;
+        int has_method = 0;
+        int has_length = 0;
+        int has_script = 0;
+        while(requests_file != NULL){
+            line_length = getline(&line, &line_capacity, requests_file);
+            if(line_length < 0){
+                break;
+            }
+            while(line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r')){
+                line[--line_length] = '\0';
+            }
+            if(line_length == 0){
+                if(variable_count > 0 || body != NULL){
+                    break;
+                }
+                continue;
+            }
+            if(line[0] == '#' || strchr(line, '=') == NULL){
+                continue;
+            }
+            if(strncmp(line, "LHP_BODY=", 9) == 0){
+                free(body);
+                body = strdup(line + 9);
+                continue;
+            }
+            has_method |= (strncmp(line, "REQUEST_METHOD=", 15) == 0);
+            has_length |= (strncmp(line, "CONTENT_LENGTH=", 15) == 0);
+            has_script |= (strncmp(line, "SCRIPT_NAME=", 12) == 0);
+            char **new_variables = realloc(variables, (variable_count + 1) * sizeof(*variables));
+            if(new_variables == NULL){
+                status = 1;
+                break;
+            }
+            variables = new_variables;
+            variables[variable_count++] = strdup(line);
+        }
+        if(requests_file == NULL || feof(requests_file)){
+            at_end = 1;
+        }
+
+        // An empty block at the end of the file isn't a request (unless the file has no requests at all).
+        if(status == 0 && (variable_count > 0 || body != NULL || request_mix_count == 0)){
+            char content_length[64];
+            char *defaults[4];
+            size_t default_count = 0;
+            defaults[default_count++] = "GATEWAY_INTERFACE=CGI/1.1";
+            if(!has_method){
+                defaults[default_count++] = (body != NULL) ? "REQUEST_METHOD=POST" : "REQUEST_METHOD=GET";
+            }
+            if(!has_script){
+                defaults[default_count++] = "SCRIPT_NAME=/";
+            }
+            if(body != NULL && !has_length){
+                snprintf(content_length, sizeof(content_length), "CONTENT_LENGTH=%zu", strlen(body));
+                defaults[default_count++] = content_length;
+            }
+            char **all_variables = malloc((variable_count + default_count) * sizeof(*all_variables));
+            struct bench_request *new_mix = realloc(request_mix, (request_mix_count + 1) * sizeof(*request_mix));
+            if(all_variables == NULL || new_mix == NULL){
+                status = 1;
+            } else {
+                request_mix = new_mix;
+                memcpy(all_variables, defaults, default_count * sizeof(*all_variables));
+                memcpy(all_variables + default_count, variables, variable_count * sizeof(*all_variables));
+                status = encode_request(all_variables, variable_count + default_count, body, &request_mix[request_mix_count]);
+                if(status == 0){
+                    request_mix_count++;
+                }
+            }
+            free(all_variables);
+        }
+
+        for(size_t i = 0; i < variable_count; i++){
+            free(variables[i]);
+        }
+        free(variables);
+        free(body);
+    }
+
+    free(line);
+    if(requests_file != NULL){
+        fclose(requests_file);
+    }
+    if(status != 0){
+        fprintf(stderr, "Error loading the requests to send! Not enough memory.\n");
+    }
+    return status;
+}
+
+/**
+ * This function opens a connection to the page.
+ *
+ * @author Iqra Haq
+ * \return int - The connection's file descriptor, or -1 if it couldn't be opened.
+ */
+int connect_to_page(void)
+{
+    struct sockaddr_un address;
+    int descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(descriptor == -1){
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    if(connect(descriptor, (struct sockaddr *)&address, sizeof(address)) == -1){
+        close(descriptor);
+        return -1;
+    }
+    return descriptor;
+}
+
+/**
+ * This function reads from a connection through its buffer.
+ *
+ * @author Iqra Haq
+ * @param[out] connection - The connection to read from.
+ * @param[out] data - Where to copy what is read (NULL to skip it).
+ * @param[in] length - The number of bytes to read.
+ * \return int - Error status (including the page closing the connection).
+ */
+int read_connection(struct bench_connection *connection, unsigned char *data, size_t length)
+{
+    while(length > 0){
+        if(connection->start == connection->end){
+            ssize_t received = read(connection->descriptor, connection->buffer, sizeof(connection->buffer));
+            if(received < 0 && errno == EINTR){
+                continue;
+            }
+            if(received <= 0){
+                return 1;
+            }
+            connection->start = 0;
+            connection->end = (size_t)received;
+        }
+        size_t chunk = connection->end - connection->start;
+        if(chunk > length){
+            chunk = length;
+        }
+        if(data != NULL){
+            memcpy(data, connection->buffer + connection->start, chunk);
+            data += chunk;
+        }
+        connection->start += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+/**
+ * This function sends a request to the page and reads its response.
+ *
+ * @author Iqra Haq
+ * @param[out] connection - The connection to send the request on.
+ * @param[in] request - The request to send.
+ * @param[out] bytes - The number of bytes of output the page sent.
+ * \return int - Error status (including the page refusing the request).
+ */
+int send_request(struct bench_connection *connection, struct bench_request *request, unsigned long long *bytes)
+{
+    size_t sent = 0;
+    while(sent < request->length){
+        ssize_t written = write(connection->descriptor, request->records + sent, request->length - sent);
+        if(written < 0 && errno == EINTR){
+            continue;
+        }
+        if(written <= 0){
+            return 1;
+        }
+        sent += (size_t)written;
+    }
+
+    // Read records until the end of the request, counting the output.
+    while(1){
+        unsigned char header[FCGI_HEADER_LENGTH];
+        unsigned char end_body[8];
+        if(read_connection(connection, header, sizeof(header)) != 0){
+            return 1;
+        }
+        size_t content_length = ((size_t)header[4] << 8) | header[5];
+        size_t padding_length = header[6];
+        if(header[1] == FCGI_END_REQUEST && content_length == sizeof(end_body)){
+            if(read_connection(connection, end_body, sizeof(end_body)) != 0 || read_connection(connection, NULL, padding_length) != 0){
+                return 1;
+            }
+            // The protocol status is FCGI_REQUEST_COMPLETE (0) if the page answered the request.
+            return end_body[4] != 0;
+        }
+        if(header[1] == FCGI_STDOUT){
+            *bytes += content_length;
+        }
+        if(read_connection(connection, NULL, content_length + padding_length) != 0){
+            return 1;
+        }
+    }
+}
+
+/**
+ * This function sends requests from one connection until the benchmark is over, measuring the latency of each.
+ *
+ * @author Iqra Haq
+ * @param[in] argument - The worker's state.
+ * \return void * - NULL.
+ */
+void *bench_worker(void *argument)
+{
+    struct bench_worker *worker = argument;
+    struct bench_connection *connection = malloc(sizeof(*connection));
+    if(connection == NULL){
+        return NULL;
+    }
+    connection->descriptor = -1;
+
+    while(1){
+        long number = __sync_fetch_and_add(&next_request, 1);
+        int measured = (number >= options.warmup);
+        if(options.duration <= 0 && number >= options.warmup + options.requests){
+            break;
+        }
+        unsigned long long start = now_nanoseconds();
+        unsigned long long end = (options.duration > 0) ? __atomic_load_n(&measure_end, __ATOMIC_ACQUIRE) : 0;
+        if(end != 0 && start >= end){
+            break;
+        }
+
+        // Send the request (on a new connection, unless the last one was kept open).
+        struct bench_request *request = &request_mix[(size_t)number % request_mix_count];
+        unsigned long long bytes = 0;
+        int failed = 0;
+        if(connection->descriptor == -1){
+            connection->descriptor = connect_to_page();
+            connection->start = 0;
+            connection->end = 0;
+        }
+        if(connection->descriptor == -1 || send_request(connection, request, &bytes) != 0){
+            failed = 1;
+        }
+        if(connection->descriptor != -1 && (failed || !options.keep_connection)){
+            close(connection->descriptor);
+            connection->descriptor = -1;
+        }
+        unsigned long long latency = now_nanoseconds() - start;
+
+        if(!measured){
+            continue;
+        }
+        // The first measured request starts the clock (and the duration, if there is one).
+        if(__atomic_load_n(&measure_start, __ATOMIC_RELAXED) == 0 && __sync_bool_compare_and_swap(&measure_start, 0, start) && options.duration > 0){
+            __atomic_store_n(&measure_end, start + (unsigned long long)(options.duration * 1e9), __ATOMIC_RELEASE);
+        }
+        if(failed){
+            worker->errors++;
+            continue;
+        }
+        if(worker->latency_count == worker->latency_capacity){
+            size_t new_capacity = (worker->latency_capacity > 0) ? worker->latency_capacity * 2 : 4096;
+            unsigned long long *new_latencies = realloc(worker->latencies, new_capacity * sizeof(*new_latencies));
+            if(new_latencies == NULL){
+                worker->errors++;
+                continue;
+            }
+            worker->latencies = new_latencies;
+            worker->latency_capacity = new_capacity;
+        }
+        worker->latencies[worker->latency_count++] = latency;
+        worker->bytes += bytes;
+    }
+
+    if(connection->descriptor != -1){
+        close(connection->descriptor);
+    }
+    free(connection);
+    return NULL;
+}
+
+/**
+ * This function starts the page on a new Unix domain socket, given to it as its standard input as a web server would.
+ *
+ * @author Iqra Haq
+ * @param[in] exe_file_name - The name of the EXE File to start.
+ * \return pid_t - The process ID of the page, or -1 if it couldn't be started.
+ */
+pid_t start_page(const char *exe_file_name)
+{
+    struct sockaddr_un address;
+    int descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(descriptor == -1){
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    unlink(socket_path);
+    // The socket listens before the page starts, so requests sent while it is still starting up wait for it.
+    if(bind(descriptor, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(descriptor, 1024) == -1){
+        close(descriptor);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if(pid == 0){
+        // The FastCGI library accepts requests on the socket given as its standard input.
+        dup2(descriptor, STDIN_FILENO);
+        if(descriptor != STDIN_FILENO){
+            close(descriptor);
+        }
+        int null_descriptor = open("/dev/null", O_WRONLY);
+        if(null_descriptor != -1){
+            dup2(null_descriptor, STDOUT_FILENO);
+            close(null_descriptor);
+        }
+        execl(exe_file_name, exe_file_name, (char *)NULL);
+        _exit(127);
+    }
+    close(descriptor);
+    return pid;
+}
+
+/**
+ * This function compares two latencies, for sorting.
+ *
+ * @author Iqra Haq
+ * @param[in] first - The first latency.
+ * @param[in] second - The second latency.
+ * \return int - Which latency comes first.
+ */
+int compare_latencies(const void *first, const void *second)
+{
+    unsigned long long a = *(const unsigned long long *)first;
+    unsigned long long b = *(const unsigned long long *)second;
+    return (a > b) - (a < b);
+}
+
+/**
+ * This function finds a percentile of the sorted latencies (the nearest rank), in microseconds.
+ *
+ * @author Iqra Haq
+ * @param[in] latencies - The sorted latencies.
+ * @param[in] count - The number of latencies.
+ * @param[in] fraction - The percentile as a fraction (e.g. 0.99).
+ * \return double - The latency in microseconds.
+ */
+double percentile(const unsigned long long *latencies, size_t count, double fraction)
+{
+    if(count == 0){
+        return 0;
+    }
+    size_t rank = (size_t)(fraction * (double)count + 0.999999);
+    if(rank < 1){
+        rank = 1;
+    }
+    if(rank > count){
+        rank = count;
+    }
+    return (double)latencies[rank - 1] / 1000.0;
+}
+
+/**
+ * This function prints the results of the benchmark.
+ *
+ * @author Iqra Haq
+ * @param[in] page_name - The page that was measured.
+ * @param[in] latencies - The sorted latencies of every measured request.
+ * @param[in] count - The number of latencies.
+ * @param[in] errors - The number of requests that failed.
+ * @param[in] bytes - The number of bytes of output.
+ * @param[in] seconds - How long the measured requests took.
+ */
+void print_results(const char *page_name, const unsigned long long *latencies, size_t count, unsigned long long errors, unsigned long long bytes, double seconds)
+{
+    double total = 0;
+    unsigned long long histogram[BENCH_HISTOGRAM_BUCKETS] = { 0 };
+    for(size_t i = 0; i < count; i++){
+        total += (double)latencies[i];
+        // Bucket i holds latencies under 2^i microseconds (the last bucket holds the rest).
+        unsigned long long microseconds = latencies[i] / 1000;
+        size_t bucket = 0;
+        while(bucket < BENCH_HISTOGRAM_BUCKETS - 1 && (1ULL << bucket) <= microseconds){
+            bucket++;
+        }
+        histogram[bucket]++;
+    }
+    double mean = (count > 0) ? total / (double)count / 1000.0 : 0;
+    double rate = (seconds > 0) ? (double)count / seconds : 0;
+    double minimum = (count > 0) ? (double)latencies[0] / 1000.0 : 0;
+    double maximum = (count > 0) ? (double)latencies[count - 1] / 1000.0 : 0;
+
+    if(options.csv){
+        printf("page,concurrency,requests,errors,seconds,requests_per_second,bytes,min_us,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+        printf("%s,%ld,%zu,%llu,%.6f,%.2f,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", page_name, options.concurrency, count, errors, seconds, rate, bytes,
+               minimum, mean, percentile(latencies, count, 0.5), percentile(latencies, count, 0.9), percentile(latencies, count, 0.99), percentile(latencies, count, 0.999), maximum);
+        return;
+    }
+
+    printf("{\"page\":\"");
+    for(const char *character = page_name; *character != '\0'; character++){
+        if(*character == '"' || *character == '\\'){
+            putchar('\\');
+        }
+        putchar(*character);
+    }
+    printf("\",\"concurrency\":%ld,\"keep_connection\":%s,\"requests\":%zu,\"errors\":%llu,\"seconds\":%.6f,\"requests_per_second\":%.2f,\"bytes\":%llu,",
+           options.concurrency, options.keep_connection ? "true" : "false", count, errors, seconds, rate, bytes);
+    printf("\"latency_us\":{\"min\":%.1f,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},", minimum, mean,
+           percentile(latencies, count, 0.5), percentile(latencies, count, 0.9), percentile(latencies, count, 0.99), percentile(latencies, count, 0.999), maximum);
+    // The histogram lists the upper bound of each bucket that has any requests in it, with its count.
+    printf("\"histogram_us\":[");
+    int first = 1;
+    for(size_t bucket = 0; bucket < BENCH_HISTOGRAM_BUCKETS; bucket++){
+        if(histogram[bucket] > 0){
+            printf("%s[%llu,%llu]", first ? "" : ",", 1ULL << bucket, histogram[bucket]);
+            first = 0;
+        }
+    }
+    printf("]}\n");
+}
+
+/**
+ * The main function starts the page, sends it requests from every connection and prints the results.
+ *
+ * @author Iqra Haq
+ * @param[in] argc - The number of arguments.
+ * @param[in] argv - The arguments.
+ * \return int - Exit status (1 if the benchmark couldn't be run or any request failed).
+ */
+int main(int argc, char *argv[])
+{
+    const char *usage = "Usage: lhpBench [-c concurrency] [-n requests | -d seconds] [-w warmup] [-k] [-f json|csv] [-s socket] [-a socket] page.exe [requestsFile]";
+    char default_socket[64];
+    int option;
+    options.concurrency = 8;
+    options.requests = 10000;
+    options.warmup = 100;
+
+    while((option = getopt(argc, argv, "a:c:d:f:kn:s:w:")) != -1){
+        if(option == 'a'){
+            // Measure a page that is already running on this socket, rather than starting one.
+            options.attach_socket = optarg;
+        } else if(option == 'c'){
+            options.concurrency = strtol(optarg, NULL, 10);
+        } else if(option == 'd'){
+            options.duration = strtod(optarg, NULL);
+        } else if(option == 'f' && (strcmp(optarg, "json") == 0 || strcmp(optarg, "csv") == 0)){
+            options.csv = (strcmp(optarg, "csv") == 0);
+        } else if(option == 'k'){
+            options.keep_connection = 1;
+        } else if(option == 'n'){
+            options.requests = strtol(optarg, NULL, 10);
+        } else if(option == 's'){
+            socket_path = optarg;
+        } else if(option == 'w'){
+            options.warmup = strtol(optarg, NULL, 10);
+        } else {
+            fprintf(stderr, "%s\n", usage);
+            return 1;
+        }
+    }
+    // The page is needed unless one that is already running is measured, and the requests file is optional.
+    const char *page_name = (optind < argc && options.attach_socket == NULL) ? argv[optind++] : options.attach_socket;
+    const char *requests_file_name = (optind < argc) ? argv[optind++] : NULL;
+    if(page_name == NULL || optind != argc || options.concurrency < 1 || options.requests < 1 || options.warmup < 0){
+        fprintf(stderr, "%s\n", usage);
+        return 1;
+    }
+    if(options.attach_socket != NULL){
+        socket_path = options.attach_socket;
+    } else if(socket_path == NULL){
+        snprintf(default_socket, sizeof(default_socket), "/tmp/lhpBench-%ld.sock", (long)getpid());
+        socket_path = default_socket;
+    }
+    // A page that closes a connection early shouldn't end the benchmark.
+    signal(SIGPIPE, SIG_IGN);
+
+    if(load_request_mix(requests_file_name) != 0){
+        return 1;
+    }
+    pid_t page = -1;
+    if(options.attach_socket == NULL){
+        // The page is run by its path, so one in the current directory needs a "./" in front of it.
+        char *path = malloc(strlen(page_name) + 3);
+        if(path == NULL){
+            return 1;
+        }
+        snprintf(path, strlen(page_name) + 3, (strchr(page_name, '/') != NULL) ? "%s" : "./%s", page_name);
+        page = start_page(path);
+        free(path);
+        if(page == -1){
+            fprintf(stderr, "Error starting %s on %s, please try again...\n", page_name, socket_path);
+            return 1;
+        }
+    }
+
+    // Send the requests from every connection at once.
+    struct bench_worker *workers = calloc((size_t)options.concurrency, sizeof(*workers));
+    long started = 0;
+    if(workers != NULL){
+        for(; started < options.concurrency; started++){
+            if(pthread_create(&workers[started].thread, NULL, bench_worker, &workers[started]) != 0){
+                break;
+            }
+        }
+    }
+    for(long i = 0; i < started; i++){
+        pthread_join(workers[i].thread, NULL);
+    }
+    unsigned long long finish = now_nanoseconds();
+
+    if(page != -1){
+        int wait_status;
+        kill(page, SIGTERM);
+        waitpid(page, &wait_status, 0);
+        unlink(socket_path);
+    }
+    if(started == 0){
+        fprintf(stderr, "Error starting the connections, please try again...\n");
+        return 1;
+    }
+
+    // Gather the latencies from every connection and print the results.
+    size_t count = 0;
+    unsigned long long errors = 0;
+    unsigned long long bytes = 0;
+    for(long i = 0; i < started; i++){
+        count += workers[i].latency_count;
+        errors += workers[i].errors;
+        bytes += workers[i].bytes;
+    }
+    unsigned long long *latencies = malloc((count > 0 ? count : 1) * sizeof(*latencies));
+    if(latencies == NULL){
+        return 1;
+    }
+    size_t offset = 0;
+    for(long i = 0; i < started; i++){
+        memcpy(latencies + offset, workers[i].latencies, workers[i].latency_count * sizeof(*latencies));
+        offset += workers[i].latency_count;
+        free(workers[i].latencies);
+    }
+    qsort(latencies, count, sizeof(*latencies), compare_latencies);
+    double seconds = (measure_start != 0) ? (double)(finish - measure_start) / 1e9 : 0;
+    print_results(page_name, latencies, count, errors, bytes, seconds);
+
+    for(size_t i = 0; i < request_mix_count; i++){
+        free(request_mix[i].records);
+    }
+    free(request_mix);
+    free(latencies);
+    free(workers);
+    return (errors > 0) ? 1 : 0;
+}
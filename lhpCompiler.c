@@ -23,33 +23,402 @@
  */
 
 // These are the necessary pre-processor directives required for the library functions used by the prototype.
+// (fopencookie(), used for the LHP Log, is a GNU extension.)
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <stdarg.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <zlib.h>
+
+// The environment of the program, passed on to gcc and mysql_config.
+extern char **environ;
 
 
 /**
- * This function gets the current local date and time based on when the function is run. This will be vital for the LHP Log File.
- * 
- * @author Iqra Haq
- * \return A pointer to the Date&Time
+ * The kinds of segment that the front end splits an LHP File into.
  */
-char *get_current_date_and_time()
-{
-    // Variables that support storing date & time variables.
-    time_t raw_time;
-    struct tm * time_info;
+enum lhp_segment_kind {
+    // A relevant pre-processor directive (i.e. a "#include..." line).
+    LHP_DIRECTIVE,
+    // HTML before the first "<£lhp" start tag.
+    LHP_HEADER_HTML,
+    // C code between a pair of LHP tags.
+    LHP_C_BLOCK,
+    // C code between the "<£init" tag and its "£>" end tag, run once before the first request.
+    LHP_INIT_BLOCK,
+    // HTML between a "£>" end tag and the next "<£lhp" start tag.
+    LHP_INNER_HTML,
+    // HTML after the last "£>" end tag.
+    LHP_FOOTER_HTML
+};
+
+// Used in place of the position of a segment to mean every segment of a kind.
+#define LHP_ALL_SEGMENTS ((size_t)-1)
+
+/**
+ * A run of consecutive lines of the same kind within the memory-mapped LHP File.
+ */
+struct lhp_segment {
+    enum lhp_segment_kind kind;
+    // Start of the segment within the mapped file and its length (including new line characters).
+    const char *start;
+    size_t length;
+    // Line number that the segment starts on and the number of lines it covers.
+    size_t line_number;
+    size_t line_count;
+};
+
+/**
+ * The settings of a page's response cache, given by its cache tag (e.g. "<£cache ttl=10 key=QUERY_STRING,HTTP_COOKIE memory=4M £>").
+ */
+struct lhp_cache_settings {
+    // How many seconds a response is kept for (0 if the page isn't cached).
+    long ttl;
+    // The CGI variables that responses are cached by, as a comma separated list within the LHP File.
+    const char *key;
+    size_t key_length;
+    // Most bytes of responses kept at once.
+    unsigned long long memory;
+};
+
+// The CGI variable that responses are cached by, and how much memory the cache uses, unless the cache tag says otherwise.
+#define LHP_CACHE_DEFAULT_KEY "QUERY_STRING"
+#define LHP_CACHE_DEFAULT_MEMORY (4ULL * 1024 * 1024)
+
+/**
+ * A memory-mapped LHP File and the segment table built for it by the front end.
+ */
+struct lhp_source {
+    char *file_name;
+    // Contents of the file, mapped read only.
+    const char *data;
+    size_t size;
+    size_t line_count;
+    // Segment table (in the order that the segments appear in the file).
+    struct lhp_segment *segments;
+    size_t segment_count;
+    size_t segment_capacity;
+    // Counters for the LHP tags found, used for validation.
+    int head_counter;
+    int tail_counter;
+    // Number of LHP tags found where they don't belong (a start tag inside a C code block or an end tag outside of one).
+    int misplaced_counter;
+    // Counters for the init block tags.
+    int init_head_counter;
+    int init_tail_counter;
+    // The cache tag (if there is one, the last of them), how many were found and the settings it gives (filled in by file_checker).
+    const char *cache_tag;
+    size_t cache_tag_length;
+    int cache_counter;
+    struct lhp_cache_settings cache;
+    // Number of static tags found (marking a page whose responses only change when it is compiled again).
+    int static_counter;
+    // The ETag of the page's responses, if they only depend on the build (0 if they don't have one).
+    unsigned long long etag;
+    // The minified HTML segments point into this buffer rather than the mapped file (NULL unless the HTML was minified).
+    char *minified;
+};
+
+/**
+ * The toolchain used to compile every C File, found once at the start of each run of the program.
+ */
+struct lhp_toolchain {
+    // Output of "mysql_config --cflags --libs", split in place into separate flags.
+    char *mysql_output;
+    char **mysql_flags;
+    size_t mysql_flag_count;
+};
+
+/**
+ * The build profiles that pages can be compiled with.
+ */
+enum lhp_build_profile {
+    // Unoptimised, with debugging information.
+    LHP_DEBUG,
+    // Optimised (-O2, link time optimisation and unused sections left out).
+    LHP_RELEASE,
+    // As release, with profile-guided optimisation from replaying recorded requests.
+    LHP_PGO
+};
+
+// Most flags any build profile adds.
+#define LHP_MAX_PROFILE_FLAGS 8
+
+/**
+ * The options given by the user on the command line.
+ */
+struct lhp_options {
+    // Maximum number of LHP Files to compile at once.
+    long jobs;
+    // Compile LHP Files even if the build cache shows their EXE Files are up to date.
+    int force;
+    // Name of the bundle to link every page into (NULL to give each page an EXE File of its own).
+    char *bundle_name;
+    // Name of the host to build for pages compiled to shared object modules that it loads (NULL unless pages are built as modules).
+    char *host_name;
+    // Number of responder threads in each page (0 for a single-threaded page).
+    long threads;
+    // The build profile to compile pages with.
+    enum lhp_build_profile profile;
+    // Name of the file to write the metrics of each phase to (NULL if they aren't recorded).
+    char *metrics_file_name;
+    // Keep running after compiling, recompiling pages whenever they change.
+    int watch;
+    // Minify the HTML of each page before it is compiled in.
+    int minify;
+    // Send the header HTML of each response straight away, and the rest in chunks as it is written.
+    int stream;
+    // Give each page (or the bundle or host) a supervisor that runs a pool of workers when LHP_LISTEN is set.
+    int supervise;
+    // Whether pages record runtime metrics into shared memory, and whether to read them rather than compile anything.
+    int runtime_metrics;
+    int read_metrics;
+    // The toolchain, found once and shared by every LHP File (including those compiled by worker processes).
+    struct lhp_toolchain toolchain;
+    // Directory of the precompiled preamble shared by the LHP Files being compiled together (NULL if they don't use one).
+    char *preamble_directory;
+};
+
+// Most bytes of a streamed response kept back before they are sent.
+#define LHP_STREAM_CHUNK 16384
+
+// Status returned when an LHP File didn't need compiling as its EXE File is up to date.
+#define LHP_UP_TO_DATE 2
+
+/**
+ * A list of LHP Files to be compiled in batch mode.
+ */
+struct lhp_file_list {
+    char **names;
+    // Where the route of each LHP File starts within its name (used when pages are bundled).
+    size_t *route_starts;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * A directory watched for changes in watch mode, and the inotify watch descriptor it was given.
+ */
+struct lhp_watch {
+    int descriptor;
+    char *directory;
+};
+
+/**
+ * The list of directories watched for changes in watch mode.
+ */
+struct lhp_watch_list {
+    struct lhp_watch *watches;
+    size_t count;
+    size_t capacity;
+};
+
+// How long the watched directories must be quiet for after a change before the changed pages are compiled, in milliseconds.
+#define LHP_WATCH_DEBOUNCE 150
+
+/**
+ * An entry of the route table of a bundle.
+ */
+struct bundle_route {
+    char *route;
+    // Position of the page in the list of LHP Files (which gives the name of its handler) and its object file (or its module, for a host).
+    size_t index;
+    char *object_file_name;
+};
+
+/**
+ * A portion of HTML compressed at compile time, along with the checksums of the uncompressed HTML.
+ */
+struct compressed_html {
+    unsigned char *data;
+    size_t length;
+    size_t html_length;
+    unsigned long crc;
+    unsigned long adler;
+};
+
+
+// The layout of the shared memory segment that pages built with runtime metrics (-s) record into, as read by "lhpCompiler -r".
+// It must match the definitions in runtime_metrics_code, and the magic number must change along with it.
+#define LHP_METRICS_MAGIC 0x4c48504d45545231ULL
+#define LHP_METRICS_SLOTS 64
+#define LHP_METRICS_BUCKETS 32
+
+/**
+ * The counters of one process of a page (each on cache lines of its own, so that processes don't slow each other down).
+ */
+struct lhp_metrics_slot {
+    // The process using the slot (0 if no process has used it yet).
+    int pid;
+    int padding;
+    unsigned long long requests;
+    // Time spent in the header HTML, the C code block(s) and the footer HTML (which sends the response), in nanoseconds.
+    unsigned long long nanoseconds[3];
+    unsigned long long max_nanoseconds;
+    // The number of requests that took under 2^i microseconds (and at least half that) in bucket i.
+    unsigned long long histogram[LHP_METRICS_BUCKETS];
+} __attribute__((aligned(64)));
+
+/**
+ * The shared memory segment of a page.
+ */
+struct lhp_metrics_segment {
+    unsigned long long magic;
+    unsigned long long slot_size;
+    char page[64];
+    struct lhp_metrics_slot slots[LHP_METRICS_SLOTS];
+};
+
+/**
+ * The phases of compiling an LHP File that are timed when metrics are recorded.
+ */
+enum lhp_phase {
+    // Mapping the LHP File and building its segment table.
+    LHP_PHASE_LOAD,
+    // Checking the structure of the LHP File (file_checker).
+    LHP_PHASE_CHECK,
+    // Minifying the HTML segments (minify_html).
+    LHP_PHASE_MINIFY,
+    // Generating each part of the C File (analyse_preprocessor_directives, analyse_html, analyse_c and analyse_init).
+    LHP_PHASE_DIRECTIVES,
+    LHP_PHASE_HTML,
+    LHP_PHASE_C,
+    LHP_PHASE_INIT,
+    // Building the build cache record and comparing it to the saved one.
+    LHP_PHASE_CACHE,
+    // Writing the C File.
+    LHP_PHASE_WRITE,
+    // Running gcc (and, for profile-guided optimisation, replaying the recorded requests).
+    LHP_PHASE_COMPILE,
+    LHP_PHASE_COUNT
+};
+
+/**
+ * The time taken by a phase, along with the number of bytes and lines it dealt with.
+ */
+struct lhp_phase_metrics {
+    unsigned long long nanoseconds;
+    unsigned long long bytes;
+    unsigned long long lines;
+};
+
+/**
+ * The metrics recorded for an LHP File. In batch mode these are kept in memory shared with the worker processes.
+ */
+struct lhp_file_metrics {
+    struct lhp_phase_metrics phases[LHP_PHASE_COUNT];
+    unsigned long long total_nanoseconds;
+    // Peak memory use (resident set size in kilobytes) of the front end and of the programs it ran, such as gcc.
+    long peak_memory;
+    long peak_child_memory;
+    // The result of compiling the LHP File (as returned by compile_lhp_file), and whether it was compiled at all.
+    int status;
+    int recorded;
+};
+
+
+/**
+ * The formats that the LHP Log can be written in.
+ */
+enum lhp_log_format {
+    // A line of text per record (with any further lines of the message indented).
+    LHP_LOG_TEXT,
+    // A JSON object per line.
+    LHP_LOG_JSON,
+    // A fixed header per record followed by its strings (see struct lhp_log_record).
+    LHP_LOG_BINARY
+};
 
-    // Gets the time and date in Unix Timestamp format, i.e. 00:00:00 TTT, MMMM D YYYY.
-    time ( &raw_time );
-    // Puts the time retrieved into a structure of information so that the certain information is easy to extract.
-    time_info = localtime ( &raw_time );
+/**
+ * The severity of a record of the LHP Log.
+ */
+enum lhp_severity {
+    LHP_INFO,
+    LHP_WARNING,
+    LHP_ERROR
+};
+
+/**
+ * The header of each record of a binary LHP Log (48 bytes, in the byte order of the machine), followed by the name of the file,
+ * the phase and the message (none of them null terminated).
+ */
+struct lhp_log_record {
+    // LHP_LOG_MAGIC, and the length of the whole record (header and strings).
+    uint32_t magic;
+    uint32_t length;
+    // When the record was written (nanoseconds since the epoch), and how far into its phase.
+    uint64_t time;
+    uint64_t duration;
+    uint32_t job;
+    uint32_t pid;
+    uint16_t severity;
+    uint16_t file_length;
+    uint16_t phase_length;
+    uint16_t padding;
+    uint32_t message_length;
+    uint32_t reserved;
+};
+
+#define LHP_LOG_MAGIC 0x52504c48
+
+/**
+ * What the process is currently doing, which is added to every record it writes to the LHP Log.
+ * Worker processes each have their own copy (as they are forked), so they never share a record.
+ */
+struct lhp_log_context {
+    // The LHP Log, opened for appending so that each record can be added with a single write().
+    int descriptor;
+    enum lhp_log_format format;
+    // The job is the position of the LHP File in the list (starting from 1), or 0 for the run as a whole.
+    unsigned long job;
+    const char *file;
+    const char *phase;
+    unsigned long long phase_start;
+    // Text written to the log that doesn't end with a new line yet (records are only committed once they have ended).
+    char *pending;
+    size_t pending_length;
+    size_t pending_capacity;
+    // The severity of the message being written (set by log_message, and information for anything written to the log directly).
+    enum lhp_severity severity;
+};
+
+// What this process is currently doing (see struct lhp_log_context).
+struct lhp_log_context log_context = { -1, LHP_LOG_TEXT, 0, NULL, "run", 0, NULL, 0, 0, LHP_INFO };
 
-    // Returns the struct time_info as a char * so that all information is returned in a string format ready to print.
-    return asctime (time_info);
+/**
+ * This function writes a message to the LHP Log with the severity given, rather than as information
+ * (as anything written to the log with fprintf() is).
+ *
+ * @author Iqra Haq
+ * @param[out] lhp_log - The log file to write the message to.
+ * @param[in] severity - The severity of the message.
+ * @param[in] format - The message, formatted as with printf() (ending with a new line).
+ */
+void log_message(FILE *lhp_log, enum lhp_severity severity, const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    log_context.severity = severity;
+    vfprintf(lhp_log, format, arguments);
+    log_context.severity = LHP_INFO;
+    va_end(arguments);
 }
 
 /**
@@ -81,13 +450,14 @@ void remove_file_extension(char *file_name)
  * This function opens a file and outputs this as a FILE parameter by using the file name and the type specified as input parameters. 
  * If the file doesn't exist, the file will be created. 
  * The type specified will be the action used by the program to analyse the file, e.g. read, write or append.
- * If there is an issue opening the file, a log of this will be noted to the LHP Log File.
+ * If there is an issue opening the file, a log of this will be noted to the LHP Log File and NULL is returned,
+ * so that only the LHP File being compiled fails (rather than every file compiled by the same process).
  *
  * @author Iqra Haq
  * @param[in] file_name - The name of the file.
  * @param[in] type - The type of behaviour when opening the file (i.e. read, write, append).
  * @param[out] lhp_log - The log file to store any errors in.
- * \return FILE - Opened File
+ * \return FILE - Opened File (NULL if it couldn't be opened).
  */
 FILE *file_opener(char *file_name, const char *type, FILE *lhp_log)
 {   
@@ -96,9 +466,9 @@ FILE *file_opener(char *file_name, const char *type, FILE *lhp_log)
     // Validation to check if there were any issues opening the file.
     if(in_file_ptr == NULL){
     	// Log to be added to the LHP Log file if there were any issues and notification is outputted to user on this.
-        fprintf(lhp_log, "Error opening %s, please try again...\n", file_name);
+        log_message(lhp_log, LHP_ERROR, "Error opening %s, please try again...\n", file_name);
     	printf("There was an error processing this file. Please check LHP.log for further details!\n");
-        exit(1);
+        return NULL;
     } else {
     	// Successful file open, therefore return the opened FILE pointer.
         return in_file_ptr;
@@ -106,526 +476,6420 @@ FILE *file_opener(char *file_name, const char *type, FILE *lhp_log)
 }
 
 /**
- * This function checks the input file to see that the content structure of the file is consistent with an expected LHP file. 
- * If any errors are detected, sufficient output will be given to the user via the LHP Log file and a status number will be returned.
+ * This function finds the first occurence of a piece of text within a region of memory that isn't null terminated.
+ * The LHP File is memory-mapped rather than read line by line, so the usual strstr() searches can't be used on it.
  *
  * @author Iqra Haq
- * @param[in] file_name - The name of the input file.
- * @param[in] line - The data of the file to be read.
- * @param[out] lhp_log - The log file to store any errors in.
- * \return int - Error status.
+ * @param[in] start - The start of the region to search.
+ * @param[in] length - The length of the region to search.
+ * @param[in] text - The null terminated text to search for.
+ * \return const char * - Pointer to the first occurence of the text, or NULL if it wasn't found.
  */
-int file_checker(FILE *lhp_file, FILE *lhp_log, char *line, char *file_name)
+const char *find_text(const char *start, size_t length, const char *text)
 {
-	// LHP Tags and the sufficient counters for validation checks.
-    char *head = "<£lhp";
-    char *tail = "£>";
-    int lhp_counter = 0;
-    int head_counter = 0;
-    int tail_counter = 0;
-    // Status flag for any issues encountered, set at 0 for no errors yet.
-    int status = 0;
-  
-  	// As the file may have already been read line by line in a previous function, it has been rewinded so that the pointer position is put back to the beginning.
-    rewind(lhp_file);
-
-    // Variables required for dynamic memory allocation.
-    size_t len = 0;
-    ssize_t read;
-
-    // Loop through the file, line by line. This includes the use of dynamic memory manipulation with the getline() function.
-    while((read = getline(&line, &len, lhp_file)) != -1){
-
-    	// If the line ends with a new line character, replace this with a null terminator (as strstr() searches require null termination).
-        char *position;
-        if((position = strchr(line, '\n')) != NULL){
-            *position = '\0';
-        }
-       
-        // Count the occurences of LHP tags separately and store the count in separate counters.
-        if(strstr(line, head) != NULL){
-        	head_counter++;
-        } else if(strstr(line, tail) != NULL){
-            tail_counter++;
-        }
-
-        // Check that HTML doesn't contain any double quotations to avoid conflict with printf() encapsulation.
-        if ((head_counter + tail_counter) % 2 == 0){
-        	if(strstr(line, "\"")){
-    			// Log to be added to the LHP Log file if there were any issues and status changed to 1 (signifying error occured).
-		    	fprintf(lhp_log, "Error with %s file! This program does not permit double quotation marks in HTML code. Please replace these with single quotation marks!\n", file_name);
-		    	status = 1;
-        	}
-        }
-    }
-
-    // Calculate the total amount of LHP tags in file.
-    lhp_counter = head_counter + tail_counter;
-
-    //Validation for too many LHP tags.
-    if(lhp_counter > 2){
-		// Log to be added to the LHP Log file if there were any issues and status changed to 1 (signifying error occured).
-    	fprintf(lhp_log, "Error with %s file! Too many LHP tags detected in this file.\n", file_name);
-    	status = 1;
-    // Validation for too little LHP tags.
-    } else if (lhp_counter < 1) {
-		// Log to be added to the LHP Log file if there were any issues and status changed to 1 (signifying error occured).
-    	fprintf(lhp_log, "Error with %s file! No LHP tags detected in this file.\n", file_name);
-    	status = 1;
-    // Validation for inconsistent LHP tag pairings.
-    } else if (head_counter != tail_counter){
-		// Log to be added to the LHP Log file if there were any issues and status changed to 1 (signifying error occured).
-    	fprintf(lhp_log, "Error with %s file! LHP tag pairs are inconsistent. Either a start tag or an end tag is missing!\n", file_name);
-    	status = 1;
+    // Length of the text being searched for.
+    size_t text_length = strlen(text);
+    // End of the region in which a full match could still start.
+    const char *end = start + length;
+
+    // An empty region or a region shorter than the text can never contain it.
+    if(text_length == 0 || length < text_length){
+        return NULL;
     }
-        
-    // As dynamic memory manipulation was involved, freeing the memory once the analysis has succeeded is required.
-    free(line);
-    return status;
-    
+
+    // Jump from one occurence of the first character to the next rather than comparing at every position.
+    while((start = memchr(start, text[0], (end - start) - text_length + 1)) != NULL){
+        // Compare the remainder of the text once the first character has matched.
+        if(memcmp(start, text, text_length) == 0){
+            return start;
+        }
+        // Move past the failed match and stop once too little of the region is left.
+        start++;
+        if((size_t)(end - start) < text_length){
+            break;
+        }
+    }
+    return NULL;
 }
 
 /**
- * This function is 1st of the 3 major analysis functions of the program 
- * with the main aim of copying any pre-processor directives 
- * from the LHP File (lhp_file) to the top of the C File (intermediary_file).
- * This is the first user defined function called in the main function, 
- * therefore, any prints from this function will be at the top of the file.
- * 
+ * This function moves a cursor over a region of the memory-mapped LHP File one line at a time.
+ * The new line character is not included in the length of the line returned.
+ *
  * @author Iqra Haq
- * @param[in] lhp_file - The input file where data will be read from.
- * @param[out] intermediary_file - The output file where the data will be written to.
- * @param[in] line - The data of the file to be read and written.
+ * @param[in,out] cursor - The position to read the next line from, moved to the start of the line after it.
+ * @param[in] end - The end of the region being read.
+ * @param[out] line - The start of the line that was read.
+ * \return size_t - The length of the line that was read.
  */
-void analyse_preprocessor_directives(FILE *lhp_file, FILE *intermediary_file, char *line)
+size_t next_line(const char **cursor, const char *end, const char **line)
 {
-	// Insert the FastCGI Standard I/O Header Library into the intermediary file to enable FastCGI Functionality.
-    fprintf(intermediary_file, "%s\n", "#include \"fcgi_stdio.h\"");
-
-    // As the file may have already been read line by line in a previous function, it has been rewinded so that the pointer position is put back to the beginning.
-    rewind(lhp_file);
-    
-    // Variables required for dynamic memory allocation.
-    size_t len = 0;
-    ssize_t read;
-
-    // Loop through the file, line by line. This includes the use of dynamic memory manipulation with the getline() function.
-    while((read = getline(&line, &len, lhp_file)) != -1){
-
-    	// Variables for the loops have been made here for clarity (easier to identify that there are multiple "for" loops not just one).
-        int i, j;
-
-        // Loop through the line, letter by letter.
-        for(i=0; i<strlen(line); i++){
-
-        	// Skip any whitespace.
-            while(line[i] == ' ' || line[i] == '\t' || line[i] == '\n' || line[i] == '\r' || line[i] == '\f' || line[i] == '\v'){
-                i++;
-            }
-
-            // Check to see if the line is a relevant pre-processor directive (i.e. that it starts with a "#include...")
-            if((ispunct(line[i])) && (line[i] == '#') && (strstr(line, "#include") != NULL)){
-                // Remove any leading or trailing whitespace that the previous check may have omitted by looping through the line twice and comparing contents.
-                for(i=0; line[i]==' ' || line[i]=='\t'; i++) {}
-                for(j=0; line[i]; i++){
-                    line[j++]=line[i];
-                }
-    			// Null terminate the string (signals that the end of the string has been reached).
-                line[j]='\0';
-                // Print to file.
-                fprintf(intermediary_file, "%s", line);
-            } else {
-            	// Stop the loop once the whole line has been analysed so that the next line can be processed.
-                break;
-            }
-        }
-    }
+    // Find the end of the current line, or use the end of the region if the final line has no new line character.
+    const char *new_line = memchr(*cursor, '\n', end - *cursor);
+    const char *line_end = (new_line != NULL) ? new_line : end;
 
-    // As dynamic memory manipulation was involved, freeing the memory once the analysis has succeeded is required.
-    free(line);
-                
+    // Hand back the line and move the cursor to the start of the next one.
+    *line = *cursor;
+    *cursor = (new_line != NULL) ? new_line + 1 : end;
+    return line_end - *line;
 }
 
 /**
- * This function is 2nd of the 3 major analysis functions of the program with the main aim
- * of copying any HTML from the LHP File (lhp_file) to the C File (intermediary_file).
- * 
+ * This function adds a line of the LHP File to the segment table of the source.
+ * Lines of the same kind that directly follow each other are merged into a single segment so that
+ * the emitters can process whole blocks of HTML or C rather than individual lines.
+ *
  * @author Iqra Haq
- * @param[in] lhp_file - The input file where data will be read from.
- * @param[out] intermediary_file - The output file where the data will be written to.
- * @param[in] line - The data of the file to be read and written.
+ * @param[in,out] source - The source whose segment table is being built.
+ * @param[in] kind - The kind of segment the line belongs to.
+ * @param[in] start - The start of the line (including any leading whitespace that should be kept).
+ * @param[in] length - The length of the line including its new line character.
+ * @param[in] line_number - The line number of the line within the LHP File.
+ * \return int - Error status.
  */
-void analyse_html(FILE *lhp_file, FILE *intermediary_file, char *line)
+int add_segment_line(struct lhp_source *source, enum lhp_segment_kind kind, const char *start, size_t length, size_t line_number)
 {
+    // Pointer to the most recently added segment (if there is one).
+    struct lhp_segment *last = (source->segment_count > 0) ? &source->segments[source->segment_count - 1] : NULL;
 
-	// LHP Tags and the counter for the tags have been initialised to begin with.
-    char *head = "<£lhp";
-    char *tail = "£>";
-    int lhp_counter = 0;
-  
-    // As the file may have already been read line by line in a previous function, it has been rewinded so that the pointer position is put back to the beginning.
-    rewind(lhp_file);
-  
-
-    // Start the header function for the first portion of HTML.
-    fprintf(intermediary_file, "\n%s\n", "// Header HTML Function.");
-    fprintf(intermediary_file, "%s\n", "void header_html()\n{");
-    // Follwiing line allows for the code to be compatible with a web server and therefore viewable via a web browser.
-    fprintf(intermediary_file, "\t%s\n", "printf(\"Content-type: text/html\\n\\n\");");
-    
-    // Variables required for dynamic memory allocation.
-    size_t len = 0;
-    ssize_t read;
-
-    // Loop through the file, line by line. This includes the use of dynamic memory manipulation with the getline() function.
-    while((read = getline(&line, &len, lhp_file)) != -1){
-
-    	// If the line ends with a new line character, replace this with a null terminator (as strstr() searches require null termination).
-        char *position;
-        if((position = strchr(line, '\n')) != NULL){
-            *position = '\0';
-        }
-        
-        // Count the occurences of LHP tags and store the count in lhp_counter.
-        if((strstr(line, head) != NULL) || strstr(line, tail) != NULL){
-            lhp_counter++;
-        }
-        
-        // Find the occurence of the start LHP tag (as this indicates the end of the first (header) portion of HTML code.
-        if(strstr(line, head) != NULL){
-        	// Insert end bracket to end the header HTML function.
-            fprintf(intermediary_file, "}\n");
-            // Find the occurence of the corresponding end LHP tag.(as this indicates the start of the final (footer) portion of HTML code.)
-        } else if (strstr(line, tail) != NULL){
-    		// Start the footer function for the final portion of HTML.
-            fprintf(intermediary_file, "\n%s\n", "// Footer HTML Function.");
-            fprintf(intermediary_file, "%s\n", "void footer_html()\n{");
-        }
-
-
-        // Only target the HTML code by checking the LHP Counter to make sure it is an even number.
-        if(lhp_counter % 2 == 0){
-        	// Check to see that the "£>" (end/tail tag) isn't included with the HTML code (as the counter changes to even once this line is reached).
-            if(strstr(line, tail) == NULL){
-            	// Check to not include empty lines as these will also be wrapped around by printf() statements (therefore, printing empty lines).
-                if(line[0] != '\0'){
-                    // Print HTML code wrapped in "printf()" statements to the intermediary_file (the C File).
-                    // Printing will ensure HTML is sent straight to output, i.e. straight to the browser.
-                    fprintf(intermediary_file, "\tprintf(\"%s\");\n", line);
-                }
-            }
-        } 
-    }
-    // End bracket for the footer HTML function.
-    fprintf(intermediary_file, "}\n");
-    // As dynamic memory manipulation was involved, freeing the memory once the analysis has succeeded is required.
-    free(line);
+    // Extend the last segment if the line is of the same kind and carries straight on from it.
+    if(last != NULL && last->kind == kind && last->start + last->length == start){
+        last->length += length;
+        last->line_count++;
+        return 0;
+    }
+
+    // Grow the segment table (doubling its size) when it runs out of room.
+    if(source->segment_count == source->segment_capacity){
+        size_t capacity = (source->segment_capacity == 0) ? 16 : source->segment_capacity * 2;
+        struct lhp_segment *segments = realloc(source->segments, capacity * sizeof(*segments));
+        if(segments == NULL){
+            return 1;
+        }
+        source->segments = segments;
+        source->segment_capacity = capacity;
+    }
+
+    // Start a new segment with the line.
+    source->segments[source->segment_count].kind = kind;
+    source->segments[source->segment_count].start = start;
+    source->segments[source->segment_count].length = length;
+    source->segments[source->segment_count].line_number = line_number;
+    source->segments[source->segment_count].line_count = 1;
+    source->segment_count++;
+    return 0;
 }
 
 /**
- * This function is 3rd of the 3 major analysis functions of the program with the main aim
- * of copying any C code from the LHP File (lhp_file) to the C File (intermediary_file).
- * 
+ * This function is the front end of the program. It memory-maps the LHP File and reads through it once,
+ * splitting it into a table of segments (pre-processor directives, header HTML, the C code blocks, the HTML between them and footer HTML)
+ * along with the line numbers they started on. Validation and all of the analysis functions work from this table,
+ * so the LHP File never needs to be rewinded and read again.
+ * If there is an issue opening or reading the file, a log of this will be noted to the LHP Log File.
+ *
  * @author Iqra Haq
- * @param[in] lhp_file - The input file where data will be read from.
- * @param[out] intermediary_file - The output file where the data will be written to.
- * @param[in] line - The data of the file to be read and written.
+ * @param[in] file_name - The name of the LHP File.
+ * @param[out] source - The source to fill with the contents and segment table of the LHP File.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
  */
-void analyse_c(FILE *lhp_file, FILE *intermediary_file, char *line)
+int source_loader(char *file_name, struct lhp_source *source, FILE *lhp_log)
 {
-	// LHP Tags and the counter for the tags have been initialised to begin with.
+    // LHP Tags to look out for.
     char *head = "<£lhp";
     char *tail = "£>";
-    int lhp_counter = 0;
-    int indent_counter = 0;
-    // Pointer for indentation.
-    char *cLine = " ";
-
-    // As the file may have already been read line by line in a previous function, it has been rewinded so that the pointer position is put back to the beginning.
-    rewind(lhp_file);
+    char *init_head = "<£init";
+    char *cache_head = "<£cache";
+    char *static_head = "<£static";
+    // Information about the file (needed for its size).
+    struct stat file_info;
+    // Line counter so that each segment knows where it started.
+    size_t line_number = 0;
 
-    // Variables required for dynamic memory allocation.
-    size_t len = 0;
-    ssize_t read;
+    // Start with an empty source so that it can always be safely unloaded.
+    memset(source, 0, sizeof(*source));
+    source->file_name = file_name;
 
-    // Loop through the file, line by line. This includes the use of dynamic memory manipulation with the getline() function.
-    while((read = getline(&line, &len, lhp_file)) != -1){
-    	// If the line ends with a new line character, replace this with a null terminator (as strstr() searches require null termination).
-        char *position;
-        if((position = strchr(line, '\n')) != NULL){
-            *position = '\0';
+    // Open the file as a read only (avoid accidental file modifications) and find out how big it is.
+    int descriptor = open(file_name, O_RDONLY);
+    if(descriptor == -1 || fstat(descriptor, &file_info) == -1){
+        // Log to be added to the LHP Log file if there were any issues.
+        log_message(lhp_log, LHP_ERROR, "Error opening %s, please try again...\n", file_name);
+        if(descriptor != -1){
+            close(descriptor);
         }
+        return 1;
+    }
 
-        // Count the occurences of LHP tags and store the count in lhp_counter.
-        if((strstr(line, head) != NULL) || strstr(line, tail) != NULL){
-            lhp_counter++;
+    // Map the whole file into memory in one go (an empty file can't be mapped, and simply has no segments).
+    source->size = file_info.st_size;
+    if(source->size > 0){
+        void *data = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if(data == MAP_FAILED){
+            log_message(lhp_log, LHP_ERROR, "Error reading %s, please try again...\n", file_name);
+            close(descriptor);
+            return 1;
         }
+        source->data = data;
+        // Let the kernel know that the file will be read from start to finish.
+        madvise(data, source->size, MADV_SEQUENTIAL);
+    }
+    // The mapping stays valid after the file descriptor is closed.
+    close(descriptor);
 
-        // Calculate the indentation space of the C code block so that it can be removed when copying to C (intermediary) file.
-        if(strstr(line, "main(") != NULL){
-	        // Loop through the line, letter by letter.
-	        for(int i=0; i<=strlen(line); i++){
-                // Check for and count occurences of leading whitespace.
-	        	if(line[i] == ' ' || line[i] == '\t'){
-	        		indent_counter++;
-                    // Change blank spaces to tabs for better uniformity and space consistency.
-                    if(line[i] == ' '){
-                        line[i] = '\t';
+    // Cursor used to walk through the mapped file line by line.
+    const char *cursor = source->data;
+    const char *end = source->data + source->size;
+
+    // Loop through the file, line by line, exactly once.
+    while(cursor < end){
+        const char *line;
+        const char *line_start = cursor;
+        size_t length = next_line(&cursor, end, &line);
+        // Length of the line including its new line character (so that segments cover whole lines).
+        size_t full_length = cursor - line_start;
+        line_number++;
+        source->line_count++;
+
+        // Count the occurences of LHP tags separately. Both tags contain a "£", so lines without one can be skipped quickly.
+        // An end tag closes the init block if one is open, otherwise the C code block.
+        int in_init = (source->init_head_counter > source->init_tail_counter);
+        if(memchr(line, head[1], length) != NULL){
+            if(find_text(line, length, head) != NULL){
+                if(source->head_counter > source->tail_counter){
+                    source->misplaced_counter++;
+                }
+                source->head_counter++;
+                continue;
+            } else if(find_text(line, length, init_head) != NULL){
+                source->init_head_counter++;
+                continue;
+            } else if(find_text(line, length, cache_head) != NULL){
+                // The cache tag is a line of its own, with its end tag on the same line. Its settings are read by file_checker.
+                source->cache_tag = line;
+                source->cache_tag_length = length;
+                source->cache_counter++;
+                continue;
+            } else if(find_text(line, length, static_head) != NULL){
+                // The static tag is a line of its own too, and has no settings.
+                source->static_counter++;
+                continue;
+            } else if(find_text(line, length, tail) != NULL){
+                if(in_init){
+                    source->init_tail_counter++;
+                } else {
+                    if(source->tail_counter >= source->head_counter){
+                        source->misplaced_counter++;
                     }
-	        	} else {
-                    break;
+                    source->tail_counter++;
                 }
-	    	}
+                continue;
+            }
         }
 
-                   
-        // Only target the C code by checking the LHP Counter to make sure it is an odd number.
-        if(lhp_counter % 2 != 0){
-            // Check to make sure that the current line is bigger than the C code block indentation.
-            if(strlen(line) >= indent_counter){
-                // Point to the indentation, so that the line starts here.
-                cLine = &line[indent_counter];
-            } else {
-                // Keep line as is.
-                cLine = line;
-            }
-            
-        	// Relevant Pre-Processor Directives have already been processed, therefore, they have been omitted here to avoid duplication and other errors.
-            if(strstr(line, "#include") == NULL){
-	        	// Check to see that the "<£lhp" (start/head tag) isn't included with the HTML code (as the counter changes to odd once this line is reached).
-                if(strstr(line, head) == NULL){
-                	// Make sure to omit the main statement to avoid code being sent to C (intermediary) File in the wrong order.
-            		if(strstr(cLine, "main(") == NULL){
-                        // Make sure to omit the return statement as footer function call needs to be included first.
-                        if(strstr(cLine, "return 0") == NULL){
-                            // Make sure to indent the main function closing bracket.
-                            if((strcmp(cLine, "}") == 0)){
-                                // Doesn't need to be wrapped in printf() as C code is being sent to a C (intermediary) File.
-                                fprintf(intermediary_file, "%s\n", cLine);
-                            } else {
-                                // Doesn't need to be wrapped in printf() as C code is being sent to a C (intermediary) File.
-                                //Indent any extra lines accordingly.
-                                fprintf(intermediary_file, "\t\t%s\n", cLine);
-                            }
-                        }
-                        
-                	}
-                }
-            } 
+        // Skip any leading whitespace to see what the line starts with.
+        size_t i = 0;
+        while(i < length && isspace((unsigned char)line[i])){
+            i++;
         }
 
-
-        // Locate start of main function and indent any extra lines accordingly before printing.
-        if(strstr(line, "main(") != NULL){
-            // Print the main function line.
-            fprintf(intermediary_file, "%s\n", cLine);
-            // Insert relevant FastCGI while statement to allow for C code to be FastCGI compatible.
-            fprintf(intermediary_file, "\t%s\n", "while (FCGI_Accept() >= 0){");
-            // Insert header HTML function call into C code block before main.
-            fprintf(intermediary_file, "\t\t%s\n", "header_html();");
+        // Work out which segment the line belongs to. Relevant pre-processor directives (i.e. lines that start with a "#include...")
+        // are collected wherever they appear, everything else depends on which side of the LHP tags the line is on.
+        enum lhp_segment_kind kind;
+        if(i < length && line[i] == '#' && find_text(line, length, "#include") != NULL){
+            // Leading whitespace is left out of the directive.
+            kind = LHP_DIRECTIVE;
+            line_start += i;
+            full_length -= i;
+        } else if(in_init){
+            kind = LHP_INIT_BLOCK;
+        } else if((source->head_counter + source->tail_counter) % 2 != 0){
+            kind = LHP_C_BLOCK;
+        } else if(source->tail_counter > 0){
+            kind = LHP_FOOTER_HTML;
+        } else {
+            kind = LHP_HEADER_HTML;
         }
-            
-        // Locate the return statement of the main function and indent any extra lines accordingly before printing.
-        if(strstr(line, "return 0") != NULL){
-        	// Insert footer function call into C code block before main's return statement.
-            fprintf(intermediary_file, "\t\t%s\n", "footer_html();");
-            // Insert corresponding end bracket to the finish FastCGI while code block.
-            fprintf(intermediary_file, "\t%s\n", "}");
-            // Print remainder C code (expected to be the main's return statement).
-            fprintf(intermediary_file, "%s\n", cLine);
+
+        // Store the line in the segment table.
+        if(add_segment_line(source, kind, line_start, full_length, line_number) != 0){
+            log_message(lhp_log, LHP_ERROR, "Error with %s file! Not enough memory to process this file.\n", file_name);
+            return 1;
         }
+    }
 
+    // HTML after an end tag was taken to be footer HTML, but any of it that comes before a later C code block is HTML between the blocks.
+    size_t last_c_block = 0;
+    for(size_t i = 0; i < source->segment_count; i++){
+        if(source->segments[i].kind == LHP_C_BLOCK){
+            last_c_block = i;
+        }
     }
-    // As dynamic memory manipulation was involved, freeing the memory once the analysis has succeeded is required.
-    free(line);
+    for(size_t i = 0; i < last_c_block; i++){
+        if(source->segments[i].kind == LHP_FOOTER_HTML){
+            source->segments[i].kind = LHP_INNER_HTML;
+        }
+    }
+
+    return 0;
 }
 
 /**
- * This function is the final major function of the program with the main aim
- * of compiling the C File (intermediary_file) with enough compatibility for interaction with
- * SQL statements for database functionality and FastCGI for web server hosting.
- * 
+ * This function releases the memory-mapped LHP File, the segment table built for it and any minified HTML.
+ *
  * @author Iqra Haq
- * @param[in] file_name - The name of the file to be used.
- * @param[in] command - The pointer to the command.
- * @param[out] lhp_log - The log file to store any errors in. 
+ * @param[in,out] source - The source to release.
  */
-void compilation(char *file_name, char *command, FILE *lhp_log)
+void source_unloader(struct lhp_source *source)
 {
-    // Remove file extension so that the same name can be used for the outputted EXE file.
-    remove_file_extension(file_name);
+    // Unmap the LHP File (if anything was mapped) and free the segment table.
+    if(source->data != NULL){
+        munmap((void *)source->data, source->size);
+    }
+    free(source->segments);
+    free(source->minified);
+    memset(source, 0, sizeof(*source));
+}
 
-    // Calculate enough space for the static aspects of the command and the variable file name and store the value.
-    size_t command_length = 83 + ((strlen(file_name)*2));
-    // Change memory allocation from NULL (as specified in main) to the calculated value.
-    command = realloc(command, command_length);
+/**
+ * This function reads the settings of the response cache from the cache tag of an LHP File, e.g.
+ * "<£cache ttl=10 key=QUERY_STRING,HTTP_COOKIE memory=4M £>". The ttl (in seconds) must be given; the key
+ * (the CGI variables responses are cached by) and memory (with an optional K, M or G) have defaults.
+ *
+ * @author Iqra Haq
+ * @param[in,out] source - The source with the cache tag, whose cache settings are filled in.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
+ */
+int read_cache_tag(struct lhp_source *source, FILE *lhp_log)
+{
+    struct lhp_cache_settings *cache = &source->cache;
+    const char *start = find_text(source->cache_tag, source->cache_tag_length, "<£cache") + strlen("<£cache");
+    const char *end = find_text(start, (source->cache_tag + source->cache_tag_length) - start, "£>");
+    if(end == NULL){
+        log_message(lhp_log, LHP_ERROR, "Error with %s file! The cache tag must end with an end tag on the same line.\n", source->file_name);
+        return 1;
+    }
+    cache->key = LHP_CACHE_DEFAULT_KEY;
+    cache->key_length = strlen(LHP_CACHE_DEFAULT_KEY);
+    cache->memory = LHP_CACHE_DEFAULT_MEMORY;
 
-    // Conditional macro statements to check relevant Operating System is in use.
-    #ifdef _WIN32
-        // Output relevant log to lhp_log for Windows Operating System as being unusable for program.
-        fprintf(lhp_log, "%s\n", "Incorrect Operating System in use (OS: Windows).");
-        fprintf(lhp_log, "%s\n", "This program cannot be run on this OS.");
-        fprintf(lhp_log, "%s\n", "Please move to a Linux/Unix OS to use this.");
-        // Notification is outputted to user to check log file.
-    	printf("The program encountered an error. Please check LHP.log for further details!\n");
+    // Read each "name=value" setting in turn.
+    while(start < end){
+        while(start < end && isspace((unsigned char)*start)){
+            start++;
+        }
+        const char *value_end = start;
+        while(value_end < end && !isspace((unsigned char)*value_end)){
+            value_end++;
+        }
+        if(start == end){
+            break;
+        }
+        const char *equals = memchr(start, '=', value_end - start);
+        const char *value = (equals != NULL) ? equals + 1 : value_end;
+        size_t name_length = (equals != NULL) ? (size_t)(equals - start) : 0;
+        size_t value_length = value_end - value;
+        char number[32];
+        char *number_end = number;
+        snprintf(number, sizeof(number), "%.*s", (int)value_length, value);
+        if(name_length == 3 && strncmp(start, "ttl", 3) == 0){
+            cache->ttl = strtol(number, &number_end, 10);
+            if(value_length == 0 || *number_end != '\0' || cache->ttl <= 0){
+                log_message(lhp_log, LHP_ERROR, "Error with %s file! The ttl of the cache tag must be a number of seconds.\n", source->file_name);
+                return 1;
+            }
+        } else if(name_length == 3 && strncmp(start, "key", 3) == 0){
+            // The key is a comma separated list of CGI variable names.
+            int valid = (value_length > 0 && value[0] != ',' && value[value_length - 1] != ',');
+            for(size_t i = 0; i < value_length; i++){
+                valid &= (isalnum((unsigned char)value[i]) || value[i] == '_' || (value[i] == ',' && value[i + 1] != ','));
+            }
+            if(!valid){
+                log_message(lhp_log, LHP_ERROR, "Error with %s file! The key of the cache tag must be a comma separated list of CGI variables.\n", source->file_name);
+                return 1;
+            }
+            cache->key = value;
+            cache->key_length = value_length;
+        } else if(name_length == 6 && strncmp(start, "memory", 6) == 0){
+            cache->memory = strtoull(number, &number_end, 10);
+            const char *units = "KMG";
+            const char *unit = (*number_end != '\0') ? strchr(units, toupper((unsigned char)*number_end)) : NULL;
+            if(unit != NULL && number_end[1] == '\0'){
+                cache->memory <<= 10 * (unit - units + 1);
+                number_end++;
+            }
+            if(value_length == 0 || *number_end != '\0' || cache->memory == 0){
+                log_message(lhp_log, LHP_ERROR, "Error with %s file! The memory of the cache tag must be a number of bytes (optionally followed by K, M or G).\n", source->file_name);
+                return 1;
+            }
+        } else {
+            log_message(lhp_log, LHP_ERROR, "Error with %s file! Unknown setting in the cache tag: %.*s\n", source->file_name, (int)(value_end - start), start);
+            return 1;
+        }
+        start = value_end;
+    }
 
-    #elif __linux__
-        // Output relevant log to lhp_log for Linux Operating System in use.
-        fprintf(lhp_log, "%s\n", "Correct Operating System in use (OS: Linux).");
-        // Construct the correct command by inserting file name with correctly appended file extensions and static command aspects.
-        strcpy(command, "gcc -g -std=c99 -Wall -o ");
-        command = strcat(command, file_name);
-        command = strcat(command, ".exe ");
-        command = strcat(command, file_name);
-        // Include relevant compatibility and append any errors to LHP Log.
-        command = strcat(command, ".c -lfcgi `mysql_config --cflags --libs` 2>> LHP.log");
-    #elif __unix__
-        // Output relevant log to lhp_log for Unix Operating System in use.
-        fprintf(lhp_log, "%s\n", "Correct Operating System in use (OS: Unix).");
-        // Construct the correct command by inserting file name with correctly appended file extensions and static command aspects.
-        strcpy(command, "gcc -g -std=c99 -Wall -lfcgi -o ");
-        command = strcat(command, file_name);
-        command = strcat(command, ".exe ");
-        command = strcat(command, file_name);
-        // Include relevant compatibility and append any errors to LHP Log.
-        command = strcat(command, ".c -lfcgi `mysql_config --cflags --libs` 2>> LHP.log");
-    #else
-        // Output relevant log to lhp_log for Other Operating System as being unusable for program.
-        fprintf(lhp_log, "%s\n", "Incorrect Operating System in use (OS: Other).");
-        fprintf(lhp_log, "%s\n", "This program cannot be run on this OS.");
-        fprintf(lhp_log, "%s\n", "Please move to a Linux/Unix OS to use this.");
-        // Notification is outputted to user to check log file.
-    	printf("The program encountered an error. Please check LHP.log for further details!\n");
-    #endif
-    
-    // Issue the command with system() and wrap with a check to make sure that the command was successfully executed.
-    if(system(command) == 0){
-        // Output relevant log for successful execution to the LHP Log.
-        fprintf(lhp_log, "The file '%s.exe' has been successfully compiled.\n", file_name);
+    if(cache->ttl <= 0){
+        log_message(lhp_log, LHP_ERROR, "Error with %s file! The cache tag must give a ttl (e.g. ttl=10).\n", source->file_name);
+        return 1;
     }
+    return 0;
+}
+
+/**
+ * This function checks the input file to see that the content structure of the file is consistent with an expected LHP file. 
+ * HTML is escaped when it is compiled, so it may contain any characters (including double quotation marks).
+ * If any errors are detected, sufficient output will be given to the user via the LHP Log file and a status number will be returned.
+ *
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the input file.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
+ */
+int file_checker(struct lhp_source *source, FILE *lhp_log)
+{
+    // Status flag for any issues encountered, set at 0 for no errors yet.
+    int status = 0;
+    // Total amount of LHP tags counted by the front end.
+    int lhp_counter = source->head_counter + source->tail_counter;
 
-    // Free the allocated memory used for the command.
-    free(command);
+    // Validation for too little LHP tags (any number of C code blocks is allowed).
+    if (lhp_counter < 1) {
+        // Log to be added to the LHP Log file if there were any issues and status changed to 1 (signifying error occured).
+        log_message(lhp_log, LHP_ERROR, "Error with %s file! No LHP tags detected in this file.\n", source->file_name);
+        status = 1;
+    // Validation for inconsistent LHP tag pairings.
+    } else if (source->head_counter != source->tail_counter){
+        // Log to be added to the LHP Log file if there were any issues and status changed to 1 (signifying error occured).
+        log_message(lhp_log, LHP_ERROR, "Error with %s file! LHP tag pairs are inconsistent. Either a start tag or an end tag is missing!\n", source->file_name);
+        status = 1;
+    // Validation for LHP tags in the wrong order (C code blocks can't be nested).
+    } else if (source->misplaced_counter > 0){
+        log_message(lhp_log, LHP_ERROR, "Error with %s file! LHP tags are out of order. Each start tag must be followed by an end tag before the next start tag!\n", source->file_name);
+        status = 1;
+    // Validation for the (optional) init block.
+    } else if(source->init_head_counter > 1){
+        log_message(lhp_log, LHP_ERROR, "Error with %s file! Only one init block is allowed in this file.\n", source->file_name);
+        status = 1;
+    } else if(source->init_head_counter != source->init_tail_counter){
+        log_message(lhp_log, LHP_ERROR, "Error with %s file! The init block is missing its end tag!\n", source->file_name);
+        status = 1;
+    // Validation for the (optional) cache tag.
+    } else if(source->cache_counter > 1){
+        log_message(lhp_log, LHP_ERROR, "Error with %s file! Only one cache tag is allowed in this file.\n", source->file_name);
+        status = 1;
+    } else if(source->cache_counter == 1){
+        status = read_cache_tag(source, lhp_log);
+    }
+    // Validation for the (optional) static tag.
+    if(status == 0 && source->static_counter > 1){
+        log_message(lhp_log, LHP_ERROR, "Error with %s file! Only one static tag is allowed in this file.\n", source->file_name);
+        status = 1;
+    }
 
+    return status;
 }
 
-
 /**
-* This is main function of the program. This is where all the functions will be called.
-* The order of the statements within the main function matter as all statements are 
-* essentially global statements and have effects on the user-defined functions.
-* Argument variable parameters passed at run-time have been used rather than continuous
-* user interaction for ease of use and essential interaction only.
-*
-* @author Iqra Haq
-* @param[in] argc - Number of argument parameters supplied by user.
-* @param[in] argv - List of arguments supplied by user.
-* \return int - Error status.
-*/
-int main (int argc, char* argv[])
+ * This function checks whether the text at a position starts with a tag of the given name (e.g. "<pre" or "</pre"),
+ * ignoring case, and that the name isn't just the start of a longer one.
+ *
+ * @author Iqra Haq
+ * @param[in] position - The position of the "<" that might start the tag.
+ * @param[in] end - The end of the text.
+ * @param[in] name - The name of the tag, with its "<" or "</".
+ * \return int - 1 if the tag starts at the position, 0 if not.
+ */
+int starts_with_tag(const char *position, const char *end, const char *name)
 {
+    size_t length = strlen(name);
+    if((size_t)(end - position) < length || strncasecmp(position, name, length) != 0){
+        return 0;
+    }
+    return position + length == end || isspace((unsigned char)position[length]) || position[length] == '>' || position[length] == '/';
+}
 
-    // Relevant FILE variables created. (Note: EXE File is created during compilation function's system() call)
-    FILE *lhp_file = NULL;
-    FILE *intermediary_file = NULL;
-    FILE *lhp_log = NULL;
-
-    //Dynamic Memory Allocation (Length of file_name will vary).
-    char *command = NULL;
-    char *line = NULL;
-    char *date_and_time = get_current_date_and_time();
+/**
+ * This function minifies the HTML segments of an LHP File before they are compiled in. Comments are left out
+ * (apart from conditional comments), runs of whitespace between tags are collapsed to a single space (or a new
+ * line if there was one), and whitespace within tags (outside of quoted values) is collapsed too. The contents of
+ * <pre>, <textarea>, <script> and <style> elements are kept exactly as they are. The HTML is read in the order it
+ * appears in the file, so an element or comment can run across C code blocks, but every segment keeps some
+ * whitespace at each end if it had any, as the C code blocks might print text next to it.
+ *
+ * @author Iqra Haq
+ * @param[in,out] source - The source whose HTML segments are minified (pointed into source->minified).
+ * @param[out] lhp_log - The log file to report the bytes saved in.
+ * \return size_t - Number of bytes of HTML saved.
+ */
+size_t minify_html(struct lhp_source *source, FILE *lhp_log)
+{
+    // Elements whose contents are kept as they are.
+    const char *const kept_starts[] = { "<pre", "<textarea", "<script", "<style", NULL };
+    const char *const kept_ends[] = { "</pre", "</textarea", "</script", "</style", NULL };
+    enum { IN_TEXT, IN_TAG, IN_QUOTE, IN_COMMENT, IN_KEPT } state = IN_TEXT;
+    // The element being kept (or about to be, once its start tag ends) and the quote character of a quoted value.
+    int kept = -1;
+    char quote = 0;
+    size_t before = 0;
+    size_t after = 0;
+
+    // Minifying never makes the HTML any longer, so a buffer the size of the file is always big enough.
+    source->minified = malloc(source->size > 0 ? source->size : 1);
+    if(source->minified == NULL){
+        return 0;
+    }
+    char *output = source->minified;
+    for(size_t index = 0; index < source->segment_count; index++){
+        struct lhp_segment *segment = &source->segments[index];
+        if(segment->kind != LHP_HEADER_HTML && segment->kind != LHP_INNER_HTML && segment->kind != LHP_FOOTER_HTML){
+            continue;
+        }
+        const char *position = segment->start;
+        const char *end = segment->start + segment->length;
+        char *start = output;
+        // Whitespace waiting to be written (0, a space or a new line) once something other than whitespace follows it.
+        char space = 0;
+        while(position < end){
+            char character = *position;
+            if(state == IN_TEXT){
+                if(isspace((unsigned char)character)){
+                    space = (character == '\n' || space == '\n') ? '\n' : ' ';
+                    position++;
+                    continue;
+                }
+                if(end - position >= 4 && memcmp(position, "<!--", 4) == 0 && !(end - position >= 5 && position[4] == '[')){
+                    state = IN_COMMENT;
+                    position += 4;
+                    continue;
+                }
+                if(space != 0){
+                    *output++ = space;
+                    space = 0;
+                }
+                if(character == '<'){
+                    for(int name = 0; kept_starts[name] != NULL; name++){
+                        if(starts_with_tag(position, end, kept_starts[name])){
+                            kept = name;
+                        }
+                    }
+                    state = IN_TAG;
+                }
+                *output++ = character;
+            } else if(state == IN_TAG){
+                if(isspace((unsigned char)character)){
+                    // Whitespace between attributes becomes a single space (and none before the end of the tag).
+                    if(output == start || output[-1] != ' '){
+                        *output++ = ' ';
+                    }
+                    position++;
+                    continue;
+                }
+                if(character == '>'){
+                    if(output > start && output[-1] == ' '){
+                        output--;
+                    }
+                    state = (kept >= 0) ? IN_KEPT : IN_TEXT;
+                } else if(character == '"' || character == '\''){
+                    quote = character;
+                    state = IN_QUOTE;
+                }
+                *output++ = character;
+            } else if(state == IN_QUOTE){
+                if(character == quote){
+                    state = IN_TAG;
+                }
+                *output++ = character;
+            } else if(state == IN_COMMENT){
+                if(end - position >= 3 && memcmp(position, "-->", 3) == 0){
+                    state = IN_TEXT;
+                    position += 3;
+                } else {
+                    position++;
+                }
+                continue;
+            } else {
+                // The end tag of the kept element is left to be written as any other tag.
+                if(character == '<' && starts_with_tag(position, end, kept_ends[kept])){
+                    kept = -1;
+                    state = IN_TEXT;
+                    continue;
+                }
+                *output++ = character;
+            }
+            position++;
+        }
+        if(space != 0){
+            *output++ = space;
+        }
+        before += segment->length;
+        after += output - start;
+        segment->start = start;
+        segment->length = output - start;
+    }
+
+    fprintf(lhp_log, "Minified the HTML of %s from %zu to %zu bytes (%zu saved).\n", source->file_name, before, after, before - after);
+    return before - after;
+}
+
+/**
+ * This function prints a block of code that the generated C File always needs, one line at a time.
+ *
+ * @author Iqra Haq
+ * @param[in] lines - The lines of code to print, ending with a NULL.
+ * @param[out] intermediary_file - The output file where the code will be written to.
+ */
+void print_lines(const char *const lines[], FILE *intermediary_file)
+{
+    for(size_t i = 0; lines[i] != NULL; i++){
+        fprintf(intermediary_file, "%s\n", lines[i]);
+    }
+}
+
+// Code that captures the output of the C code blocks while the response is put together.
+// This comes before "fcgi_stdio.h" in the C File as it needs the C library's own FILE rather than the FastCGI one.
+const char *const body_capture_code[] = {
+    "",
+    "// A portion of static HTML: as it is (with any response headers before it) and compressed at compile time,",
+    "// with the checksums and length of the HTML so that encoded responses can carry on the checksums over it.",
+    "struct lhp_html {",
+    "\tconst char *data;",
+    "\tsize_t length;",
+    "\tconst char *deflated;",
+    "\tsize_t deflated_length;",
+    "\tunsigned long crc;",
+    "\tunsigned long adler;",
+    "\tunsigned long html_length;",
+    "};",
+    "",
+    "// A piece of the response: static HTML sent from where it is, or (if html is NULL) a run of the captured output.",
+    "struct lhp_piece {",
+    "\tconst struct lhp_html *html;",
+    "\tsize_t offset;",
+    "\tsize_t length;",
+    "};",
+    "",
+    "// Output of the C code blocks, captured in memory while the response is put together.",
+    "LHP_PER_REQUEST FILE *lhp_body_stream = NULL;",
+    "LHP_PER_REQUEST char *lhp_body = NULL;",
+    "LHP_PER_REQUEST size_t lhp_body_length = 0;",
+    "// Pieces of the response so far, and how much of the captured output they cover.",
+    "LHP_PER_REQUEST struct lhp_piece *lhp_pieces = NULL;",
+    "LHP_PER_REQUEST size_t lhp_piece_count = 0;",
+    "LHP_PER_REQUEST size_t lhp_piece_capacity = 0;",
+    "LHP_PER_REQUEST size_t lhp_body_mark = 0;",
+    "",
+    "// Starts capturing into a fresh buffer (releasing one left behind by a response that never reached footer_html()).",
+    "static void *lhp_body_open(void)",
+    "{",
+    "\tif (lhp_body_stream != NULL) {",
+    "\t\tfclose(lhp_body_stream);",
+    "\t}",
+    "\tfree(lhp_body);",
+    "\tlhp_body = NULL;",
+    "\tlhp_piece_count = 0;",
+    "\tlhp_body_mark = 0;",
+    "\tlhp_body_stream = open_memstream(&lhp_body, &lhp_body_length);",
+    "\treturn lhp_body_stream;",
+    "}",
+    "",
+    "// Stops capturing, leaving the captured output in lhp_body.",
+    "static void lhp_body_close(void)",
+    "{",
+    "\tfclose(lhp_body_stream);",
+    "\tlhp_body_stream = NULL;",
+    "}",
+    "",
+    "// Adds a piece to the response, returning -1 if there isn't enough memory for it.",
+    "static int lhp_add_piece(const struct lhp_html *html, size_t offset, size_t length)",
+    "{",
+    "\tif (lhp_piece_count == lhp_piece_capacity) {",
+    "\t\tsize_t capacity = (lhp_piece_capacity == 0) ? 16 : lhp_piece_capacity * 2;",
+    "\t\tstruct lhp_piece *pieces = realloc(lhp_pieces, capacity * sizeof(*pieces));",
+    "\t\tif (pieces == NULL) {",
+    "\t\t\treturn -1;",
+    "\t\t}",
+    "\t\tlhp_pieces = pieces;",
+    "\t\tlhp_piece_capacity = capacity;",
+    "\t}",
+    "\tlhp_pieces[lhp_piece_count].html = html;",
+    "\tlhp_pieces[lhp_piece_count].offset = offset;",
+    "\tlhp_pieces[lhp_piece_count].length = length;",
+    "\tlhp_piece_count++;",
+    "\treturn 0;",
+    "}",
+    "",
+    "// Writes to the captured output directly (rather than through stdout, which may be the FastCGI one).",
+    "static void lhp_body_write(const char *data, size_t length)",
+    "{",
+    "\tfwrite(data, 1, length, lhp_body_stream);",
+    "}",
+    "",
+    "static void lhp_body_vprintf(const char *format, va_list arguments)",
+    "{",
+    "\tvfprintf(lhp_body_stream, format, arguments);",
+    "}",
+    "",
+    "// Ends the current run of captured output as a piece of its own, so that static HTML can be added after it.",
+    "static int lhp_cut_body(void)",
+    "{",
+    "\tfflush(lhp_body_stream);",
+    "\tif (lhp_body_length == lhp_body_mark) {",
+    "\t\treturn 0;",
+    "\t}",
+    "\tif (lhp_add_piece(NULL, lhp_body_mark, lhp_body_length - lhp_body_mark) != 0) {",
+    "\t\treturn -1;",
+    "\t}",
+    "\tlhp_body_mark = lhp_body_length;",
+    "\treturn 0;",
+    "}",
+    "",
+    "// Forgets the pieces and captured output once they have been sent, capturing again from the start of the buffer.",
+    "static inline void lhp_body_rewind(void)",
+    "{",
+    "\tfseek(lhp_body_stream, 0, SEEK_SET);",
+    "\tfflush(lhp_body_stream);",
+    "\tlhp_piece_count = 0;",
+    "\tlhp_body_mark = 0;",
+    "}",
+    "",
+    NULL
+};
+
+// Output functions of a threaded page. Each thread has a FastCGI request of its own, so the output of the C code block
+// (printf(), fwrite() to stdout and so on) is sent to the output stream of that thread's request rather than a global one,
+// and getenv() and reading stdin look at that request's parameters and input.
+const char *const threaded_output_code[] = {
+    "#include <pthread.h>",
+    "#include \"fcgiapp.h\"",
+    "",
+    "// The request being handled by this thread, and where its output is captured while an encoded response is sent (if anywhere).",
+    "static __thread FCGX_Request *lhp_request = NULL;",
+    "static __thread FILE *lhp_capture = NULL;",
+    "",
+    "static void lhp_output_capture(void *stream)",
+    "{",
+    "\tlhp_capture = stream;",
+    "}",
+    "",
+    "static void lhp_output_release(void)",
+    "{",
+    "\tlhp_capture = NULL;",
+    "}",
+    "",
+    "// Sends gathered pieces of the response into the output buffer of this thread's request.",
+    "static void lhp_output_gather(struct iovec *iov, int count)",
+    "{",
+    "\tfor (int i = 0; i < count; i++) {",
+    "\t\tFCGX_PutStr(iov[i].iov_base, (int)iov[i].iov_len, lhp_request->out);",
+    "\t}",
+    "}",
+    "",
+    "// Pushes what has been sent so far on to the web server.",
+    "static inline void lhp_output_flush(void)",
+    "{",
+    "\tFCGX_FFlush(lhp_request->out);",
+    "}",
+    "",
+    "static inline int lhp_vfprintf(FILE *stream, const char *format, va_list arguments)",
+    "{",
+    "\tif (stream != stdout) {",
+    "\t\treturn vfprintf(stream, format, arguments);",
+    "\t}",
+    "\treturn (lhp_capture != NULL) ? vfprintf(lhp_capture, format, arguments) : FCGX_VFPrintF(lhp_request->out, format, arguments);",
+    "}",
+    "",
+    "static inline int lhp_printf(const char *format, ...)",
+    "{",
+    "\tva_list arguments;",
+    "\tva_start(arguments, format);",
+    "\tint length = lhp_vfprintf(stdout, format, arguments);",
+    "\tva_end(arguments);",
+    "\treturn length;",
+    "}",
+    "",
+    "static inline int lhp_fprintf(FILE *stream, const char *format, ...)",
+    "{",
+    "\tva_list arguments;",
+    "\tva_start(arguments, format);",
+    "\tint length = lhp_vfprintf(stream, format, arguments);",
+    "\tva_end(arguments);",
+    "\treturn length;",
+    "}",
+    "",
+    "static inline size_t lhp_fwrite(const void *data, size_t size, size_t count, FILE *stream)",
+    "{",
+    "\tif (stream != stdout || lhp_capture != NULL) {",
+    "\t\treturn fwrite(data, size, count, (stream != stdout) ? stream : lhp_capture);",
+    "\t}",
+    "\tif (size == 0 || count == 0) {",
+    "\t\treturn 0;",
+    "\t}",
+    "\treturn (FCGX_PutStr(data, (int)(size * count), lhp_request->out) < 0) ? 0 : count;",
+    "}",
+    "",
+    "static inline int lhp_fputs(const char *text, FILE *stream)",
+    "{",
+    "\treturn (lhp_fwrite(text, 1, strlen(text), stream) == strlen(text)) ? 0 : EOF;",
+    "}",
+    "",
+    "static inline int lhp_puts(const char *text)",
+    "{",
+    "\treturn (lhp_fputs(text, stdout) == 0 && lhp_fputs(\"\\n\", stdout) == 0) ? 0 : EOF;",
+    "}",
+    "",
+    "static inline int lhp_putchar(int c)",
+    "{",
+    "\tunsigned char byte = (unsigned char)c;",
+    "\treturn (lhp_fwrite(&byte, 1, 1, stdout) == 1) ? byte : EOF;",
+    "}",
+    "",
+    "static inline int lhp_fflush(FILE *stream)",
+    "{",
+    "\tif (stream != stdout) {",
+    "\t\treturn fflush(stream);",
+    "\t}",
+    "\treturn (lhp_capture != NULL) ? fflush(lhp_capture) : FCGX_FFlush(lhp_request->out);",
+    "}",
+    "",
+    "static inline size_t lhp_fread(void *data, size_t size, size_t count, FILE *stream)",
+    "{",
+    "\tif (stream != stdin) {",
+    "\t\treturn fread(data, size, count, stream);",
+    "\t}",
+    "\tif (size == 0 || count == 0) {",
+    "\t\treturn 0;",
+    "\t}",
+    "\treturn FCGX_GetStr(data, (int)(size * count), lhp_request->in) / size;",
+    "}",
+    "",
+    "static inline int lhp_getchar(void)",
+    "{",
+    "\treturn FCGX_GetChar(lhp_request->in);",
+    "}",
+    "",
+    "// Outside a request (e.g. in main() before the threads start) the process's own environment is read.",
+    "static inline char *lhp_getenv(const char *name)",
+    "{",
+    "\treturn (lhp_request != NULL) ? FCGX_GetParam(name, lhp_request->envp) : getenv(name);",
+    "}",
+    "",
+    "#undef printf",
+    "#define printf lhp_printf",
+    "#undef fprintf",
+    "#define fprintf lhp_fprintf",
+    "#undef fwrite",
+    "#define fwrite lhp_fwrite",
+    "#undef fputs",
+    "#define fputs lhp_fputs",
+    "#undef puts",
+    "#define puts lhp_puts",
+    "#undef putchar",
+    "#define putchar lhp_putchar",
+    "#undef fflush",
+    "#define fflush lhp_fflush",
+    "#undef fread",
+    "#define fread lhp_fread",
+    "#undef getchar",
+    "#define getchar lhp_getchar",
+    "#undef getenv",
+    "#define getenv lhp_getenv",
+    NULL
+};
+
+// Output functions of a page using the FastCGI Standard I/O library, which sends the output to a single global stream.
+const char *const stdio_output_code[] = {
+    "",
+    "// The FastCGI output stream, put aside while the output of the C code block is being captured.",
+    "static FCGI_FILE lhp_response_stdout;",
+    "",
+    "static void lhp_output_capture(void *stream)",
+    "{",
+    "\tlhp_response_stdout = *FCGI_stdout;",
+    "\tFCGI_stdout->stdio_stream = stream;",
+    "\tFCGI_stdout->fcgx_stream = NULL;",
+    "}",
+    "",
+    "static void lhp_output_release(void)",
+    "{",
+    "\t*FCGI_stdout = lhp_response_stdout;",
+    "}",
+    "",
+    "// Sends gathered pieces of the response into the FastCGI output buffer or, when run as a plain CGI program,",
+    "// straight to the standard output with a single writev().",
+    "static void lhp_output_gather(struct iovec *iov, int count)",
+    "{",
+    "\tif (FCGI_stdout->fcgx_stream != NULL) {",
+    "\t\tfor (int i = 0; i < count; i++) {",
+    "\t\t\tFCGX_PutStr(iov[i].iov_base, (int)iov[i].iov_len, FCGI_stdout->fcgx_stream);",
+    "\t\t}",
+    "\t\treturn;",
+    "\t}",
+    "\tfflush(stdout);",
+    "\twhile (count > 0) {",
+    "\t\tssize_t written = writev(STDOUT_FILENO, iov, count);",
+    "\t\tif (written < 0) {",
+    "\t\t\tif (errno == EINTR) {",
+    "\t\t\t\tcontinue;",
+    "\t\t\t}",
+    "\t\t\treturn;",
+    "\t\t}",
+    "\t\t// Carry on from wherever a partial write stopped.",
+    "\t\twhile (count > 0 && (size_t)written >= iov->iov_len) {",
+    "\t\t\twritten -= iov->iov_len;",
+    "\t\t\tiov++;",
+    "\t\t\tcount--;",
+    "\t\t}",
+    "\t\tif (count > 0) {",
+    "\t\t\tiov->iov_base = (char *)iov->iov_base + written;",
+    "\t\t\tiov->iov_len -= written;",
+    "\t\t}",
+    "\t}",
+    "}",
+    "",
+    "// Pushes what has been sent so far on to the web server (the standard output is written to straight away).",
+    "static inline void lhp_output_flush(void)",
+    "{",
+    "\tif (FCGI_stdout->fcgx_stream != NULL) {",
+    "\t\tFCGX_FFlush(FCGI_stdout->fcgx_stream);",
+    "\t}",
+    "}",
+    NULL
+};
+
+// Main function of a threaded page. A pool of threads each accept requests of their own with FCGX_Accept_r()
+// (taking turns, as not every platform allows them to accept on the same socket at once) and call the page's handler for each.
+const char *const threaded_main_code[] = {
+    "",
+    "static pthread_mutex_t lhp_accept_mutex = PTHREAD_MUTEX_INITIALIZER;",
+    "",
+    "static void *lhp_responder(void *unused)",
+    "{",
+    "\tFCGX_Request request;",
+    "\t(void)unused;",
+    "\tif (FCGX_InitRequest(&request, 0, 0) != 0) {",
+    "\t\treturn NULL;",
+    "\t}",
+    "\tlhp_request = &request;",
+    "\tfor (;;) {",
+    "\t\tpthread_mutex_lock(&lhp_accept_mutex);",
+    "\t\tint accepted = FCGX_Accept_r(&request);",
+    "\t\tpthread_mutex_unlock(&lhp_accept_mutex);",
+    "\t\tif (accepted < 0) {",
+    "\t\t\tbreak;",
+    "\t\t}",
+    "\t\tlhp_page();",
+    "\t\tFCGX_Finish_r(&request);",
+    "\t\tlhp_worker_finished();",
+    "\t}",
+    "\tFCGX_Free(&request, 1);",
+    "\treturn NULL;",
+    "}",
+    "",
+    "int main(void)",
+    "{",
+    "\tpthread_t threads[LHP_THREADS];",
+    "\tint started = 0;",
+    "\tlhp_supervise();",
+    "\tif (FCGX_Init() != 0) {",
+    "\t\treturn 1;",
+    "\t}",
+    "\tlhp_page_init();",
+    "\twhile (started < LHP_THREADS && pthread_create(&threads[started], NULL, lhp_responder, NULL) == 0) {",
+    "\t\tstarted++;",
+    "\t}",
+    "\tfor (int i = 0; i < started; i++) {",
+    "\t\tpthread_join(threads[i], NULL);",
+    "\t}",
+    "\treturn (started > 0) ? 0 : 1;",
+    "}",
+    NULL
+};
+
+// The entry point of a module, shared by the page (which exports one named lhp_module) and the host that loads it.
+// The ABI number changes whenever this layout or the way the host calls a module does, so that old modules are refused.
+const char *const module_abi_code[] = {
+    "",
+    "#define LHP_MODULE_ABI 1",
+    "",
+    "struct lhp_module {",
+    "\tint abi;",
+    "\tint (*handler)(void);",
+    "\tvoid (*init)(void);",
+    "};",
+    NULL
+};
+
+// Runtime for pages that use MySQL. The connection is opened on first use and kept open across requests (one per thread
+// in a threaded page), checked with a ping once it has been idle for a while and reopened whenever it is lost.
+// Prepared statements are cached by their SQL text, so each one is only prepared once per connection.
+const char *const mysql_runtime_code[] = {
+    "",
+    "#include <time.h>",
+    "",
+    "// Connection settings, given once by lhp_db_configure() (normally in the init block).",
+    "static char *lhp_db_host = NULL;",
+    "static char *lhp_db_user = NULL;",
+    "static char *lhp_db_password = NULL;",
+    "static char *lhp_db_database = NULL;",
+    "static char *lhp_db_socket = NULL;",
+    "static unsigned int lhp_db_port = 0;",
+    "",
+    "// Seconds a connection can be idle before it is checked with a ping, and the size of the prepared statement cache.",
+    "#define LHP_DB_IDLE_CHECK 30",
+    "#define LHP_DB_STATEMENT_SLOTS 128",
+    "",
+    "struct lhp_db_statement {",
+    "\tchar *sql;",
+    "\tMYSQL_STMT *statement;",
+    "};",
+    "",
+    "LHP_PER_REQUEST MYSQL *lhp_db_connection = NULL;",
+    "LHP_PER_REQUEST time_t lhp_db_last_used = 0;",
+    "LHP_PER_REQUEST struct lhp_db_statement lhp_db_statements[LHP_DB_STATEMENT_SLOTS];",
+    "LHP_PER_REQUEST size_t lhp_db_statement_count = 0;",
+    "",
+    "static char *lhp_db_copy(const char *text)",
+    "{",
+    "\treturn (text != NULL) ? strdup(text) : NULL;",
+    "}",
+    "",
+    "// Sets where to connect to. Any argument parameter can be NULL (or 0) to use the MySQL defaults.",
+    "static inline void lhp_db_configure(const char *host, const char *user, const char *password, const char *database, unsigned int port, const char *unix_socket)",
+    "{",
+    "\tmysql_library_init(0, NULL, NULL);",
+    "\tlhp_db_host = lhp_db_copy(host);",
+    "\tlhp_db_user = lhp_db_copy(user);",
+    "\tlhp_db_password = lhp_db_copy(password);",
+    "\tlhp_db_database = lhp_db_copy(database);",
+    "\tlhp_db_socket = lhp_db_copy(unix_socket);",
+    "\tlhp_db_port = port;",
+    "}",
+    "",
+    "// Closes every cached prepared statement.",
+    "static void lhp_db_forget_statements(void)",
+    "{",
+    "\tfor (size_t i = 0; i < LHP_DB_STATEMENT_SLOTS; i++) {",
+    "\t\tif (lhp_db_statements[i].sql != NULL) {",
+    "\t\t\tmysql_stmt_close(lhp_db_statements[i].statement);",
+    "\t\t\tfree(lhp_db_statements[i].sql);",
+    "\t\t\tlhp_db_statements[i].sql = NULL;",
+    "\t\t}",
+    "\t}",
+    "\tlhp_db_statement_count = 0;",
+    "}",
+    "",
+    "// Closes the connection (and its prepared statements), so that the next call to lhp_db() opens a new one.",
+    "// Call this if running a prepared statement fails because the connection to the server was lost.",
+    "static void lhp_db_reset(void)",
+    "{",
+    "\tlhp_db_forget_statements();",
+    "\tif (lhp_db_connection != NULL) {",
+    "\t\tmysql_close(lhp_db_connection);",
+    "\t\tlhp_db_connection = NULL;",
+    "\t}",
+    "}",
+    "",
+    "// Returns the persistent connection, opening it if needed, or NULL if the server can't be reached.",
+    "static MYSQL *lhp_db(void)",
+    "{",
+    "\ttime_t now = time(NULL);",
+    "\tif (lhp_db_connection != NULL && now - lhp_db_last_used >= LHP_DB_IDLE_CHECK && mysql_ping(lhp_db_connection) != 0) {",
+    "\t\tlhp_db_reset();",
+    "\t}",
+    "\tif (lhp_db_connection == NULL) {",
+    "\t\tMYSQL *connection = mysql_init(NULL);",
+    "\t\tif (connection == NULL) {",
+    "\t\t\treturn NULL;",
+    "\t\t}",
+    "\t\tif (mysql_real_connect(connection, lhp_db_host, lhp_db_user, lhp_db_password, lhp_db_database, lhp_db_port, lhp_db_socket, 0) == NULL) {",
+    "\t\t\tmysql_close(connection);",
+    "\t\t\treturn NULL;",
+    "\t\t}",
+    "\t\tlhp_db_connection = connection;",
+    "\t}",
+    "\tlhp_db_last_used = now;",
+    "\treturn lhp_db_connection;",
+    "}",
+    "",
+    "// Whether a MySQL error means that the connection to the server was lost (CR_SERVER_GONE_ERROR or CR_SERVER_LOST).",
+    "static int lhp_db_lost(unsigned int error)",
+    "{",
+    "\treturn error == 2006 || error == 2013;",
+    "}",
+    "",
+    "// Runs a query on the persistent connection, reconnecting and trying once more if the connection was lost.",
+    "// Returns 0 on success (the result, if any, is read from lhp_db() as usual).",
+    "static inline int lhp_db_query(const char *sql)",
+    "{",
+    "\tfor (int attempt = 0; attempt < 2; attempt++) {",
+    "\t\tMYSQL *connection = lhp_db();",
+    "\t\tif (connection == NULL) {",
+    "\t\t\treturn -1;",
+    "\t\t}",
+    "\t\tif (mysql_query(connection, sql) == 0) {",
+    "\t\t\treturn 0;",
+    "\t\t}",
+    "\t\tif (!lhp_db_lost(mysql_errno(connection))) {",
+    "\t\t\treturn -1;",
+    "\t\t}",
+    "\t\tlhp_db_reset();",
+    "\t}",
+    "\treturn -1;",
+    "}",
+    "",
+    "// Returns a prepared statement for the SQL text, preparing it only if it hasn't been already on this connection.",
+    "// The statement belongs to the cache and must not be closed; it is reset before being handed out again.",
+    "static inline MYSQL_STMT *lhp_db_prepare(const char *sql)",
+    "{",
+    "\tunsigned long hash = 5381;",
+    "\tfor (const char *c = sql; *c != '\\0'; c++) {",
+    "\t\thash = hash * 33 + (unsigned char)*c;",
+    "\t}",
+    "\tfor (int attempt = 0; attempt < 2; attempt++) {",
+    "\t\tMYSQL *connection = lhp_db();",
+    "\t\tif (connection == NULL) {",
+    "\t\t\treturn NULL;",
+    "\t\t}",
+    "\t\tsize_t slot = hash % LHP_DB_STATEMENT_SLOTS;",
+    "\t\twhile (lhp_db_statements[slot].sql != NULL) {",
+    "\t\t\tif (strcmp(lhp_db_statements[slot].sql, sql) == 0) {",
+    "\t\t\t\tmysql_stmt_reset(lhp_db_statements[slot].statement);",
+    "\t\t\t\treturn lhp_db_statements[slot].statement;",
+    "\t\t\t}",
+    "\t\t\tslot = (slot + 1) % LHP_DB_STATEMENT_SLOTS;",
+    "\t\t}",
+    "\t\t// Start the cache again once it is three quarters full, so that there is always a free slot to stop at.",
+    "\t\tif (lhp_db_statement_count >= LHP_DB_STATEMENT_SLOTS * 3 / 4) {",
+    "\t\t\tlhp_db_forget_statements();",
+    "\t\t\tslot = hash % LHP_DB_STATEMENT_SLOTS;",
+    "\t\t}",
+    "\t\tMYSQL_STMT *statement = mysql_stmt_init(connection);",
+    "\t\tchar *key = strdup(sql);",
+    "\t\tif (statement == NULL || key == NULL) {",
+    "\t\t\tif (statement != NULL) {",
+    "\t\t\t\tmysql_stmt_close(statement);",
+    "\t\t\t}",
+    "\t\t\tfree(key);",
+    "\t\t\treturn NULL;",
+    "\t\t}",
+    "\t\tif (mysql_stmt_prepare(statement, sql, strlen(sql)) == 0) {",
+    "\t\t\tlhp_db_statements[slot].sql = key;",
+    "\t\t\tlhp_db_statements[slot].statement = statement;",
+    "\t\t\tlhp_db_statement_count++;",
+    "\t\t\treturn statement;",
+    "\t\t}",
+    "\t\tunsigned int error = mysql_stmt_errno(statement);",
+    "\t\tmysql_stmt_close(statement);",
+    "\t\tfree(key);",
+    "\t\tif (!lhp_db_lost(error)) {",
+    "\t\t\treturn NULL;",
+    "\t\t}",
+    "\t\tlhp_db_reset();",
+    "\t}",
+    "\treturn NULL;",
+    "}",
+    NULL
+};
+
+// Code for a per-request arena: memory handed out by lhp_alloc() lasts until the next request starts, when all of it is
+// released at once, so that the C code blocks don't need to malloc() and free() temporary strings themselves.
+// A request that needs more than one block leaves a single block big enough for all of it, so later requests don't allocate at all.
+const char *const request_arena_code[] = {
+    "",
+    "// Size of the first arena block, and the alignment of everything handed out from it.",
+    "#define LHP_ARENA_BLOCK 65536",
+    "#define LHP_ARENA_ALIGN 16",
+    "",
+    "struct lhp_arena_block {",
+    "\tstruct lhp_arena_block *next;",
+    "\tsize_t size;",
+    "\tsize_t used;",
+    "\tunsigned char *data;",
+    "};",
+    "",
+    "LHP_PER_REQUEST struct lhp_arena_block *lhp_arena = NULL;",
+    "",
+    "static struct lhp_arena_block *lhp_arena_block(size_t size)",
+    "{",
+    "\tstruct lhp_arena_block *block = malloc(sizeof(*block) + LHP_ARENA_ALIGN + size);",
+    "\tif (block == NULL) {",
+    "\t\treturn NULL;",
+    "\t}",
+    "\tuintptr_t start = (uintptr_t)(block + 1);",
+    "\tblock->data = (unsigned char *)((start + LHP_ARENA_ALIGN - 1) & ~(uintptr_t)(LHP_ARENA_ALIGN - 1));",
+    "\tblock->next = NULL;",
+    "\tblock->size = size;",
+    "\tblock->used = 0;",
+    "\treturn block;",
+    "}",
+    "",
+    "// Hands out memory that lasts until the end of the current request (it must not be freed), or NULL if there is none left.",
+    "static inline void *lhp_alloc(size_t size)",
+    "{",
+    "\tsize = (size + LHP_ARENA_ALIGN - 1) & ~(size_t)(LHP_ARENA_ALIGN - 1);",
+    "\tif (lhp_arena == NULL || lhp_arena->size - lhp_arena->used < size) {",
+    "\t\tsize_t block_size = (lhp_arena == NULL) ? LHP_ARENA_BLOCK : lhp_arena->size * 2;",
+    "\t\tstruct lhp_arena_block *block = lhp_arena_block((block_size > size) ? block_size : size);",
+    "\t\tif (block == NULL) {",
+    "\t\t\treturn NULL;",
+    "\t\t}",
+    "\t\tblock->next = lhp_arena;",
+    "\t\tlhp_arena = block;",
+    "\t}",
+    "\tvoid *memory = lhp_arena->data + lhp_arena->used;",
+    "\tlhp_arena->used += size;",
+    "\treturn memory;",
+    "}",
+    "",
+    "// Copies a string into the arena.",
+    "static inline char *lhp_strdup(const char *text)",
+    "{",
+    "\tsize_t length = strlen(text) + 1;",
+    "\tchar *copy = lhp_alloc(length);",
+    "\treturn (copy != NULL) ? memcpy(copy, text, length) : NULL;",
+    "}",
+    "",
+    "// Formats a string (as sprintf() would) into the arena.",
+    "static inline char *lhp_sprintf(const char *format, ...)",
+    "{",
+    "\tva_list arguments;",
+    "\tva_start(arguments, format);",
+    "\tint length = vsnprintf(NULL, 0, format, arguments);",
+    "\tva_end(arguments);",
+    "\tchar *text = (length >= 0) ? lhp_alloc((size_t)length + 1) : NULL;",
+    "\tif (text != NULL) {",
+    "\t\tva_start(arguments, format);",
+    "\t\tvsnprintf(text, (size_t)length + 1, format, arguments);",
+    "\t\tva_end(arguments);",
+    "\t}",
+    "\treturn text;",
+    "}",
+    "",
+    "// Releases everything handed out during the last request. If it took more than one block, they are replaced by one big enough for all of them.",
+    "static void lhp_arena_reset(void)",
+    "{",
+    "\tif (lhp_arena == NULL || lhp_arena->next == NULL) {",
+    "\t\tif (lhp_arena != NULL) {",
+    "\t\t\tlhp_arena->used = 0;",
+    "\t\t}",
+    "\t\treturn;",
+    "\t}",
+    "\tsize_t total = 0;",
+    "\twhile (lhp_arena != NULL) {",
+    "\t\tstruct lhp_arena_block *next = lhp_arena->next;",
+    "\t\ttotal += lhp_arena->size;",
+    "\t\tfree(lhp_arena);",
+    "\t\tlhp_arena = next;",
+    "\t}",
+    "\tlhp_arena = lhp_arena_block(total);",
+    "}",
+    NULL
+};
+
+// Code for reading the parameters of a request: the query string, the cookies and a form posted in the body. Each is
+// parsed the first time it is looked at during a request, into a flat array of names and values pointing into a single
+// copy of the text in the arena (or into the body itself), with a small hash table over the names. Values are URL-decoded
+// in place the first time they are looked up, so nothing else is copied or allocated.
+const char *const request_params_code[] = {
+    "",
+    "// Most bytes of a form body that are read (a larger body is left unread for the C code blocks to deal with).",
+    "#ifndef LHP_FORM_MAX",
+    "#define LHP_FORM_MAX (1024 * 1024)",
+    "#endif",
+    "#define LHP_PARAM_BUCKETS 64",
+    "",
+    "// A name and value within the parsed text. The name isn't null terminated; the value is.",
+    "struct lhp_param {",
+    "\tconst char *name;",
+    "\tsize_t name_length;",
+    "\tchar *value;",
+    "\tsize_t value_length;",
+    "\tuint32_t hash;",
+    "\t// Whether the value has been URL-decoded yet, and the next parameter in the same bucket (or -1).",
+    "\tint decoded;",
+    "\tint next;",
+    "};",
+    "",
+    "struct lhp_params {",
+    "\tint parsed;",
+    "\tstruct lhp_param *params;",
+    "\tsize_t count;",
+    "\tint buckets[LHP_PARAM_BUCKETS];",
+    "};",
+    "",
+    "LHP_PER_REQUEST struct lhp_params lhp_query_params;",
+    "LHP_PER_REQUEST struct lhp_params lhp_form_params;",
+    "LHP_PER_REQUEST struct lhp_params lhp_cookie_params;",
+    "",
+    "// Forgets the parameters of the last request (their memory was in the arena).",
+    "static inline void lhp_params_reset(void)",
+    "{",
+    "\tlhp_query_params.parsed = 0;",
+    "\tlhp_form_params.parsed = 0;",
+    "\tlhp_cookie_params.parsed = 0;",
+    "}",
+    "",
+    "// FNV-1a hash of a name.",
+    "static inline uint32_t lhp_param_hash(const char *name, size_t length)",
+    "{",
+    "\tuint32_t hash = 2166136261u;",
+    "\tfor (size_t i = 0; i < length; i++) {",
+    "\t\thash = (hash ^ (unsigned char)name[i]) * 16777619u;",
+    "\t}",
+    "\treturn hash;",
+    "}",
+    "",
+    "// Value of a hexadecimal digit, or -1 if it isn't one.",
+    "static inline int lhp_hex_digit(char c)",
+    "{",
+    "\tif (c >= '0' && c <= '9') {",
+    "\t\treturn c - '0';",
+    "\t}",
+    "\tif ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {",
+    "\t\treturn (c | 0x20) - 'a' + 10;",
+    "\t}",
+    "\treturn -1;",
+    "}",
+    "",
+    "// URL-decodes text in place (\"+\" becomes a space and \"%XX\" the byte it stands for), returning its new length.",
+    "static inline size_t lhp_url_decode(char *text, size_t length)",
+    "{",
+    "\tsize_t out = 0;",
+    "\tfor (size_t i = 0; i < length; i++) {",
+    "\t\tint high = (text[i] == '%' && i + 2 < length) ? lhp_hex_digit(text[i + 1]) : -1;",
+    "\t\tint low = (high >= 0) ? lhp_hex_digit(text[i + 2]) : -1;",
+    "\t\tif (low >= 0) {",
+    "\t\t\ttext[out++] = (char)((high << 4) | low);",
+    "\t\t\ti += 2;",
+    "\t\t} else {",
+    "\t\t\ttext[out++] = (text[i] == '+') ? ' ' : text[i];",
+    "\t\t}",
+    "\t}",
+    "\treturn out;",
+    "}",
+    "",
+    "// Splits text (which it takes over) into parameters separated by a character, and builds the hash table over their names.",
+    "// Cookies aren't URL-decoded, and may have spaces before their names.",
+    "static inline void lhp_params_parse(struct lhp_params *params, char *text, size_t length, char separator, int decode)",
+    "{",
+    "\tparams->parsed = 1;",
+    "\tparams->count = 0;",
+    "\tfor (int i = 0; i < LHP_PARAM_BUCKETS; i++) {",
+    "\t\tparams->buckets[i] = -1;",
+    "\t}",
+    "\tif (text == NULL || length == 0) {",
+    "\t\treturn;",
+    "\t}",
+    "\tsize_t capacity = 1;",
+    "\tfor (const char *c = memchr(text, separator, length); c != NULL; c = memchr(c + 1, separator, (size_t)(text + length - c - 1))) {",
+    "\t\tcapacity++;",
+    "\t}",
+    "\tparams->params = lhp_alloc(capacity * sizeof(*params->params));",
+    "\tif (params->params == NULL) {",
+    "\t\treturn;",
+    "\t}",
+    "\tchar *end = text + length;",
+    "\twhile (text < end) {",
+    "\t\tchar *stop = memchr(text, separator, (size_t)(end - text));",
+    "\t\tif (stop == NULL) {",
+    "\t\t\tstop = end;",
+    "\t\t}",
+    "\t\twhile (!decode && text < stop && *text == ' ') {",
+    "\t\t\ttext++;",
+    "\t\t}",
+    "\t\tif (stop > text) {",
+    "\t\t\tstruct lhp_param *param = &params->params[params->count++];",
+    "\t\t\tchar *equals = memchr(text, '=', (size_t)(stop - text));",
+    "\t\t\tparam->name = text;",
+    "\t\t\tparam->name_length = (size_t)(((equals != NULL) ? equals : stop) - text);",
+    "\t\t\tif (decode && (memchr(text, '%', param->name_length) != NULL || memchr(text, '+', param->name_length) != NULL)) {",
+    "\t\t\t\tparam->name_length = lhp_url_decode(text, param->name_length);",
+    "\t\t\t}",
+    "\t\t\tparam->value = (equals != NULL) ? equals + 1 : stop;",
+    "\t\t\tparam->value_length = (size_t)(stop - param->value);",
+    "\t\t\tparam->hash = lhp_param_hash(param->name, param->name_length);",
+    "\t\t\tparam->decoded = !decode;",
+    "\t\t}",
+    "\t\t// The separator ends the value (the text itself ends with a null character).",
+    "\t\t*stop = '\\0';",
+    "\t\ttext = stop + 1;",
+    "\t}",
+    "\t// The first of several parameters with the same name is the one found, so they are added to the buckets backwards.",
+    "\tfor (size_t i = params->count; i-- > 0;) {",
+    "\t\tint *bucket = &params->buckets[params->params[i].hash % LHP_PARAM_BUCKETS];",
+    "\t\tparams->params[i].next = *bucket;",
+    "\t\t*bucket = (int)i;",
+    "\t}",
+    "}",
+    "",
+    "// Looks up a parameter by name, URL-decoding its value the first time.",
+    "static inline const char *lhp_params_find(struct lhp_params *params, const char *name)",
+    "{",
+    "\tsize_t length = strlen(name);",
+    "\tuint32_t hash = lhp_param_hash(name, length);",
+    "\tfor (int i = params->buckets[hash % LHP_PARAM_BUCKETS]; i >= 0; i = params->params[i].next) {",
+    "\t\tstruct lhp_param *param = &params->params[i];",
+    "\t\tif (param->hash == hash && param->name_length == length && memcmp(param->name, name, length) == 0) {",
+    "\t\t\tif (!param->decoded) {",
+    "\t\t\t\tparam->value_length = lhp_url_decode(param->value, param->value_length);",
+    "\t\t\t\tparam->value[param->value_length] = '\\0';",
+    "\t\t\t\tparam->decoded = 1;",
+    "\t\t\t}",
+    "\t\t\treturn param->value;",
+    "\t\t}",
+    "\t}",
+    "\treturn NULL;",
+    "}",
+    "",
+    "// Copies a CGI variable into the arena to be parsed (so that getenv() still gives it as it was).",
+    "static inline char *lhp_params_text(const char *name, size_t *length)",
+    "{",
+    "\tconst char *value = getenv(name);",
+    "\t*length = (value != NULL) ? strlen(value) : 0;",
+    "\tchar *text = (value != NULL) ? lhp_alloc(*length + 1) : NULL;",
+    "\treturn (text != NULL) ? memcpy(text, value, *length + 1) : NULL;",
+    "}",
+    "",
+    "// Reads a form posted in the body (application/x-www-form-urlencoded, up to LHP_FORM_MAX bytes) into the arena.",
+    "static inline char *lhp_form_body(size_t *length)",
+    "{",
+    "\tconst char *method = getenv(\"REQUEST_METHOD\");",
+    "\tconst char *type = getenv(\"CONTENT_TYPE\");",
+    "\tconst char *content_length = getenv(\"CONTENT_LENGTH\");",
+    "\tchar *end = NULL;",
+    "\tunsigned long long expected = (content_length != NULL) ? strtoull(content_length, &end, 10) : 0;",
+    "\t*length = 0;",
+    "\tif (method == NULL || strcmp(method, \"POST\") != 0 || type == NULL || strncasecmp(type, \"application/x-www-form-urlencoded\", 33) != 0 || end == content_length || expected > LHP_FORM_MAX) {",
+    "\t\treturn NULL;",
+    "\t}",
+    "\tchar *body = lhp_alloc((size_t)expected + 1);",
+    "\tif (body == NULL) {",
+    "\t\treturn NULL;",
+    "\t}",
+    "\twhile (*length < expected) {",
+    "\t\tsize_t got = fread(body + *length, 1, (size_t)expected - *length, stdin);",
+    "\t\tif (got == 0) {",
+    "\t\t\tbreak;",
+    "\t\t}",
+    "\t\t*length += got;",
+    "\t}",
+    "\tbody[*length] = '\\0';",
+    "\treturn body;",
+    "}",
+    "",
+    "// Value of a parameter of the query string, or NULL if there isn't one.",
+    "static inline const char *lhp_query(const char *name)",
+    "{",
+    "\tif (!lhp_query_params.parsed) {",
+    "\t\tsize_t length;",
+    "\t\tchar *text = lhp_params_text(\"QUERY_STRING\", &length);",
+    "\t\tlhp_params_parse(&lhp_query_params, text, length, '&', 1);",
+    "\t}",
+    "\treturn lhp_params_find(&lhp_query_params, name);",
+    "}",
+    "",
+    "// Value of a field of a form posted in the body, or NULL if there isn't one.",
+    "static inline const char *lhp_form(const char *name)",
+    "{",
+    "\tif (!lhp_form_params.parsed) {",
+    "\t\tsize_t length;",
+    "\t\tchar *body = lhp_form_body(&length);",
+    "\t\tlhp_params_parse(&lhp_form_params, body, length, '&', 1);",
+    "\t}",
+    "\treturn lhp_params_find(&lhp_form_params, name);",
+    "}",
+    "",
+    "// Value of a cookie, or NULL if there isn't one.",
+    "static inline const char *lhp_cookie(const char *name)",
+    "{",
+    "\tif (!lhp_cookie_params.parsed) {",
+    "\t\tsize_t length;",
+    "\t\tchar *text = lhp_params_text(\"HTTP_COOKIE\", &length);",
+    "\t\tlhp_params_parse(&lhp_cookie_params, text, length, ';', 0);",
+    "\t}",
+    "\treturn lhp_params_find(&lhp_cookie_params, name);",
+    "}",
+    NULL
+};
+
+// Code for runtime metrics (-s): each process of the page claims a slot of a shared memory segment named after the page,
+// and counts its requests, the time spent in each part of them and a histogram of their latencies there.
+// Recording a request is a handful of atomic additions; the clock is read through the vDSO, so no system calls are made.
+const char *const runtime_metrics_code[] = {
+    "",
+    "#include <fcntl.h>",
+    "#include <signal.h>",
+    "#include <time.h>",
+    "#include <unistd.h>",
+    "#include <sys/mman.h>",
+    "#include <sys/stat.h>",
+    "",
+    "// The layout of the segment (read by \"lhpCompiler -r\").",
+    "#define LHP_METRICS_MAGIC 0x4c48504d45545231ULL",
+    "#define LHP_METRICS_SLOTS 64",
+    "#define LHP_METRICS_BUCKETS 32",
+    "",
+    "struct lhp_metrics_slot {",
+    "\tint pid;",
+    "\tint padding;",
+    "\tunsigned long long requests;",
+    "\tunsigned long long nanoseconds[3];",
+    "\tunsigned long long max_nanoseconds;",
+    "\tunsigned long long histogram[LHP_METRICS_BUCKETS];",
+    "} __attribute__((aligned(64)));",
+    "",
+    "struct lhp_metrics_segment {",
+    "\tunsigned long long magic;",
+    "\tunsigned long long slot_size;",
+    "\tchar page[64];",
+    "\tstruct lhp_metrics_slot slots[LHP_METRICS_SLOTS];",
+    "};",
+    "",
+    "// The points of a request that are timed: its start, and the end of the header HTML, the C code block(s) and the footer HTML.",
+    "enum lhp_metrics_point { LHP_METRICS_START, LHP_METRICS_HEADER, LHP_METRICS_BODY, LHP_METRICS_FOOTER };",
+    "",
+    "static struct lhp_metrics_slot *lhp_metrics_slot = NULL;",
+    "LHP_PER_REQUEST unsigned long long lhp_metrics_times[LHP_METRICS_FOOTER];",
+    "",
+    "// Opens the page's segment and claims a slot in it: a free one, or one left by a process that has exited (whose counts carry on).",
+    "static void lhp_metrics_open(void)",
+    "{",
+    "\tint descriptor = shm_open(LHP_METRICS_NAME, O_RDWR | O_CREAT, 0600);",
+    "\tstruct stat info;",
+    "\tif (descriptor == -1) {",
+    "\t\treturn;",
+    "\t}",
+    "\tif (fstat(descriptor, &info) == -1 || ((size_t)info.st_size < sizeof(struct lhp_metrics_segment) && ftruncate(descriptor, sizeof(struct lhp_metrics_segment)) == -1)) {",
+    "\t\tclose(descriptor);",
+    "\t\treturn;",
+    "\t}",
+    "\tstruct lhp_metrics_segment *segment = mmap(NULL, sizeof(*segment), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);",
+    "\tclose(descriptor);",
+    "\tif (segment == MAP_FAILED) {",
+    "\t\treturn;",
+    "\t}",
+    "\t// A new segment is all zeros, so the first process to get there fills in its header.",
+    "\tunsigned long long magic = 0;",
+    "\tif (__atomic_compare_exchange_n(&segment->magic, &magic, LHP_METRICS_MAGIC, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {",
+    "\t\tsegment->slot_size = sizeof(struct lhp_metrics_slot);",
+    "\t\tstrncpy(segment->page, LHP_METRICS_PAGE, sizeof(segment->page) - 1);",
+    "\t} else if (magic != LHP_METRICS_MAGIC) {",
+    "\t\t// The segment was made by a page with a different layout.",
+    "\t\tmunmap(segment, sizeof(*segment));",
+    "\t\treturn;",
+    "\t}",
+    "\tint pid = (int)getpid();",
+    "\tfor (int i = 0; i < LHP_METRICS_SLOTS; i++) {",
+    "\t\tint owner = __atomic_load_n(&segment->slots[i].pid, __ATOMIC_ACQUIRE);",
+    "\t\tif (owner == pid || ((owner == 0 || (kill(owner, 0) == -1 && errno == ESRCH)) &&",
+    "\t\t\t__atomic_compare_exchange_n(&segment->slots[i].pid, &owner, pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))) {",
+    "\t\t\tlhp_metrics_slot = &segment->slots[i];",
+    "\t\t\treturn;",
+    "\t\t}",
+    "\t}",
+    "}",
+    "",
+    "// Records a point of the current request, adding the whole request to the process's slot at the end of the footer HTML.",
+    "static inline void lhp_metrics_mark(enum lhp_metrics_point point)",
+    "{",
+    "\tstruct lhp_metrics_slot *slot = lhp_metrics_slot;",
+    "\tstruct timespec now;",
+    "\tif (slot == NULL) {",
+    "\t\treturn;",
+    "\t}",
+    "\tclock_gettime(CLOCK_MONOTONIC, &now);",
+    "\tunsigned long long time = (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;",
+    "\tif (point != LHP_METRICS_FOOTER) {",
+    "\t\tlhp_metrics_times[point] = time;",
+    "\t\treturn;",
+    "\t}",
+    "\tunsigned long long total = time - lhp_metrics_times[LHP_METRICS_START];",
+    "\t__atomic_fetch_add(&slot->requests, 1, __ATOMIC_RELAXED);",
+    "\t__atomic_fetch_add(&slot->nanoseconds[0], lhp_metrics_times[LHP_METRICS_HEADER] - lhp_metrics_times[LHP_METRICS_START], __ATOMIC_RELAXED);",
+    "\t__atomic_fetch_add(&slot->nanoseconds[1], lhp_metrics_times[LHP_METRICS_BODY] - lhp_metrics_times[LHP_METRICS_HEADER], __ATOMIC_RELAXED);",
+    "\t__atomic_fetch_add(&slot->nanoseconds[2], time - lhp_metrics_times[LHP_METRICS_BODY], __ATOMIC_RELAXED);",
+    "\tunsigned long long microseconds = total / 1000;",
+    "\tint bucket = (microseconds > 0) ? 64 - __builtin_clzll(microseconds) : 0;",
+    "\t__atomic_fetch_add(&slot->histogram[(bucket < LHP_METRICS_BUCKETS) ? bucket : LHP_METRICS_BUCKETS - 1], 1, __ATOMIC_RELAXED);",
+    "\tunsigned long long max = __atomic_load_n(&slot->max_nanoseconds, __ATOMIC_RELAXED);",
+    "\twhile (total > max && !__atomic_compare_exchange_n(&slot->max_nanoseconds, &max, total, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {",
+    "\t}",
+    "}",
+    NULL
+};
+
+/**
+ * This function finds the name of the shared memory segment that a page records its runtime metrics into.
+ * It is made from the name of the page as it was given to the lhpCompiler (without its extension), e.g. "site/shop/basket.lhp"
+ * records into "/lhp.site.shop.basket", so "lhpCompiler -r" needs the page to be named the same way.
+ *
+ * @author Iqra Haq
+ * @param[in] page_name - The name of the page (its LHP File, EXE File or base name).
+ * @param[out] segment_name - The name of the segment.
+ * @param[in] size - The size of segment_name.
+ */
+void metrics_segment_name(const char *page_name, char *segment_name, size_t size)
+{
+    while(strncmp(page_name, "./", 2) == 0){
+        page_name += 2;
+    }
+    size_t length = strlen(page_name);
+    if(length > 4 && (strcmp(page_name + length - 4, ".lhp") == 0 || strcmp(page_name + length - 4, ".exe") == 0)){
+        length -= 4;
+    }
+    size_t used = (size_t)snprintf(segment_name, size, "%s", "/lhp.");
+    for(size_t i = 0; i < length && used + 1 < size; i++){
+        char character = page_name[i];
+        // Only one "/" is allowed in the name of a segment (at the start), so directories are separated by dots instead.
+        segment_name[used++] = (character == '/') ? '.' : (isalnum((unsigned char)character) || character == '.' || character == '-' || character == '_') ? character : '_';
+    }
+    segment_name[used] = '\0';
+}
+
+// Code for the supervisor (-k). When LHP_LISTEN is set, the EXE File binds the socket itself and forks a pool of workers
+// that accept requests on it (as the standard input, where FastCGI expects its socket), rather than relying on the web
+// server to start them. The pool grows while connections are left waiting or most workers are busy and shrinks once it
+// has been quiet for a while, and workers are replaced once they have served LHP_MAX_REQUESTS requests or grown past
+// LHP_MAX_RSS megabytes. Each worker runs the init block(s) itself, after it has been forked.
+const char *const supervisor_code[] = {
+    "",
+    "#include <errno.h>",
+    "#include <fcntl.h>",
+    "#include <netdb.h>",
+    "#include <poll.h>",
+    "#include <signal.h>",
+    "#include <time.h>",
+    "#include <unistd.h>",
+    "#include <sys/mman.h>",
+    "#include <sys/resource.h>",
+    "#include <sys/socket.h>",
+    "#include <sys/stat.h>",
+    "#include <sys/un.h>",
+    "#include <sys/wait.h>",
+    "",
+    "// Most workers in a pool, how often (in milliseconds) the supervisor looks at them, how many looks make up a round",
+    "// (after which the size of the pool is decided) and how many quiet rounds it takes before the pool shrinks.",
+    "#define LHP_WORKERS_LIMIT 256",
+    "#define LHP_SUPERVISOR_TICK 100",
+    "#define LHP_SUPERVISOR_ROUND 10",
+    "#define LHP_QUIET_ROUNDS 5",
+    "",
+    "// Requests each worker can handle at once.",
+    "#ifdef LHP_THREADS",
+    "#define LHP_WORKER_CAPACITY LHP_THREADS",
+    "#else",
+    "#define LHP_WORKER_CAPACITY 1",
+    "#endif",
+    "",
+    "// A worker's entry in the scoreboard shared with the supervisor.",
+    "struct lhp_worker {",
+    "\tint pid;",
+    "\t// Requests being handled, and requests handled altogether.",
+    "\tint busy;",
+    "\tunsigned long requests;",
+    "\t// Set once the supervisor has asked the worker to stop, and when the worker was started.",
+    "\tint stopping;",
+    "\ttime_t started;",
+    "};",
+    "",
+    "static struct lhp_worker *lhp_workers = NULL;",
+    "static int lhp_worker_count = 0;",
+    "// This process's entry (NULL unless it is a worker of a supervisor), and whether its thread is handling a request.",
+    "static struct lhp_worker *lhp_worker = NULL;",
+    "#ifdef LHP_THREADS",
+    "static __thread int lhp_handling = 0;",
+    "#else",
+    "static int lhp_handling = 0;",
+    "#endif",
+    "static unsigned long lhp_max_requests = 0;",
+    "static long lhp_max_rss = 0;",
+    "static volatile sig_atomic_t lhp_stop_pool = 0;",
+    "",
+    "static void lhp_stop_handler(int signal_number)",
+    "{",
+    "\t(void)signal_number;",
+    "\tlhp_stop_pool = 1;",
+    "}",
+    "",
+    "// Reads a number from an environment variable, or gives a default if it isn't set.",
+    "static long lhp_setting(const char *name, long fallback)",
+    "{",
+    "\tconst char *value = getenv(name);",
+    "\treturn (value != NULL && value[0] != '\\0') ? strtol(value, NULL, 10) : fallback;",
+    "}",
+    "",
+    "// Binds and listens on a Unix domain socket (any address with a \"/\" in it) or a TCP one ([host]:port).",
+    "static int lhp_listen(const char *address)",
+    "{",
+    "\tint listener = -1;",
+    "\tif (strchr(address, '/') != NULL) {",
+    "\t\tstruct sockaddr_un local;",
+    "\t\tstruct stat info;",
+    "\t\tmemset(&local, 0, sizeof(local));",
+    "\t\tlocal.sun_family = AF_UNIX;",
+    "\t\tif (strlen(address) >= sizeof(local.sun_path)) {",
+    "\t\t\treturn -1;",
+    "\t\t}",
+    "\t\tstrcpy(local.sun_path, address);",
+    "\t\t// A socket left behind by an earlier run is replaced.",
+    "\t\tif (stat(address, &info) == 0 && S_ISSOCK(info.st_mode)) {",
+    "\t\t\tunlink(address);",
+    "\t\t}",
+    "\t\tlistener = socket(AF_UNIX, SOCK_STREAM, 0);",
+    "\t\tif (listener >= 0 && (bind(listener, (struct sockaddr *)&local, sizeof(local)) != 0 || listen(listener, SOMAXCONN) != 0)) {",
+    "\t\t\tclose(listener);",
+    "\t\t\tlistener = -1;",
+    "\t\t}",
+    "\t\treturn listener;",
+    "\t}",
+    "\tconst char *colon = strrchr(address, ':');",
+    "\tchar host[256];",
+    "\tsize_t host_length = (colon != NULL) ? (size_t)(colon - address) : 0;",
+    "\tconst char *host_start = address;",
+    "\tstruct addrinfo hints;",
+    "\tstruct addrinfo *found = NULL;",
+    "\t// An IPv6 address is given in brackets (e.g. [::1]:9000), which getaddrinfo() doesn't expect.",
+    "\tif (host_length > 0 && address[0] == '[') {",
+    "\t\tif (host_length < 3 || address[host_length - 1] != ']') {",
+    "\t\t\treturn -1;",
+    "\t\t}",
+    "\t\thost_start++;",
+    "\t\thost_length -= 2;",
+    "\t}",
+    "\tif (host_length >= sizeof(host) || memchr(host_start, '[', host_length) != NULL || memchr(host_start, ']', host_length) != NULL) {",
+    "\t\treturn -1;",
+    "\t}",
+    "\tmemcpy(host, host_start, host_length);",
+    "\thost[host_length] = '\\0';",
+    "\tmemset(&hints, 0, sizeof(hints));",
+    "\thints.ai_family = AF_UNSPEC;",
+    "\thints.ai_socktype = SOCK_STREAM;",
+    "\thints.ai_flags = AI_PASSIVE;",
+    "\tif (getaddrinfo((host_length > 0) ? host : NULL, (colon != NULL) ? colon + 1 : address, &hints, &found) != 0) {",
+    "\t\treturn -1;",
+    "\t}",
+    "\tfor (struct addrinfo *option = found; option != NULL && listener < 0; option = option->ai_next) {",
+    "\t\tint reuse = 1;",
+    "\t\tlistener = socket(option->ai_family, option->ai_socktype, option->ai_protocol);",
+    "\t\tif (listener >= 0 && (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||",
+    "\t\t\tbind(listener, option->ai_addr, option->ai_addrlen) != 0 || listen(listener, SOMAXCONN) != 0)) {",
+    "\t\t\tclose(listener);",
+    "\t\t\tlistener = -1;",
+    "\t\t}",
+    "\t}",
+    "\tfreeaddrinfo(found);",
+    "\treturn listener;",
+    "}",
+    "",
+    "// In a threaded page, only the thread accepting a request takes SIGUSR1 (with which FastCGI stops accepting), so that",
+    "// it is the one woken when the worker stops, rather than a thread that is busy or waiting for its turn to accept.",
+    "#ifdef LHP_THREADS",
+    "static void lhp_stop_signal(int how)",
+    "{",
+    "\tsigset_t stop_signal;",
+    "\tsigemptyset(&stop_signal);",
+    "\tsigaddset(&stop_signal, SIGUSR1);",
+    "\tpthread_sigmask(how, &stop_signal, NULL);",
+    "}",
+    "#else",
+    "#define lhp_stop_signal(how)",
+    "#endif",
+    "",
+    "// Starts a worker in an entry of the scoreboard, returning 1 in the worker itself (which goes on to handle requests).",
+    "static int lhp_spawn(struct lhp_worker *worker)",
+    "{",
+    "\tworker->busy = 0;",
+    "\tworker->requests = 0;",
+    "\tworker->stopping = 0;",
+    "\tworker->started = time(NULL);",
+    "\tpid_t pid = fork();",
+    "\tif (pid == 0) {",
+    "\t\tsignal(SIGTERM, SIG_DFL);",
+    "\t\tsignal(SIGINT, SIG_DFL);",
+    "\t\tlhp_stop_signal(SIG_BLOCK);",
+    "\t\tlhp_worker = worker;",
+    "\t\treturn 1;",
+    "\t}",
+    "\tworker->pid = (pid > 0) ? (int)pid : 0;",
+    "\treturn 0;",
+    "}",
+    "",
+    "// Whether this worker should stop accepting requests: it has been asked to, or is due to be replaced.",
+    "static int lhp_worker_spent(void)",
+    "{",
+    "\tstruct rusage usage;",
+    "\tif (__atomic_load_n(&lhp_worker->stopping, __ATOMIC_RELAXED)) {",
+    "\t\treturn 1;",
+    "\t}",
+    "\tif (lhp_max_requests > 0 && __atomic_load_n(&lhp_worker->requests, __ATOMIC_RELAXED) >= lhp_max_requests) {",
+    "\t\treturn 1;",
+    "\t}",
+    "\treturn lhp_max_rss > 0 && getrusage(RUSAGE_SELF, &usage) == 0 && usage.ru_maxrss / 1024 >= lhp_max_rss;",
+    "}",
+    "",
+    "// Keeps the worker's entry up to date between requests, returning 0 if it should stop accepting them.",
+    "static int lhp_worker_accepting(void)",
+    "{",
+    "\tif (lhp_worker == NULL) {",
+    "\t\treturn 1;",
+    "\t}",
+    "\tif (lhp_handling) {",
+    "\t\t__atomic_sub_fetch(&lhp_worker->busy, 1, __ATOMIC_RELAXED);",
+    "\t\tlhp_handling = 0;",
+    "\t}",
+    "\treturn !lhp_worker_spent();",
+    "}",
+    "",
+    "static void lhp_worker_accepted(void)",
+    "{",
+    "\tif (lhp_worker != NULL) {",
+    "\t\t__atomic_add_fetch(&lhp_worker->busy, 1, __ATOMIC_RELAXED);",
+    "\t\t__atomic_add_fetch(&lhp_worker->requests, 1, __ATOMIC_RELAXED);",
+    "\t\tlhp_handling = 1;",
+    "\t}",
+    "}",
+    "",
+    "// Accepting a request goes through the worker's entry in the scoreboard.",
+    "#ifdef LHP_THREADS",
+    "static int lhp_accept_r(FCGX_Request *request)",
+    "{",
+    "\tif (!lhp_worker_accepting()) {",
+    "\t\treturn -1;",
+    "\t}",
+    "\tif (lhp_worker == NULL) {",
+    "\t\treturn FCGX_Accept_r(request);",
+    "\t}",
+    "\t// A stop signal sent while no thread was accepting arrives here, before the worker is checked again.",
+    "\tlhp_stop_signal(SIG_UNBLOCK);",
+    "\tint accepted = lhp_worker_spent() ? -1 : FCGX_Accept_r(request);",
+    "\tlhp_stop_signal(SIG_BLOCK);",
+    "\tif (accepted >= 0) {",
+    "\t\tlhp_worker_accepted();",
+    "\t}",
+    "\treturn accepted;",
+    "}",
+    "#define FCGX_Accept_r lhp_accept_r",
+    "",
+    "// Called by each thread once it has finished a request. As soon as the worker is spent, the whole of it stops: the thread",
+    "// blocked accepting the next request is woken by SIGUSR1 (after FastCGI is told to stop accepting, in case it is just about",
+    "// to), and every other thread stops once it finishes its request or its turn to accept comes, so that main() can join them.",
+    "static void lhp_worker_finished(void)",
+    "{",
+    "\tstatic int retiring = 0;",
+    "\tif (lhp_worker == NULL) {",
+    "\t\treturn;",
+    "\t}",
+    "\tif (lhp_handling) {",
+    "\t\t__atomic_sub_fetch(&lhp_worker->busy, 1, __ATOMIC_RELAXED);",
+    "\t\tlhp_handling = 0;",
+    "\t}",
+    "\tif (lhp_worker_spent() && !__atomic_exchange_n(&retiring, 1, __ATOMIC_RELAXED)) {",
+    "\t\tFCGX_ShutdownPending();",
+    "\t\tkill(getpid(), SIGUSR1);",
+    "\t}",
+    "}",
+    "#else",
+    "static int lhp_accept(void)",
+    "{",
+    "\tif (!lhp_worker_accepting()) {",
+    "\t\treturn -1;",
+    "\t}",
+    "\tint accepted = FCGI_Accept();",
+    "\tif (accepted >= 0) {",
+    "\t\tlhp_worker_accepted();",
+    "\t}",
+    "\treturn accepted;",
+    "}",
+    "#define FCGI_Accept lhp_accept",
+    "#endif",
+    "",
+    "// Runs the pool if LHP_LISTEN is set, returning only in the workers (or straight away if it isn't set).",
+    "static void lhp_supervise(void)",
+    "{",
+    "\tconst char *address = getenv(\"LHP_LISTEN\");",
+    "\tif (address == NULL || address[0] == '\\0') {",
+    "\t\treturn;",
+    "\t}",
+    "\tlong processors = sysconf(_SC_NPROCESSORS_ONLN);",
+    "\tlong most = lhp_setting(\"LHP_MAX_WORKERS\", (processors > 0) ? processors * 2 : 4);",
+    "\tlong least = lhp_setting(\"LHP_MIN_WORKERS\", 1);",
+    "\tlhp_max_requests = (unsigned long)lhp_setting(\"LHP_MAX_REQUESTS\", 0);",
+    "\tlhp_max_rss = lhp_setting(\"LHP_MAX_RSS\", 0);",
+    "\tlhp_worker_count = (int)((most < 1) ? 1 : ((most > LHP_WORKERS_LIMIT) ? LHP_WORKERS_LIMIT : most));",
+    "\tint minimum = (int)((least < 1) ? 1 : ((least > lhp_worker_count) ? lhp_worker_count : least));",
+    "",
+    "\t// The workers find the socket as their standard input.",
+    "\tint listener = lhp_listen(address);",
+    "\tif (listener < 0 || (listener != 0 && (dup2(listener, 0) != 0 || close(listener) != 0))) {",
+    "\t\tfprintf(stderr, \"Could not listen on %s\\n\", address);",
+    "\t\texit(1);",
+    "\t}",
+    "\t// The scoreboard is shared memory mapped from /dev/zero, which every worker inherits.",
+    "\tint zero = open(\"/dev/zero\", O_RDWR);",
+    "\tlhp_workers = (zero >= 0) ? mmap(NULL, sizeof(*lhp_workers) * lhp_worker_count, PROT_READ | PROT_WRITE, MAP_SHARED, zero, 0) : MAP_FAILED;",
+    "\tif (zero >= 0) {",
+    "\t\tclose(zero);",
+    "\t}",
+    "\tif (lhp_workers == MAP_FAILED) {",
+    "\t\tfprintf(stderr, \"Could not share memory with the workers\\n\");",
+    "\t\texit(1);",
+    "\t}",
+    "",
+    "\tstruct sigaction action;",
+    "\tmemset(&action, 0, sizeof(action));",
+    "\taction.sa_handler = lhp_stop_handler;",
+    "\tsigemptyset(&action.sa_mask);",
+    "\tsigaction(SIGTERM, &action, NULL);",
+    "\tsigaction(SIGINT, &action, NULL);",
+    "",
+    "\tint target = minimum;",
+    "\tint ticks = 0;",
+    "\tint waiting = 0;",
+    "\tint quiet_rounds = 0;",
+    "\tdouble busy_total = 0;",
+    "\ttime_t respawn_after = 0;",
+    "\twhile (!lhp_stop_pool) {",
+    "\t\t// Clear the entries of workers that have finished. One that failed (or gave up without handling a request)",
+    "\t\t// straight after starting holds up the next for a second.",
+    "\t\tint status;",
+    "\t\tpid_t pid;",
+    "\t\twhile ((pid = waitpid(-1, &status, WNOHANG)) > 0) {",
+    "\t\t\tfor (int i = 0; i < lhp_worker_count; i++) {",
+    "\t\t\t\tif (lhp_workers[i].pid == (int)pid) {",
+    "\t\t\t\t\tlhp_workers[i].pid = 0;",
+    "\t\t\t\t\tint failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0 || lhp_workers[i].requests == 0;",
+    "\t\t\t\t\tif (failed && !lhp_workers[i].stopping && time(NULL) - lhp_workers[i].started < 1) {",
+    "\t\t\t\t\t\trespawn_after = time(NULL) + 1;",
+    "\t\t\t\t\t}",
+    "\t\t\t\t}",
+    "\t\t\t}",
+    "\t\t}",
+    "",
+    "\t\t// Start workers until there are as many as the pool should have (those asked to stop don't count).",
+    "\t\tint running = 0;",
+    "\t\tint busy = 0;",
+    "\t\tfor (int i = 0; i < lhp_worker_count; i++) {",
+    "\t\t\tif (lhp_workers[i].pid != 0 && !lhp_workers[i].stopping) {",
+    "\t\t\t\trunning++;",
+    "\t\t\t\tbusy += __atomic_load_n(&lhp_workers[i].busy, __ATOMIC_RELAXED);",
+    "\t\t\t}",
+    "\t\t}",
+    "\t\tfor (int i = 0; i < lhp_worker_count && running < target && time(NULL) >= respawn_after; i++) {",
+    "\t\t\tif (lhp_workers[i].pid == 0) {",
+    "\t\t\t\tif (lhp_spawn(&lhp_workers[i])) {",
+    "\t\t\t\t\treturn;",
+    "\t\t\t\t}",
+    "\t\t\t\trunning += (lhp_workers[i].pid != 0);",
+    "\t\t\t}",
+    "\t\t}",
+    "",
+    "\t\t// Measure the load: the share of the pool that is busy, and whether connections are waiting to be accepted.",
+    "\t\tstruct pollfd queue = { 0, POLLIN, 0 };",
+    "\t\tbusy_total += (running > 0) ? (double)busy / (running * LHP_WORKER_CAPACITY) : 1;",
+    "\t\twaiting += (poll(&queue, 1, 0) > 0);",
+    "\t\tif (++ticks == LHP_SUPERVISOR_ROUND) {",
+    "\t\t\tdouble busy_ratio = busy_total / ticks;",
+    "\t\t\tif (waiting > 0 || busy_ratio >= 0.75) {",
+    "\t\t\t\t// The longer connections were kept waiting, the more workers are added.",
+    "\t\t\t\ttarget += 1 + waiting / 2;",
+    "\t\t\t\tquiet_rounds = 0;",
+    "\t\t\t} else if (busy_ratio < 0.25 && ++quiet_rounds >= LHP_QUIET_ROUNDS) {",
+    "\t\t\t\ttarget--;",
+    "\t\t\t\tquiet_rounds = 0;",
+    "\t\t\t} else if (busy_ratio >= 0.25) {",
+    "\t\t\t\tquiet_rounds = 0;",
+    "\t\t\t}",
+    "\t\t\ttarget = (target > lhp_worker_count) ? lhp_worker_count : ((target < minimum) ? minimum : target);",
+    "\t\t\t// Ask an idle worker to stop if there are too many (SIGUSR1 makes FastCGI stop accepting).",
+    "\t\t\tfor (int i = 0; i < lhp_worker_count && running > target; i++) {",
+    "\t\t\t\tif (lhp_workers[i].pid != 0 && !lhp_workers[i].stopping && __atomic_load_n(&lhp_workers[i].busy, __ATOMIC_RELAXED) == 0) {",
+    "\t\t\t\t\t__atomic_store_n(&lhp_workers[i].stopping, 1, __ATOMIC_RELAXED);",
+    "\t\t\t\t\tkill(lhp_workers[i].pid, SIGUSR1);",
+    "\t\t\t\t\trunning--;",
+    "\t\t\t\t}",
+    "\t\t\t}",
+    "\t\t\tticks = 0;",
+    "\t\t\twaiting = 0;",
+    "\t\t\tbusy_total = 0;",
+    "\t\t}",
+    "\t\tstruct timespec tick = { 0, LHP_SUPERVISOR_TICK * 1000000L };",
+    "\t\tnanosleep(&tick, NULL);",
+    "\t}",
+    "",
+    "\t// Stop the pool, waiting for every worker to finish.",
+    "\tfor (int i = 0; i < lhp_worker_count; i++) {",
+    "\t\tif (lhp_workers[i].pid != 0) {",
+    "\t\t\tkill(lhp_workers[i].pid, SIGTERM);",
+    "\t\t}",
+    "\t}",
+    "\twhile (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {",
+    "\t}",
+    "\texit(0);",
+    "}",
+    NULL
+};
+
+// Without a supervisor, main() just carries on.
+const char *const supervisor_stub_code[] = {
+    "",
+    "#define lhp_supervise()",
+    "#define lhp_worker_finished()",
+    NULL
+};
+
+// The start of every C File: the POSIX functions used by the generated code (e.g. open_memstream()) are made available even though
+// it is compiled as C99, then the standard libraries, writev() and zlib (for the checksums of encoded responses) are included.
+// When pages are compiled together, these are compiled once into a precompiled preamble that each C File includes instead.
+const char *const preamble_code[] = {
+    "#define _POSIX_C_SOURCE 200809L",
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <string.h>",
+    "#include <strings.h>",
+    "#include <stdarg.h>",
+    "#include <stdint.h>",
+    "#include <errno.h>",
+    "#include <unistd.h>",
+    "#include <sys/uio.h>",
+    "#include <zlib.h>",
+    NULL
+};
+
+/**
+ * This function is 1st of the 3 major analysis functions of the program 
+ * with the main aim of copying any pre-processor directives 
+ * from the LHP File (source) to the top of the C File (intermediary_file).
+ * This is the first user defined function called in the main function, 
+ * therefore, any prints from this function will be at the top of the file.
+ * 
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the LHP File where data will be read from.
+ * @param[in] threads - The number of responder threads (0 for a single-threaded page using the FastCGI Standard I/O library).
+ * @param[in] metrics_page - The name of the page to record runtime metrics for (NULL if they aren't recorded).
+ * @param[in] preamble - Whether to include the precompiled preamble rather than the standard libraries themselves.
+ * @param[in] supervised - Whether the page's main function can run a pool of workers itself (-k).
+ * @param[out] intermediary_file - The output file where the data will be written to.
+ */
+void analyse_preprocessor_directives(struct lhp_source *source, long threads, const char *metrics_page, int preamble, int supervised, FILE *intermediary_file)
+{
+    // Insert the standard libraries needed by the generated code (found by gcc as the precompiled preamble if there is one).
+    if(preamble){
+        fprintf(intermediary_file, "%s\n", "#include \"lhp_preamble.h\"");
+    } else {
+        print_lines(preamble_code, intermediary_file);
+    }
+    // The state of the current response is kept by each thread of a threaded page, rather than once for the whole page.
+    fprintf(intermediary_file, "#define LHP_PER_REQUEST %s\n", (threads > 0) ? "static __thread" : "static");
+    print_lines(body_capture_code, intermediary_file);
+    print_lines(request_arena_code, intermediary_file);
+
+    // Insert the runtime metrics (named after the page), or take the calls to them out if they aren't wanted.
+    if(metrics_page != NULL){
+        char segment_name[NAME_MAX + 1];
+        metrics_segment_name(metrics_page, segment_name, sizeof(segment_name));
+        fprintf(intermediary_file, "\n#define LHP_METRICS_NAME \"%s\"\n#define LHP_METRICS_PAGE \"", segment_name);
+        for(const char *character = metrics_page; *character != '\0'; character++){
+            fprintf(intermediary_file, (*character == '"' || *character == '\\') ? "\\%c" : "%c", *character);
+        }
+        fprintf(intermediary_file, "%s\n", "\"");
+        print_lines(runtime_metrics_code, intermediary_file);
+    } else {
+        fprintf(intermediary_file, "%s\n", "#define lhp_metrics_open()");
+        fprintf(intermediary_file, "%s\n", "#define lhp_metrics_mark(point)");
+    }
+
+    if(threads > 0){
+        // Insert the FastCGI library's own interface, with the output functions that send to each thread's request.
+        fprintf(intermediary_file, "#define LHP_THREADS %ld\n", threads);
+        print_lines(threaded_output_code, intermediary_file);
+    } else {
+        // Insert the FastCGI Standard I/O Header Library into the intermediary file to enable FastCGI Functionality.
+        fprintf(intermediary_file, "%s\n", "#include \"fcgi_stdio.h\"");
+        print_lines(stdio_output_code, intermediary_file);
+    }
+
+    // Insert the supervisor (which wraps the function accepting requests), or take the call to it out.
+    print_lines(supervised ? supervisor_code : supervisor_stub_code, intermediary_file);
+
+    // Whether the page includes the MySQL header (and so needs the MySQL runtime).
+    int uses_mysql = 0;
+
+    // Loop through the directive segments only (the front end has already removed any leading whitespace).
+    for(size_t i = 0; i < source->segment_count; i++){
+        struct lhp_segment *segment = &source->segments[i];
+        if(segment->kind == LHP_DIRECTIVE){
+            const char *cursor = segment->start;
+            const char *end = segment->start + segment->length;
+
+            // Print each directive to file on a line of its own.
+            while(cursor < end){
+                const char *line;
+                size_t length = next_line(&cursor, end, &line);
+                fprintf(intermediary_file, "%.*s\n", (int)length, line);
+                if(find_text(line, length, "mysql.h") != NULL){
+                    uses_mysql = 1;
+                }
+            }
+        }
+    }
+
+    // Insert the request parameter functions after the directives, so that a page can define its own LHP_FORM_MAX.
+    print_lines(request_params_code, intermediary_file);
+
+    // Insert the persistent connection and prepared statement cache for pages that use MySQL.
+    if(uses_mysql){
+        print_lines(mysql_runtime_code, intermediary_file);
+    }
+}
+
+/**
+ * This function prints data to the C File (intermediary_file) as the contents of a C string literal,
+ * escaping it at compile time so that it can be sent byte for byte without any formatting at run time.
+ * The literal is broken after every new line (or every 72 characters) to keep the C File readable.
+ *
+ * @author Iqra Haq
+ * @param[in] data - The data to print.
+ * @param[in] length - The length of the data.
+ * @param[out] intermediary_file - The output file where the data will be written to.
+ */
+void print_string_literal(const char *data, size_t length, FILE *intermediary_file)
+{
+    // Number of characters printed on the current line of the literal.
+    int column = 0;
+
+    for(size_t i = 0; i < length; i++){
+        unsigned char c = data[i];
+
+        // Open a new piece of the literal at the start of each line.
+        if(column == 0){
+            fprintf(intermediary_file, "\t\"");
+        }
+
+        // Escape anything that would end the literal, be read as an escape sequence or a trigraph, or isn't printable.
+        if(c == '"' || c == '\\'){
+            column += fprintf(intermediary_file, "\\%c", c);
+        } else if(c == '?' && i > 0 && data[i - 1] == '?'){
+            column += fprintf(intermediary_file, "\\?");
+        } else if(c == '\n'){
+            column += fprintf(intermediary_file, "\\n");
+        } else if(c == '\t'){
+            column += fprintf(intermediary_file, "\\t");
+        } else if(c < ' ' || c > '~'){
+            // Octal escapes always use 3 digits so that a digit following them can't be read as part of the escape.
+            column += fprintf(intermediary_file, "\\%03o", c);
+        } else {
+            fputc(c, intermediary_file);
+            column++;
+        }
+
+        // Close this piece of the literal after a new line or once it gets long.
+        if(c == '\n' || column >= 72){
+            fprintf(intermediary_file, "\"\n");
+            column = 0;
+        }
+    }
+
+    // Close the final piece of the literal.
+    if(column > 0){
+        fprintf(intermediary_file, "\"\n");
+    }
+}
+
+/**
+ * This function compresses the HTML segments of one kind (or a single segment) at compile time as a raw deflate stream,
+ * so that encoded responses can be sent without compressing anything while a request is being handled.
+ * The header HTML and the HTML between the C code blocks are ended with a full flush (leaving the stream open and on a byte
+ * boundary so that the rest of the response can follow it) and the footer HTML is finished, as it is always the end of the response.
+ * The checksums needed for the gzip and deflate trailers are worked out at the same time.
+ *
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the LHP File where data will be read from.
+ * @param[in] kind - The kind of HTML segment to compress.
+ * @param[in] index - The position of the one segment to compress, or LHP_ALL_SEGMENTS for every segment of the kind.
+ * @param[in] flush - Z_FULL_FLUSH to leave the stream open or Z_FINISH to finish it.
+ * @param[out] compressed - The compressed HTML and its checksums.
+ * \return int - Error status.
+ */
+int deflate_html(struct lhp_source *source, enum lhp_segment_kind kind, size_t index, int flush, struct compressed_html *compressed)
+{
+    // Raw deflate stream (negative window bits) at the best compression level, as this is only done once per build.
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    memset(compressed, 0, sizeof(*compressed));
+    if(deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK){
+        return 1;
+    }
+
+    // Start the checksums and total up the HTML so that the output buffer can be made big enough for all of it.
+    compressed->crc = crc32(0L, Z_NULL, 0);
+    compressed->adler = adler32(0L, Z_NULL, 0);
+    for(size_t i = 0; i < source->segment_count; i++){
+        if(source->segments[i].kind == kind && (index == LHP_ALL_SEGMENTS || index == i)){
+            compressed->html_length += source->segments[i].length;
+        }
+    }
+    // Extra room is left for the empty block a full flush adds.
+    size_t capacity = deflateBound(&stream, compressed->html_length) + 16;
+    compressed->data = malloc(capacity);
+    if(compressed->data == NULL){
+        deflateEnd(&stream);
+        return 1;
+    }
+    stream.next_out = compressed->data;
+    stream.avail_out = capacity;
+
+    // Compress every segment of the right kind in order, updating the checksums as they go.
+    for(size_t i = 0; i < source->segment_count; i++){
+        struct lhp_segment *segment = &source->segments[i];
+        if(segment->kind == kind && (index == LHP_ALL_SEGMENTS || index == i)){
+            stream.next_in = (Bytef *)segment->start;
+            stream.avail_in = segment->length;
+            compressed->crc = crc32(compressed->crc, (const Bytef *)segment->start, segment->length);
+            compressed->adler = adler32(compressed->adler, (const Bytef *)segment->start, segment->length);
+            if(deflate(&stream, Z_NO_FLUSH) != Z_OK){
+                deflateEnd(&stream);
+                return 1;
+            }
+        }
+    }
+
+    // Either flush or finish the stream, checking it all fitted into the buffer.
+    int result = deflate(&stream, flush);
+    compressed->length = capacity - stream.avail_out;
+    deflateEnd(&stream);
+    if(result != ((flush == Z_FINISH) ? Z_STREAM_END : Z_OK) || stream.avail_in != 0){
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * This function prints one portion of HTML (header, footer or a segment between the C code blocks) to the C File (intermediary_file)
+ * as a static byte buffer that can be sent to the browser without any formatting.
+ *
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the LHP File where data will be read from.
+ * @param[in] kind - The kind of HTML segment to print.
+ * @param[in] index - The position of the one segment to print, or LHP_ALL_SEGMENTS for every segment of the kind.
+ * @param[in] prefix - Any text to send before the HTML (e.g. the response headers).
+ * @param[in] name - The name of the buffer to create.
+ * @param[out] intermediary_file - The output file where the data will be written to.
+ */
+void print_html_buffer(struct lhp_source *source, enum lhp_segment_kind kind, size_t index, const char *prefix, const char *name, FILE *intermediary_file)
+{
+    // Start the static buffer. The HTML is escaped here, once, rather than formatted with printf() on every request.
+    fprintf(intermediary_file, "static const char %s[] =\n", name);
+    size_t total_length = strlen(prefix);
+    print_string_literal(prefix, total_length, intermediary_file);
+    // Copy every segment of the right kind into the buffer exactly as it appears in the LHP File.
+    for(size_t i = 0; i < source->segment_count; i++){
+        if(source->segments[i].kind == kind && (index == LHP_ALL_SEGMENTS || index == i)){
+            print_string_literal(source->segments[i].start, source->segments[i].length, intermediary_file);
+            total_length += source->segments[i].length;
+        }
+    }
+    // An empty portion of HTML still needs a (empty) buffer.
+    if(total_length == 0){
+        fprintf(intermediary_file, "\t\"\"\n");
+    }
+    fprintf(intermediary_file, "%s\n", ";");
+}
+
+/**
+ * This function prints the compressed form of one portion of HTML to the C File (intermediary_file) as a static byte buffer.
+ *
+ * @author Iqra Haq
+ * @param[in] compressed - The compressed HTML.
+ * @param[in] name - The name of the buffer to create.
+ * @param[out] intermediary_file - The output file where the data will be written to.
+ */
+void print_compressed_buffer(struct compressed_html *compressed, const char *name, FILE *intermediary_file)
+{
+    fprintf(intermediary_file, "static const char %s[] =\n", name);
+    print_string_literal((const char *)compressed->data, compressed->length, intermediary_file);
+    fprintf(intermediary_file, "%s\n", ";");
+}
+
+/**
+ * This function prints the description of one portion of HTML (a struct lhp_html) to the C File (intermediary_file),
+ * pointing at its buffers (which must already have been printed) and giving the checksums worked out when it was compressed.
+ *
+ * @author Iqra Haq
+ * @param[in] compressed - The compressed HTML.
+ * @param[in] name - The name the buffers were printed with (without "_data" or "_deflated").
+ * @param[in] prefix - Anything to print before the description (e.g. the declaration it initialises).
+ * @param[out] intermediary_file - The output file where the data will be written to.
+ */
+void print_html_segment(struct compressed_html *compressed, const char *name, const char *prefix, FILE *intermediary_file)
+{
+    fprintf(intermediary_file, "%s { %s_data, sizeof(%s_data) - 1, %s_deflated, sizeof(%s_deflated) - 1, 0x%08lxUL, 0x%08lxUL, %zuUL }", prefix, name, name, name, name, compressed->crc, compressed->adler, compressed->html_length);
+}
+
+// Code that puts each response together and sends it. The static HTML is never copied: the response is sent as a list of
+// pieces (the static HTML where it is, and runs of the captured output of the C code blocks) with as few writes as possible.
+// Encoded responses use the HTML compressed at compile time, with the output of the C code blocks in stored (uncompressed)
+// deflate blocks between it, so that nothing is compressed while a request is being handled; only the checksums are carried on over it.
+const char *const response_encoding_code[] = {
+    "",
+    "// Content-Encodings that the static HTML has been compressed for at compile time.",
+    "enum lhp_encoding { LHP_IDENTITY, LHP_GZIP, LHP_DEFLATE };",
+    "",
+    "// Content-Encoding of the current response, and whether its output is being captured (it is sent as it goes if it can't be).",
+    "LHP_PER_REQUEST enum lhp_encoding lhp_encoding = LHP_IDENTITY;",
+    "LHP_PER_REQUEST int lhp_capturing = 0;",
+    "",
+    "// Checksum and length of the uncompressed HTML of an encoded response so far, and whether its header has been sent",
+    "// (which a streamed response does as soon as it starts).",
+    "LHP_PER_REQUEST uLong lhp_checksum = 0;",
+    "LHP_PER_REQUEST uLong lhp_length = 0;",
+    "LHP_PER_REQUEST int lhp_header_sent = 0;",
+    "",
+    "// Works out the best Content-Encoding from HTTP_ACCEPT_ENCODING (ignoring any that the client gives a quality of 0).",
+    "static enum lhp_encoding lhp_accepted_encoding(const char *accept)",
+    "{",
+    "\tint gzip = 0;",
+    "\tint deflate = 0;",
+    "\twhile (accept != NULL && *accept != '\\0') {",
+    "\t\taccept += strspn(accept, \", \\t\");",
+    "\t\tsize_t length = strcspn(accept, \",\");",
+    "\t\tsize_t name_length = strcspn(accept, \";, \\t\");",
+    "\t\tconst char *quality = strstr(accept, \"q=\");",
+    "\t\tint accepted = (quality == NULL || quality >= accept + length || strtod(quality + 2, NULL) > 0);",
+    "\t\tif (accepted && ((name_length == 4 && strncasecmp(accept, \"gzip\", 4) == 0) || (name_length == 6 && strncasecmp(accept, \"x-gzip\", 6) == 0) || (name_length == 1 && *accept == '*'))) {",
+    "\t\t\tgzip = 1;",
+    "\t\t} else if (accepted && name_length == 7 && strncasecmp(accept, \"deflate\", 7) == 0) {",
+    "\t\t\tdeflate = 1;",
+    "\t\t}",
+    "\t\taccept += length;",
+    "\t}",
+    "\treturn gzip ? LHP_GZIP : (deflate ? LHP_DEFLATE : LHP_IDENTITY);",
+    "}",
+    "",
+    "// Sends gathered pieces of the response, keeping a copy of them if the response is being cached.",
+    "static void lhp_send(struct iovec *iov, int count)",
+    "{",
+    "\tlhp_cache_record(iov, count);",
+    "\tlhp_output_gather(iov, count);",
+    "}",
+    "",
+    "// Most pieces sent in one gathered write (a response with more is sent in a few).",
+    "#define LHP_GATHER_MAX 64",
+    "",
+    "// Pieces waiting to be sent, with room for the headers of any stored deflate blocks among them.",
+    "struct lhp_gather {",
+    "\tstruct iovec iov[LHP_GATHER_MAX];",
+    "\tunsigned char headers[LHP_GATHER_MAX][5];",
+    "\tint count;",
+    "};",
+    "",
+    "// Adds data to the gathered write, sending what has been gathered so far first if there is no room left.",
+    "static void lhp_gather(struct lhp_gather *gather, const void *data, size_t length)",
+    "{",
+    "\tif (length == 0) {",
+    "\t\treturn;",
+    "\t}",
+    "\tif (gather->count == LHP_GATHER_MAX) {",
+    "\t\tlhp_send(gather->iov, gather->count);",
+    "\t\tgather->count = 0;",
+    "\t}",
+    "\tgather->iov[gather->count].iov_base = (void *)data;",
+    "\tgather->iov[gather->count].iov_len = length;",
+    "\tgather->count++;",
+    "}",
+    "",
+    "// Adds captured output to an encoded response in stored deflate blocks.",
+    "static void lhp_gather_stored(struct lhp_gather *gather, const char *data, size_t length)",
+    "{",
+    "\twhile (length > 0) {",
+    "\t\tsize_t block_length = (length > 65535) ? 65535 : length;",
+    "\t\t// The block header and its data go out together, so both need room.",
+    "\t\tif (gather->count >= LHP_GATHER_MAX - 1) {",
+    "\t\t\tlhp_send(gather->iov, gather->count);",
+    "\t\t\tgather->count = 0;",
+    "\t\t}",
+    "\t\tunsigned char *header = gather->headers[gather->count];",
+    "\t\theader[0] = 0;",
+    "\t\theader[1] = block_length & 0xff;",
+    "\t\theader[2] = block_length >> 8;",
+    "\t\theader[3] = ~block_length & 0xff;",
+    "\t\theader[4] = (~block_length >> 8) & 0xff;",
+    "\t\tlhp_gather(gather, header, sizeof(gather->headers[0]));",
+    "\t\tlhp_gather(gather, data, block_length);",
+    "\t\tdata += block_length;",
+    "\t\tlength -= block_length;",
+    "\t}",
+    "}",
+    "",
+    "// Adds static HTML to the response, carrying the checksum and length of an encoded response on over it.",
+    "static void lhp_gather_html(struct lhp_gather *gather, const struct lhp_html *html, uLong *checksum, uLong *length)",
+    "{",
+    "\tif (lhp_encoding == LHP_IDENTITY) {",
+    "\t\tlhp_gather(gather, html->data, html->length);",
+    "\t\treturn;",
+    "\t}",
+    "\tlhp_gather(gather, html->deflated, html->deflated_length);",
+    "\tif (lhp_encoding == LHP_GZIP) {",
+    "\t\t*checksum = crc32_combine(*checksum, html->crc, (z_off_t)html->html_length);",
+    "\t} else {",
+    "\t\t*checksum = adler32_combine(*checksum, html->adler, (z_off_t)html->html_length);",
+    "\t}",
+    "\t*length += html->html_length;",
+    "}",
+    "",
+    "// Adds a run of captured output to the response, carrying the checksum and length of an encoded response on over it.",
+    "static void lhp_gather_body(struct lhp_gather *gather, size_t offset, size_t body_length, uLong *checksum, uLong *length)",
+    "{",
+    "\tif (lhp_encoding == LHP_IDENTITY) {",
+    "\t\tlhp_gather(gather, lhp_body + offset, body_length);",
+    "\t\treturn;",
+    "\t}",
+    "\tlhp_gather_stored(gather, lhp_body + offset, body_length);",
+    "\tif (lhp_encoding == LHP_GZIP) {",
+    "\t\t*checksum = crc32(*checksum, (const Bytef *)lhp_body + offset, (uInt)body_length);",
+    "\t} else {",
+    "\t\t*checksum = adler32(*checksum, (const Bytef *)lhp_body + offset, (uInt)body_length);",
+    "\t}",
+    "\t*length += body_length;",
+    "}",
+    "",
+    "// Adds the headers and the header HTML to the response, starting the checksum and length of an encoded response.",
+    "static void lhp_gather_header(struct lhp_gather *gather, const struct lhp_html *header)",
+    "{",
+    "\tstatic const char gzip_headers[] = \"Content-type: text/html\\nContent-Encoding: gzip\\nVary: Accept-Encoding\\n\" LHP_ETAG_HEADER \"\\n\";",
+    "\tstatic const char deflate_headers[] = \"Content-type: text/html\\nContent-Encoding: deflate\\nVary: Accept-Encoding\\n\" LHP_ETAG_HEADER \"\\n\";",
+    "\t// gzip member header (deflate method, no flags or timestamp, Unix) and zlib header (32K window, best compression).",
+    "\tstatic const char gzip_header[10] = { 0x1f, (char)0x8b, 8, 0, 0, 0, 0, 0, 2, 3 };",
+    "\tstatic const char zlib_header[2] = { 0x78, (char)0xda };",
+    "\tlhp_checksum = (lhp_encoding == LHP_GZIP) ? crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0);",
+    "\tlhp_length = 0;",
+    "\tif (lhp_encoding == LHP_GZIP) {",
+    "\t\tlhp_gather(gather, gzip_headers, sizeof(gzip_headers) - 1);",
+    "\t\tlhp_gather(gather, gzip_header, sizeof(gzip_header));",
+    "\t} else if (lhp_encoding == LHP_DEFLATE) {",
+    "\t\tlhp_gather(gather, deflate_headers, sizeof(deflate_headers) - 1);",
+    "\t\tlhp_gather(gather, zlib_header, sizeof(zlib_header));",
+    "\t}",
+    "\tlhp_gather_html(gather, header, &lhp_checksum, &lhp_length);",
+    "\tlhp_header_sent = 1;",
+    "}",
+    "",
+    "// Adds every piece of the response so far and the rest of the captured output.",
+    "static void lhp_gather_pieces(struct lhp_gather *gather)",
+    "{",
+    "\tfor (size_t i = 0; i < lhp_piece_count; i++) {",
+    "\t\tif (lhp_pieces[i].html != NULL) {",
+    "\t\t\tlhp_gather_html(gather, lhp_pieces[i].html, &lhp_checksum, &lhp_length);",
+    "\t\t} else {",
+    "\t\t\tlhp_gather_body(gather, lhp_pieces[i].offset, lhp_pieces[i].length, &lhp_checksum, &lhp_length);",
+    "\t\t}",
+    "\t}",
+    "\tlhp_gather_body(gather, lhp_body_mark, lhp_body_length - lhp_body_mark, &lhp_checksum, &lhp_length);",
+    "}",
+    "",
+    "// Starts a response: releases the memory of the last one, picks its Content-Encoding and starts capturing the output of the C code blocks.",
+    "// If the output can't be captured, the response is sent unencoded as it goes instead, starting with the header.",
+    "static void lhp_response_start(const struct lhp_html *header)",
+    "{",
+    "\tlhp_arena_reset();",
+    "\tlhp_params_reset();",
+    "\tlhp_encoding = lhp_accepted_encoding(getenv(\"HTTP_ACCEPT_ENCODING\"));",
+    "\tlhp_header_sent = 0;",
+    "\tvoid *stream = lhp_body_open();",
+    "\tlhp_capturing = (stream != NULL);",
+    "\tif (lhp_capturing) {",
+    "\t\tlhp_stream_start(header);",
+    "\t\tlhp_output_capture(stream);",
+    "\t} else {",
+    "\t\tlhp_encoding = LHP_IDENTITY;",
+    "\t\tfwrite((void *)header->data, 1, header->length, stdout);",
+    "\t}",
+    "}",
+    "",
+    "// Adds static HTML from between two C code blocks to the response.",
+    "static inline void lhp_html_segment(const struct lhp_html *html)",
+    "{",
+    "\tif (!lhp_capturing) {",
+    "\t\tfwrite((void *)html->data, 1, html->length, stdout);",
+    "\t\treturn;",
+    "\t}",
+    "\t// Without room for another piece, the HTML is copied into the captured output instead.",
+    "\tif (lhp_cut_body() != 0 || lhp_add_piece(html, 0, 0) != 0) {",
+    "\t\tfwrite((void *)html->data, 1, html->length, stdout);",
+    "\t}",
+    "\tlhp_stream_check(html->length, 0);",
+    "}",
+    "",
+    "// Finishes the response: stops capturing and sends the header (unless it has been already), every piece, the rest of the captured output and the footer.",
+    "static void lhp_response_end(const struct lhp_html *header, const struct lhp_html *footer)",
+    "{",
+    "\tstruct lhp_gather gather;",
+    "\tunsigned char trailer[8];",
+    "\tif (!lhp_capturing) {",
+    "\t\tfwrite((void *)footer->data, 1, footer->length, stdout);",
+    "\t\treturn;",
+    "\t}",
+    "\tlhp_body_close();",
+    "\tlhp_output_release();",
+    "\tgather.count = 0;",
+    "\tif (!lhp_header_sent) {",
+    "\t\tlhp_gather_header(&gather, header);",
+    "\t}",
+    "\tlhp_gather_pieces(&gather);",
+    "\tlhp_gather_html(&gather, footer, &lhp_checksum, &lhp_length);",
+    "\t// The gzip trailer is the CRC-32 and length (least significant byte first), the zlib trailer the Adler-32 (most significant byte first).",
+    "\tif (lhp_encoding == LHP_GZIP) {",
+    "\t\tfor (int i = 0; i < 4; i++) {",
+    "\t\t\ttrailer[i] = (lhp_checksum >> (8 * i)) & 0xff;",
+    "\t\t\ttrailer[4 + i] = (lhp_length >> (8 * i)) & 0xff;",
+    "\t\t}",
+    "\t\tlhp_gather(&gather, trailer, 8);",
+    "\t} else if (lhp_encoding == LHP_DEFLATE) {",
+    "\t\tfor (int i = 0; i < 4; i++) {",
+    "\t\t\ttrailer[i] = (lhp_checksum >> (8 * (3 - i))) & 0xff;",
+    "\t\t}",
+    "\t\tlhp_gather(&gather, trailer, 4);",
+    "\t}",
+    "\tlhp_send(gather.iov, gather.count);",
+    "\tfree(lhp_body);",
+    "\tlhp_body = NULL;",
+    "}",
+    NULL
+};
+
+// Code that streams each response rather than sending it all at the end. The headers and header HTML are pushed on to the
+// web server as soon as the response starts (before the C code blocks run), then the response so far is sent whenever a
+// chunk's worth of it is waiting. An encoded response carries on as before: the HTML compressed at compile time ends with a
+// full flush, so it can be sent on its own, with the captured output in stored deflate blocks after it.
+const char *const response_streaming_code[] = {
+    "",
+    "// Bytes of static HTML among the pieces waiting to be sent, and bytes written by lhp_emitn() since the captured output was last measured.",
+    "LHP_PER_REQUEST size_t lhp_stream_html = 0;",
+    "LHP_PER_REQUEST size_t lhp_stream_written = 0;",
+    "",
+    "// Sends the headers and header HTML and pushes them on to the web server.",
+    "static void lhp_stream_start(const struct lhp_html *header)",
+    "{",
+    "\tstruct lhp_gather gather;",
+    "\tgather.count = 0;",
+    "\tlhp_stream_html = 0;",
+    "\tlhp_stream_written = 0;",
+    "\tlhp_gather_header(&gather, header);",
+    "\tlhp_send(gather.iov, gather.count);",
+    "\tlhp_output_flush();",
+    "}",
+    "",
+    "// Sends every piece waiting and the captured output, then starts capturing again from the start of the buffer.",
+    "static void lhp_stream_send(void)",
+    "{",
+    "\tstruct lhp_gather gather;",
+    "\tgather.count = 0;",
+    "\tlhp_gather_pieces(&gather);",
+    "\t// The output of the C code blocks goes back to the response while it is sent.",
+    "\tlhp_output_release();",
+    "\tlhp_send(gather.iov, gather.count);",
+    "\tlhp_output_flush();",
+    "\tlhp_output_capture(lhp_body_stream);",
+    "\tlhp_body_rewind();",
+    "\tlhp_stream_html = 0;",
+    "}",
+    "",
+    "// Counts static HTML and output added to the response, sending it once there is a chunk's worth waiting.",
+    "// The captured output is measured at each HTML segment, and after every chunk's worth written by lhp_emitn().",
+    "static void lhp_stream_check(size_t html_length, size_t written)",
+    "{",
+    "\tlhp_stream_html += html_length;",
+    "\tlhp_stream_written += written;",
+    "\tif (html_length == 0 && lhp_stream_written < LHP_STREAM_CHUNK) {",
+    "\t\treturn;",
+    "\t}",
+    "\tlhp_stream_written = 0;",
+    "\t// Cutting the captured output also brings lhp_body_length up to date.",
+    "\tlhp_cut_body();",
+    "\tif (lhp_stream_html + lhp_body_length >= LHP_STREAM_CHUNK) {",
+    "\t\tlhp_stream_send();",
+    "\t}",
+    "}",
+    NULL
+};
+
+// Code for writing to the response buffer directly, without going through printf(). Everything written is kept in the
+// response buffer (the captured output) and sent in one go at the end of the response.
+const char *const response_buffer_code[] = {
+    "",
+    "// Adds bytes to the response.",
+    "static inline void lhp_emitn(const char *data, size_t length)",
+    "{",
+    "\tif (lhp_capturing) {",
+    "\t\tlhp_body_write(data, length);",
+    "\t\tlhp_stream_check(0, length);",
+    "\t} else {",
+    "\t\tfwrite((void *)data, 1, length, stdout);",
+    "\t}",
+    "}",
+    "",
+    "// Adds a string to the response.",
+    "static inline void lhp_emit(const char *text)",
+    "{",
+    "\tlhp_emitn(text, strlen(text));",
+    "}",
+    "",
+    "// Adds formatted text (as printf() would) to the response.",
+    "static inline void lhp_emitf(const char *format, ...)",
+    "{",
+    "\tva_list arguments;",
+    "\tva_start(arguments, format);",
+    "\tif (lhp_capturing) {",
+    "\t\tlhp_body_vprintf(format, arguments);",
+    "\t} else {",
+    "\t\t// Without the response buffer, the text is formatted in the arena and written out straight away.",
+    "\t\tva_list copy;",
+    "\t\tva_copy(copy, arguments);",
+    "\t\tint length = vsnprintf(NULL, 0, format, copy);",
+    "\t\tva_end(copy);",
+    "\t\tchar *text = (length >= 0) ? lhp_alloc((size_t)length + 1) : NULL;",
+    "\t\tif (text != NULL) {",
+    "\t\t\tvsnprintf(text, (size_t)length + 1, format, arguments);",
+    "\t\t\tfwrite(text, 1, length, stdout);",
+    "\t\t}",
+    "\t}",
+    "\tva_end(arguments);",
+    "}",
+    "",
+    "// Adds text to the response with the characters that mean something in HTML (including in attribute values) escaped.",
+    "static inline void lhp_emit_html(const char *text)",
+    "{",
+    "\twhile (*text != '\\0') {",
+    "\t\tsize_t length = strcspn(text, \"&<>\\\"'\");",
+    "\t\tlhp_emitn(text, length);",
+    "\t\ttext += length;",
+    "\t\tswitch (*text) {",
+    "\t\tcase '&': lhp_emitn(\"&amp;\", 5); break;",
+    "\t\tcase '<': lhp_emitn(\"&lt;\", 4); break;",
+    "\t\tcase '>': lhp_emitn(\"&gt;\", 4); break;",
+    "\t\tcase '\"': lhp_emitn(\"&quot;\", 6); break;",
+    "\t\tcase '\\'': lhp_emitn(\"&#39;\", 5); break;",
+    "\t\tdefault: return;",
+    "\t\t}",
+    "\t\ttext++;",
+    "\t}",
+    "}",
+    "",
+    "// Adds text to the response percent-encoded for use in a URL (e.g. a query string value).",
+    "static inline void lhp_emit_url(const char *text)",
+    "{",
+    "\tstatic const char hex[] = \"0123456789ABCDEF\";",
+    "\twhile (*text != '\\0') {",
+    "\t\tsize_t length = strspn(text, \"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_.~\");",
+    "\t\tlhp_emitn(text, length);",
+    "\t\ttext += length;",
+    "\t\tif (*text != '\\0') {",
+    "\t\t\tchar escaped[3] = { '%', hex[(unsigned char)*text >> 4], hex[(unsigned char)*text & 15] };",
+    "\t\t\tlhp_emitn(escaped, 3);",
+    "\t\t\ttext++;",
+    "\t\t}",
+    "\t}",
+    "}",
+    NULL
+};
+
+// Response cache of a page with a cache tag. Fully rendered responses are kept in memory for LHP_CACHE_TTL seconds, found by
+// the values of the CGI variables in the cache tag (and the Content-Encoding of the response). The least recently used
+// responses are dropped to keep them within LHP_CACHE_MEMORY bytes. Only one request at a time renders a response that isn't
+// cached; in a threaded page, other requests for it wait (for a second at most) and are sent the same response.
+const char *const response_cache_code[] = {
+    "",
+    "#include <time.h>",
+    "",
+    "#define LHP_CACHE_BUCKETS 256",
+    "",
+    "struct lhp_cache_entry {",
+    "\t// The next entry in the same bucket, and the entries used just before and after this one.",
+    "\tstruct lhp_cache_entry *next;",
+    "\tstruct lhp_cache_entry *newer;",
+    "\tstruct lhp_cache_entry *older;",
+    "\tunsigned long long hash;",
+    "\tchar *key;",
+    "\tsize_t key_length;",
+    "\t// The response (NULL while a request is rendering it) and when it expires.",
+    "\tchar *response;",
+    "\tsize_t response_length;",
+    "\ttime_t expires;",
+    "\t// How many requests are sending the response, and whether it has been dropped from the cache (and is freed by the last of them).",
+    "\tint readers;",
+    "\tint dropped;",
+    "};",
+    "",
+    "static struct lhp_cache_entry *lhp_cache_buckets[LHP_CACHE_BUCKETS];",
+    "static struct lhp_cache_entry *lhp_cache_newest = NULL;",
+    "static struct lhp_cache_entry *lhp_cache_oldest = NULL;",
+    "static unsigned long long lhp_cache_memory = 0;",
+    "",
+    "// The entry the current request is rendering the response of (if any), and a copy of the response as it is sent.",
+    "LHP_PER_REQUEST struct lhp_cache_entry *lhp_cache_fill = NULL;",
+    "LHP_PER_REQUEST char *lhp_cache_data = NULL;",
+    "LHP_PER_REQUEST size_t lhp_cache_length = 0;",
+    "LHP_PER_REQUEST size_t lhp_cache_capacity = 0;",
+    "LHP_PER_REQUEST int lhp_cache_failed = 0;",
+    "",
+    "#ifdef LHP_THREADS",
+    "static pthread_mutex_t lhp_cache_mutex = PTHREAD_MUTEX_INITIALIZER;",
+    "static pthread_cond_t lhp_cache_rendered = PTHREAD_COND_INITIALIZER;",
+    "#define lhp_cache_lock() pthread_mutex_lock(&lhp_cache_mutex)",
+    "#define lhp_cache_unlock() pthread_mutex_unlock(&lhp_cache_mutex)",
+    "#define lhp_cache_broadcast() pthread_cond_broadcast(&lhp_cache_rendered)",
+    "#else",
+    "#define lhp_cache_lock()",
+    "#define lhp_cache_unlock()",
+    "#define lhp_cache_broadcast()",
+    "#endif",
+    "",
+    "static void lhp_cache_free(struct lhp_cache_entry *entry)",
+    "{",
+    "\tfree(entry->key);",
+    "\tfree(entry->response);",
+    "\tfree(entry);",
+    "}",
+    "",
+    "// Takes an entry out of the cache (with the lock held). It is freed once no request is sending it.",
+    "static void lhp_cache_drop(struct lhp_cache_entry *entry)",
+    "{",
+    "\tstruct lhp_cache_entry **link = &lhp_cache_buckets[entry->hash % LHP_CACHE_BUCKETS];",
+    "\twhile (*link != entry) {",
+    "\t\tlink = &(*link)->next;",
+    "\t}",
+    "\t*link = entry->next;",
+    "\t*(entry->newer != NULL ? &entry->newer->older : &lhp_cache_newest) = entry->older;",
+    "\t*(entry->older != NULL ? &entry->older->newer : &lhp_cache_oldest) = entry->newer;",
+    "\tlhp_cache_memory -= sizeof(*entry) + entry->key_length + entry->response_length;",
+    "\tentry->dropped = 1;",
+    "\tif (entry->readers == 0) {",
+    "\t\tlhp_cache_free(entry);",
+    "\t}",
+    "}",
+    "",
+    "// Makes an entry the most recently used (with the lock held).",
+    "static void lhp_cache_use(struct lhp_cache_entry *entry)",
+    "{",
+    "\tif (entry == lhp_cache_newest) {",
+    "\t\treturn;",
+    "\t}",
+    "\tif (entry->newer != NULL) {",
+    "\t\t*(entry->older != NULL ? &entry->older->newer : &lhp_cache_oldest) = entry->newer;",
+    "\t\tentry->newer->older = entry->older;",
+    "\t}",
+    "\tentry->older = lhp_cache_newest;",
+    "\tentry->newer = NULL;",
+    "\t*(lhp_cache_newest != NULL ? &lhp_cache_newest->newer : &lhp_cache_oldest) = entry;",
+    "\tlhp_cache_newest = entry;",
+    "}",
+    "",
+    "// Gives up on caching the response of the current request, letting any requests waiting for it render it themselves.",
+    "static void lhp_cache_abandon(void)",
+    "{",
+    "\tif (lhp_cache_fill != NULL) {",
+    "\t\tlhp_cache_lock();",
+    "\t\tlhp_cache_drop(lhp_cache_fill);",
+    "\t\tlhp_cache_broadcast();",
+    "\t\tlhp_cache_unlock();",
+    "\t\tlhp_cache_fill = NULL;",
+    "\t}",
+    "\tfree(lhp_cache_data);",
+    "\tlhp_cache_data = NULL;",
+    "\tlhp_cache_length = 0;",
+    "\tlhp_cache_capacity = 0;",
+    "\tlhp_cache_failed = 0;",
+    "}",
+    "",
+    "// Keeps a copy of the pieces of a response being cached as they are sent.",
+    "static void lhp_cache_record(struct iovec *iov, int count)",
+    "{",
+    "\tfor (int i = 0; i < count && lhp_cache_fill != NULL && !lhp_cache_failed; i++) {",
+    "\t\tif (lhp_cache_capacity - lhp_cache_length < iov[i].iov_len) {",
+    "\t\t\tsize_t capacity = (lhp_cache_capacity == 0) ? 4096 : lhp_cache_capacity;",
+    "\t\t\twhile (capacity - lhp_cache_length < iov[i].iov_len) {",
+    "\t\t\t\tcapacity *= 2;",
+    "\t\t\t}",
+    "\t\t\t// A response that could never fit in the cache isn't kept.",
+    "\t\t\tchar *data = (capacity / 2 <= LHP_CACHE_MEMORY) ? realloc(lhp_cache_data, capacity) : NULL;",
+    "\t\t\tif (data == NULL) {",
+    "\t\t\t\tlhp_cache_failed = 1;",
+    "\t\t\t\treturn;",
+    "\t\t\t}",
+    "\t\t\tlhp_cache_data = data;",
+    "\t\t\tlhp_cache_capacity = capacity;",
+    "\t\t}",
+    "\t\tmemcpy(lhp_cache_data + lhp_cache_length, iov[i].iov_base, iov[i].iov_len);",
+    "\t\tlhp_cache_length += iov[i].iov_len;",
+    "\t}",
+    "}",
+    "",
+    "// Puts the response of the current request in the cache once it has been sent, dropping the least recently used",
+    "// responses to make room for it, and wakes any requests waiting for it.",
+    "static void lhp_cache_finish(void)",
+    "{",
+    "\t// A response sent without the response buffer (as it went) wasn't recorded.",
+    "\tif (lhp_cache_fill == NULL || lhp_cache_failed || lhp_cache_length == 0 || lhp_cache_length > LHP_CACHE_MEMORY) {",
+    "\t\tlhp_cache_abandon();",
+    "\t\treturn;",
+    "\t}",
+    "\tchar *response = realloc(lhp_cache_data, lhp_cache_length);",
+    "\tstruct lhp_cache_entry *entry = lhp_cache_fill;",
+    "\tlhp_cache_lock();",
+    "\tentry->response = (response != NULL) ? response : lhp_cache_data;",
+    "\tentry->response_length = lhp_cache_length;",
+    "\tentry->expires = time(NULL) + LHP_CACHE_TTL;",
+    "\tlhp_cache_memory += lhp_cache_length;",
+    "\tfor (struct lhp_cache_entry *oldest = lhp_cache_oldest; lhp_cache_memory > LHP_CACHE_MEMORY && oldest != NULL; ) {",
+    "\t\tstruct lhp_cache_entry *newer = oldest->newer;",
+    "\t\t// Responses still being rendered are left alone.",
+    "\t\tif (oldest->response != NULL) {",
+    "\t\t\tlhp_cache_drop(oldest);",
+    "\t\t}",
+    "\t\toldest = newer;",
+    "\t}",
+    "\tlhp_cache_broadcast();",
+    "\tlhp_cache_unlock();",
+    "\tlhp_cache_fill = NULL;",
+    "\tlhp_cache_data = NULL;",
+    "\tlhp_cache_length = 0;",
+    "\tlhp_cache_capacity = 0;",
+    "}",
+    "",
+    "// Sends the cached response for the current request, returning 1 if there is one. Otherwise (unless the request",
+    "// can't be cached) the current request is left to render the response, which is cached by lhp_cache_finish().",
+    "static int lhp_cache_serve(void)",
+    "{",
+    "\t// Anything left over from a request that never reached the footer HTML isn't cached.",
+    "\tlhp_cache_abandon();",
+    "\tconst char *method = getenv(\"REQUEST_METHOD\");",
+    "\tif (method != NULL && strcmp(method, \"GET\") != 0 && strcmp(method, \"HEAD\") != 0) {",
+    "\t\treturn 0;",
+    "\t}",
+    "\tlhp_metrics_mark(LHP_METRICS_START);",
+    "",
+    "\t// The key is the Content-Encoding, then each variable (its value and a NUL if it is set, otherwise just a NUL).",
+    "\tsize_t key_length = 1;",
+    "\tfor (int i = 0; lhp_cache_keys[i] != NULL; i++) {",
+    "\t\tconst char *value = getenv(lhp_cache_keys[i]);",
+    "\t\tkey_length += (value != NULL) ? strlen(value) + 2 : 1;",
+    "\t}",
+    "\tchar *key = malloc(key_length);",
+    "\tif (key == NULL) {",
+    "\t\treturn 0;",
+    "\t}",
+    "\tsize_t length = 0;",
+    "\tkey[length++] = (char)('0' + lhp_accepted_encoding(getenv(\"HTTP_ACCEPT_ENCODING\")));",
+    "\tfor (int i = 0; lhp_cache_keys[i] != NULL; i++) {",
+    "\t\tconst char *value = getenv(lhp_cache_keys[i]);",
+    "\t\tif (value != NULL) {",
+    "\t\t\tkey[length++] = '=';",
+    "\t\t\tmemcpy(key + length, value, strlen(value) + 1);",
+    "\t\t\tlength += strlen(value) + 1;",
+    "\t\t} else {",
+    "\t\t\tkey[length++] = '\\0';",
+    "\t\t}",
+    "\t}",
+    "\t// FNV-1a hash of the key.",
+    "\tunsigned long long hash = 14695981039346656037ULL;",
+    "\tfor (size_t i = 0; i < key_length; i++) {",
+    "\t\thash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;",
+    "\t}",
+    "",
+    "#ifdef LHP_THREADS",
+    "\tstruct timespec deadline;",
+    "\tclock_gettime(CLOCK_REALTIME, &deadline);",
+    "\tdeadline.tv_sec += 1;",
+    "#endif",
+    "\ttime_t now = time(NULL);",
+    "\tstruct lhp_cache_entry *entry;",
+    "\tlhp_cache_lock();",
+    "\tfor (;;) {",
+    "\t\tentry = lhp_cache_buckets[hash % LHP_CACHE_BUCKETS];",
+    "\t\twhile (entry != NULL && (entry->hash != hash || entry->key_length != key_length || memcmp(entry->key, key, key_length) != 0)) {",
+    "\t\t\tentry = entry->next;",
+    "\t\t}",
+    "\t\tif (entry != NULL && entry->response != NULL && entry->expires <= now) {",
+    "\t\t\tlhp_cache_drop(entry);",
+    "\t\t\tentry = NULL;",
+    "\t\t}",
+    "\t\tif (entry == NULL || entry->response != NULL) {",
+    "\t\t\tbreak;",
+    "\t\t}",
+    "\t\t// Another request is rendering the response, so wait for it rather than render it again.",
+    "#ifdef LHP_THREADS",
+    "\t\tif (pthread_cond_timedwait(&lhp_cache_rendered, &lhp_cache_mutex, &deadline) != ETIMEDOUT) {",
+    "\t\t\tcontinue;",
+    "\t\t}",
+    "#endif",
+    "\t\t// It is taking too long, so render it as well, without caching it.",
+    "\t\tlhp_cache_unlock();",
+    "\t\tfree(key);",
+    "\t\treturn 0;",
+    "\t}",
+    "",
+    "\tif (entry == NULL) {",
+    "\t\t// Nothing is cached, so this request renders the response, with a place kept for it in the cache.",
+    "\t\tentry = calloc(1, sizeof(*entry));",
+    "\t\tif (entry != NULL) {",
+    "\t\t\tentry->hash = hash;",
+    "\t\t\tentry->key = key;",
+    "\t\t\tentry->key_length = key_length;",
+    "\t\t\tentry->next = lhp_cache_buckets[hash % LHP_CACHE_BUCKETS];",
+    "\t\t\tlhp_cache_buckets[hash % LHP_CACHE_BUCKETS] = entry;",
+    "\t\t\tlhp_cache_use(entry);",
+    "\t\t\tlhp_cache_memory += sizeof(*entry) + key_length;",
+    "\t\t\tlhp_cache_fill = entry;",
+    "\t\t} else {",
+    "\t\t\tfree(key);",
+    "\t\t}",
+    "\t\tlhp_cache_unlock();",
+    "\t\treturn 0;",
+    "\t}",
+    "",
+    "\t// Send the cached response (outside of the lock, so that a slow client doesn't hold up other requests).",
+    "\tlhp_cache_use(entry);",
+    "\tentry->readers++;",
+    "\tlhp_cache_unlock();",
+    "\tfree(key);",
+    "\tlhp_metrics_mark(LHP_METRICS_HEADER);",
+    "\tlhp_metrics_mark(LHP_METRICS_BODY);",
+    "\tstruct iovec iov = { entry->response, entry->response_length };",
+    "\tlhp_output_gather(&iov, 1);",
+    "\tlhp_cache_lock();",
+    "\tif (--entry->readers == 0 && entry->dropped) {",
+    "\t\tlhp_cache_free(entry);",
+    "\t}",
+    "\tlhp_cache_unlock();",
+    "\tlhp_metrics_mark(LHP_METRICS_FOOTER);",
+    "\treturn 1;",
+    "}",
+    NULL
+};
+
+// Code that answers a request with 304 Not Modified when the client already has the page as it was built. The ETag is
+// weak, as the responses of each Content-Encoding are the same page, and is compared with each entity tag of
+// If-None-Match without its "W/" (as weak comparison calls for).
+const char *const not_modified_code[] = {
+    "",
+    "// Sends 304 Not Modified (without running the C code block) if If-None-Match lists the ETag, returning 1 if it did.",
+    "static int lhp_not_modified(void)",
+    "{",
+    "\tstatic const char headers[] = \"Status: 304 Not Modified\\nETag: \" LHP_ETAG \"\\nVary: Accept-Encoding\\n\\n\";",
+    "\tconst char *match = getenv(\"HTTP_IF_NONE_MATCH\");",
+    "\tconst char *method = getenv(\"REQUEST_METHOD\");",
+    "\tif (match == NULL || (method != NULL && strcmp(method, \"GET\") != 0 && strcmp(method, \"HEAD\") != 0)) {",
+    "\t\treturn 0;",
+    "\t}",
+    "\tconst char *etag = LHP_ETAG + 2;",
+    "\tsize_t etag_length = sizeof(LHP_ETAG) - 3;",
+    "\twhile (*match != '\\0') {",
+    "\t\tmatch += strspn(match, \", \\t\");",
+    "\t\tsize_t length = strcspn(match, \", \\t\");",
+    "\t\tif (length > 2 && strncmp(match, \"W/\", 2) == 0) {",
+    "\t\t\tmatch += 2;",
+    "\t\t\tlength -= 2;",
+    "\t\t}",
+    "\t\tif ((length == 1 && *match == '*') || (length == etag_length && memcmp(match, etag, length) == 0)) {",
+    "\t\t\tstruct iovec iov = { (void *)headers, sizeof(headers) - 1 };",
+    "\t\t\tlhp_metrics_mark(LHP_METRICS_START);",
+    "\t\t\tlhp_output_gather(&iov, 1);",
+    "\t\t\tlhp_metrics_mark(LHP_METRICS_HEADER);",
+    "\t\t\tlhp_metrics_mark(LHP_METRICS_BODY);",
+    "\t\t\tlhp_metrics_mark(LHP_METRICS_FOOTER);",
+    "\t\t\treturn 1;",
+    "\t\t}",
+    "\t\tmatch += length;",
+    "\t}",
+    "\treturn 0;",
+    "}",
+    NULL
+};
+
+/**
+ * This function is 2nd of the 3 major analysis functions of the program with the main aim
+ * of copying any HTML from the LHP File (source) to the C File (intermediary_file).
+ * Each portion of HTML is copied both as it is and compressed (gzip and deflate share the same compressed data),
+ * and the generated functions choose between them based on the Accept-Encoding of each request.
+ * 
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the LHP File where data will be read from.
+ * @param[in] streaming - Whether each response is streamed in chunks (starting with the header HTML) rather than sent at the end.
+ * @param[out] intermediary_file - The output file where the data will be written to.
+ * \return int - Error status.
+ */
+int analyse_html(struct lhp_source *source, int streaming, FILE *intermediary_file)
+{
+    // Compressed forms of the header and footer HTML (empty until compressed, so that both can be freed whatever happens).
+    struct compressed_html header = { 0 };
+    struct compressed_html footer = { 0 };
+    int status = 0;
+
+    // Compress both portions of HTML up front.
+    if(deflate_html(source, LHP_HEADER_HTML, LHP_ALL_SEGMENTS, Z_FULL_FLUSH, &header) != 0 || deflate_html(source, LHP_FOOTER_HTML, LHP_ALL_SEGMENTS, Z_FINISH, &footer) != 0){
+        status = 1;
+    } else {
+        // Insert the code that picks the encoding of each response and sends the encoded HTML, and the functions for writing to the response buffer.
+        // The response cache (if the page has one) keeps a copy of each response as it is sent; otherwise the calls to it are taken out.
+        if(source->cache.ttl > 0){
+            fprintf(intermediary_file, "\n%s\n", "static void lhp_cache_record(struct iovec *iov, int count);");
+        } else {
+            fprintf(intermediary_file, "\n%s\n", "#define lhp_cache_record(iov, count)");
+            fprintf(intermediary_file, "%s\n", "#define lhp_cache_finish()");
+        }
+        // Responses of a page that only depend on the build carry its ETag.
+        if(source->etag != 0){
+            fprintf(intermediary_file, "\n#define LHP_ETAG \"W/\\\"%016llx\\\"\"\n", source->etag);
+            fprintf(intermediary_file, "%s\n", "#define LHP_ETAG_HEADER \"ETag: \" LHP_ETAG \"\\n\"");
+        } else {
+            fprintf(intermediary_file, "\n%s\n", "#define LHP_ETAG_HEADER \"\"");
+        }
+        // Likewise, a streamed response is sent in chunks as it goes; otherwise it is all sent at the end.
+        if(streaming){
+            fprintf(intermediary_file, "\n#define LHP_STREAM_CHUNK %d\n", LHP_STREAM_CHUNK);
+            fprintf(intermediary_file, "%s\n", "static void lhp_stream_start(const struct lhp_html *header);");
+            fprintf(intermediary_file, "%s\n", "static void lhp_stream_check(size_t html_length, size_t written);");
+        } else {
+            fprintf(intermediary_file, "\n%s\n", "#define lhp_stream_start(header)");
+            fprintf(intermediary_file, "%s\n", "#define lhp_stream_check(html_length, written)");
+        }
+        print_lines(response_encoding_code, intermediary_file);
+        if(streaming){
+            print_lines(response_streaming_code, intermediary_file);
+        }
+        print_lines(response_buffer_code, intermediary_file);
+        if(source->cache.ttl > 0){
+            fprintf(intermediary_file, "\n#define LHP_CACHE_TTL %ld\n#define LHP_CACHE_MEMORY %lluULL\n", source->cache.ttl, source->cache.memory);
+            fprintf(intermediary_file, "%s", "static const char *const lhp_cache_keys[] = { \"");
+            for(size_t i = 0; i < source->cache.key_length; i++){
+                fprintf(intermediary_file, (source->cache.key[i] == ',') ? "\", \"" : "%c", source->cache.key[i]);
+            }
+            fprintf(intermediary_file, "%s\n", "\", NULL };");
+            print_lines(response_cache_code, intermediary_file);
+        }
+        if(source->etag != 0){
+            print_lines(not_modified_code, intermediary_file);
+        }
+
+        // Start the header function for the first portion of HTML (everything before the first "<£lhp" start tag).
+        // Follwiing header allows for the code to be compatible with a web server and therefore viewable via a web browser.
+        fprintf(intermediary_file, "\n%s\n", "// Header HTML Function.");
+        char headers[128];
+        if(source->etag != 0){
+            snprintf(headers, sizeof(headers), "Content-type: text/html\nVary: Accept-Encoding\nETag: W/\"%016llx\"\n\n", source->etag);
+        } else {
+            snprintf(headers, sizeof(headers), "%s", "Content-type: text/html\nVary: Accept-Encoding\n\n");
+        }
+        print_html_buffer(source, LHP_HEADER_HTML, LHP_ALL_SEGMENTS, headers, "header_html_data", intermediary_file);
+        print_compressed_buffer(&header, "header_html_deflated", intermediary_file);
+        print_html_segment(&header, "header_html", "static const struct lhp_html header_html_segment =", intermediary_file);
+        fprintf(intermediary_file, "%s\n", ";");
+        fprintf(intermediary_file, "%s\n", "static void header_html(void)\n{");
+        fprintf(intermediary_file, "\t%s\n", "lhp_metrics_mark(LHP_METRICS_START);");
+        fprintf(intermediary_file, "\t%s\n", "lhp_response_start(&header_html_segment);");
+        fprintf(intermediary_file, "\t%s\n", "lhp_metrics_mark(LHP_METRICS_HEADER);");
+        fprintf(intermediary_file, "}\n");
+
+        // The HTML between the C code blocks is kept as a table of segments, each compressed on its own (ending with a full flush)
+        // so that it can be sent as it is or dropped into an encoded response wherever the C code blocks call for it.
+        size_t inner_count = 0;
+        for(size_t i = 0; i < source->segment_count; i++){
+            if(source->segments[i].kind == LHP_INNER_HTML){
+                inner_count++;
+            }
+        }
+        if(inner_count > 0){
+            // The checksums of each segment are kept for the table, which follows the buffers.
+            struct compressed_html *inner = calloc(inner_count, sizeof(*inner));
+            size_t inner_index = 0;
+            char name[64];
+            if(inner == NULL){
+                status = 1;
+            } else {
+                fprintf(intermediary_file, "\n%s\n", "// HTML Segments (between the C code blocks).");
+            }
+            for(size_t i = 0; i < source->segment_count && status == 0; i++){
+                if(source->segments[i].kind != LHP_INNER_HTML){
+                    continue;
+                }
+                if(deflate_html(source, LHP_INNER_HTML, i, Z_FULL_FLUSH, &inner[inner_index]) != 0){
+                    status = 1;
+                } else {
+                    snprintf(name, sizeof(name), "html_segment_%zu_data", inner_index);
+                    print_html_buffer(source, LHP_INNER_HTML, i, "", name, intermediary_file);
+                    snprintf(name, sizeof(name), "html_segment_%zu_deflated", inner_index);
+                    print_compressed_buffer(&inner[inner_index], name, intermediary_file);
+                }
+                free(inner[inner_index].data);
+                inner[inner_index].data = NULL;
+                inner_index++;
+            }
+            if(status == 0){
+                fprintf(intermediary_file, "%s\n", "static const struct lhp_html lhp_html_segments[] = {");
+                for(size_t i = 0; i < inner_count; i++){
+                    snprintf(name, sizeof(name), "html_segment_%zu", i);
+                    print_html_segment(&inner[i], name, "\t", intermediary_file);
+                    fprintf(intermediary_file, "%s\n", ",");
+                }
+                fprintf(intermediary_file, "%s\n", "};");
+            }
+            free(inner);
+        }
+
+        // Start the footer function for the final portion of HTML (everything after the last "£>" end tag), which sends the whole response.
+        fprintf(intermediary_file, "\n%s\n", "// Footer HTML Function.");
+        print_html_buffer(source, LHP_FOOTER_HTML, LHP_ALL_SEGMENTS, "", "footer_html_data", intermediary_file);
+        print_compressed_buffer(&footer, "footer_html_deflated", intermediary_file);
+        print_html_segment(&footer, "footer_html", "static const struct lhp_html footer_html_segment =", intermediary_file);
+        fprintf(intermediary_file, "%s\n", ";");
+        fprintf(intermediary_file, "%s\n", "static void footer_html(void)\n{");
+        fprintf(intermediary_file, "\t%s\n", "lhp_metrics_mark(LHP_METRICS_BODY);");
+        fprintf(intermediary_file, "\t%s\n", "lhp_response_end(&header_html_segment, &footer_html_segment);");
+        fprintf(intermediary_file, "\t%s\n", "lhp_cache_finish();");
+        fprintf(intermediary_file, "\t%s\n", "lhp_metrics_mark(LHP_METRICS_FOOTER);");
+        fprintf(intermediary_file, "}\n");
+    }
+
+    // As dynamic memory manipulation was involved, freeing the memory once the analysis has succeeded is required.
+    free(header.data);
+    free(footer.data);
+    return status;
+}
+
+/**
+ * This function is 3rd of the 3 major analysis functions of the program with the main aim
+ * of copying any C code from the LHP File (source) to the C File (intermediary_file).
+ * The C code blocks are copied one after another as a single main function, with a call to send each portion of
+ * HTML between them at the point it appears (so HTML can be repeated by a loop or left out by an if statement).
+ * 
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the LHP File where data will be read from.
+ * @param[in] handler - The name to give the main function if the page is part of a bundle or threaded (NULL for a page of its own).
+ * @param[out] intermediary_file - The output file where the data will be written to.
+ * \return int - Error status.
+ */
+int analyse_c(struct lhp_source *source, const char *handler, FILE *intermediary_file)
+{
+    // Indentation of the C code block, taken from the line the main function starts on.
+    size_t indent_counter = 0;
+    int status = 0;
+
+    // Declare the init function (defined after the C code block, so that it can use anything the C code block declares).
+    if(handler != NULL){
+        fprintf(intermediary_file, "\nvoid %s_init(void);\n", handler);
+    } else {
+        fprintf(intermediary_file, "\n%s\n", "static void lhp_init(void);");
+    }
+
+    // Number of HTML segments between the C code blocks so far.
+    size_t inner_count = 0;
+
+    // Loop through the C code block segments and the HTML between them (pre-processor directives have already been processed and the LHP tags are not part of any segment).
+    for(size_t i = 0; i < source->segment_count; i++){
+        struct lhp_segment *segment = &source->segments[i];
+        // The HTML between two C code blocks is added to the response wherever it comes in the code (e.g. inside a loop).
+        if(segment->kind == LHP_INNER_HTML){
+            fprintf(intermediary_file, "\t\tlhp_html_segment(&lhp_html_segments[%zu]);\n", inner_count++);
+            continue;
+        }
+        if(segment->kind != LHP_C_BLOCK){
+            continue;
+        }
+
+        const char *cursor = segment->start;
+        const char *end = segment->start + segment->length;
+
+        // Loop through the segment, line by line.
+        while(cursor < end){
+            const char *line;
+            size_t length = next_line(&cursor, end, &line);
+            // Pointer for indentation.
+            const char *c_line = line;
+            size_t c_length = length;
+
+            // Check for the start of the main function and the return statement of the main function.
+            int is_main = (find_text(line, length, "main(") != NULL);
+            int is_return = (find_text(line, length, "return 0") != NULL);
+
+            // Calculate the indentation space of the C code block so that it can be removed when copying to C (intermediary) file.
+            if(is_main){
+                indent_counter = 0;
+                // Check for and count occurences of leading whitespace.
+                while(indent_counter < length && (line[indent_counter] == ' ' || line[indent_counter] == '\t')){
+                    indent_counter++;
+                }
+            }
+
+            // Check to make sure that the current line is bigger than the C code block indentation.
+            if(length >= indent_counter){
+                // Point to the indentation, so that the line starts here.
+                c_line = line + indent_counter;
+                c_length = length - indent_counter;
+            }
+
+            // Locate start of main function and indent any extra lines accordingly before printing.
+            if(is_main && handler != NULL){
+                // A bundled page's main function becomes its handler, which the bundle calls once per request with no argument parameters.
+                const char *name = find_text(c_line, c_length, "main(");
+                const char *parameters = name + strlen("main(");
+                size_t parameters_length = (c_line + c_length) - parameters;
+                while(parameters_length > 0 && isspace((unsigned char)*parameters)){
+                    parameters++;
+                    parameters_length--;
+                }
+                if(!(parameters_length >= 1 && parameters[0] == ')') && !(parameters_length >= 5 && memcmp(parameters, "void)", 5) == 0)){
+                    status = 1;
+                }
+                fprintf(intermediary_file, "%.*s%s%.*s\n", (int)(name - c_line), c_line, handler, (int)(c_length - (name + strlen("main") - c_line)), name + strlen("main"));
+                // A client that already has the page is told so, and a cached response is sent, without running the C code block at all.
+                if(source->etag != 0){
+                    fprintf(intermediary_file, "\t\t%s\n", "if (lhp_not_modified()) {\n\t\t\treturn 0;\n\t\t}");
+                }
+                if(source->cache.ttl > 0){
+                    fprintf(intermediary_file, "\t\t%s\n", "if (lhp_cache_serve()) {\n\t\t\treturn 0;\n\t\t}");
+                }
+                // Insert header HTML function call into the handler.
+                fprintf(intermediary_file, "\t\t%s\n", "header_html();");
+            } else if(is_main){
+                // Print the main function line.
+                fprintf(intermediary_file, "%.*s\n", (int)c_length, c_line);
+                // Start the pool of workers if the page has a supervisor (each worker goes on from here), then
+                // run the init block once, before the first request is accepted.
+                fprintf(intermediary_file, "\t%s\n", "lhp_supervise();");
+                fprintf(intermediary_file, "\t%s\n", "lhp_init();");
+                // Insert relevant FastCGI while statement to allow for C code to be FastCGI compatible.
+                fprintf(intermediary_file, "\t%s\n", "while (FCGI_Accept() >= 0){");
+                if(source->etag != 0){
+                    fprintf(intermediary_file, "\t\t%s\n", "if (lhp_not_modified()) {\n\t\t\tcontinue;\n\t\t}");
+                }
+                if(source->cache.ttl > 0){
+                    fprintf(intermediary_file, "\t\t%s\n", "if (lhp_cache_serve()) {\n\t\t\tcontinue;\n\t\t}");
+                }
+                // Insert header HTML function call into C code block before main.
+                fprintf(intermediary_file, "\t\t%s\n", "header_html();");
+            // Locate the return statement of the main function and indent any extra lines accordingly before printing.
+            } else if(is_return){
+                // Insert footer function call into C code block before main's return statement.
+                fprintf(intermediary_file, "\t\t%s\n", "footer_html();");
+                // Insert corresponding end bracket to the finish FastCGI while code block (a bundled page's handler has no loop of its own).
+                if(handler == NULL){
+                    fprintf(intermediary_file, "\t%s\n", "}");
+                }
+                // Print remainder C code (expected to be the main's return statement).
+                fprintf(intermediary_file, "%.*s\n", (int)c_length, c_line);
+            // Make sure to indent the main function closing bracket.
+            } else if(c_length == 1 && c_line[0] == '}'){
+                // Doesn't need to be wrapped in printf() as C code is being sent to a C (intermediary) File.
+                fprintf(intermediary_file, "%.*s\n", (int)c_length, c_line);
+            } else {
+                // Doesn't need to be wrapped in printf() as C code is being sent to a C (intermediary) File.
+                //Indent any extra lines accordingly.
+                fprintf(intermediary_file, "\t\t%.*s\n", (int)c_length, c_line);
+            }
+        }
+    }
+    return status;
+}
+
+/**
+ * This function copies the init block (the C code between the "<£init" tag and its "£>" end tag) to the C File (intermediary_file)
+ * as a function of its own. It is called once per process, before the first request is accepted, so anything it sets up
+ * (e.g. the settings of a database connection) lasts for every request. A page without an init block gets an empty one.
+ *
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the LHP File where data will be read from.
+ * @param[in] handler - The name of the page's handler (if it has one), which the name of the init function is based on.
+ * @param[out] intermediary_file - The output file where the data will be written to.
+ */
+void analyse_init(struct lhp_source *source, const char *handler, FILE *intermediary_file)
+{
+    // Indentation of the init block, taken from its first line with anything on it.
+    size_t indent_counter = 0;
+    int indent_found = 0;
+
+    // The init function of a bundled (or threaded) page is called from outside it, so it isn't static.
+    fprintf(intermediary_file, "\n%s\n", "// Init Block Function (run once, before the first request).");
+    if(handler != NULL){
+        fprintf(intermediary_file, "void %s_init(void)\n{\n", handler);
+    } else {
+        fprintf(intermediary_file, "%s\n", "static void lhp_init(void)\n{");
+    }
+    // Claim a slot for the process's runtime metrics first (this does nothing unless they are recorded).
+    fprintf(intermediary_file, "\t%s\n", "lhp_metrics_open();");
+
+    // Loop through the init block segments only.
+    for(size_t i = 0; i < source->segment_count; i++){
+        struct lhp_segment *segment = &source->segments[i];
+        if(segment->kind != LHP_INIT_BLOCK){
+            continue;
+        }
+
+        const char *cursor = segment->start;
+        const char *end = segment->start + segment->length;
+
+        // Loop through the segment, line by line, removing the indentation of the block so that it can be indented to suit the function.
+        while(cursor < end){
+            const char *line;
+            size_t length = next_line(&cursor, end, &line);
+            size_t leading = 0;
+            while(leading < length && (line[leading] == ' ' || line[leading] == '\t')){
+                leading++;
+            }
+            if(!indent_found && leading < length){
+                indent_counter = leading;
+                indent_found = 1;
+            }
+            size_t skip = (leading < indent_counter) ? leading : indent_counter;
+            fprintf(intermediary_file, "\t%.*s\n", (int)(length - skip), line + skip);
+        }
+    }
+    fprintf(intermediary_file, "}\n");
+}
+
+// The flags used to compile each C File into an EXE File (including those needed by threaded pages), and the libraries needed for FastCGI and the encoded responses.
+// The flags of the build profile are added to these. (librt is only needed for shm_open() by older C libraries.)
+// The flags needed for MySQL are added after these, as reported by mysql_config.
+const char *const compiler_flags[] = { "-std=c99", "-Wall", "-pthread", NULL };
+const char *const compiler_libraries[] = { "-lfcgi", "-lz", "-lrt", NULL };
+
+// The extra flags used by each build profile. Release builds are optimised, with every function and variable in a section of
+// its own so that the linker can leave out any that aren't used. Debug builds are left unoptimised with debugging information.
+const char *const debug_flags[] = { "-g", NULL };
+const char *const release_flags[] = { "-O2", "-ffunction-sections", "-fdata-sections", "-Wl,--gc-sections", NULL };
+
+// The extra flags used to build a page as a module for a host, and to link the host (exporting libfcgi for the modules to use, and with dlopen()).
+const char *const module_flags[] = { "-fPIC", "-shared", "-fvisibility=hidden", NULL };
+const char *const host_libraries[] = { "-rdynamic", "-Wl,--whole-archive", "-lfcgi", "-Wl,--no-whole-archive", "-ldl", NULL };
+
+/**
+ * This function finds the flags for the build profile chosen by the user. Release builds of pages of their own are also
+ * optimised across the whole program at link time (LTO); bundled pages aren't, as their symbols are made local with objcopy
+ * before they are linked, which the intermediate code kept for LTO doesn't take into account.
+ *
+ * @author Iqra Haq
+ * @param[in] profile - The build profile.
+ * @param[in] bundled - Whether the flags are for part of a bundle.
+ * @param[out] flags - The flags (at most LHP_MAX_PROFILE_FLAGS, followed by a NULL).
+ * \return size_t - The number of flags.
+ */
+size_t profile_flags(enum lhp_build_profile profile, int bundled, const char *flags[])
+{
+    size_t count = 0;
+    const char *const *chosen = (profile == LHP_DEBUG) ? debug_flags : release_flags;
+    for(size_t i = 0; chosen[i] != NULL; i++){
+        flags[count++] = chosen[i];
+    }
+    if(profile != LHP_DEBUG && !bundled){
+        flags[count++] = "-flto";
+    }
+    flags[count] = NULL;
+    return count;
+}
+
+/**
+ * This function runs a program directly (without a shell) and waits for it to finish,
+ * capturing everything it outputs (standard output and standard error) through a pipe.
+ *
+ * @author Iqra Haq
+ * @param[in] arguments - The program and its argument parameters, ending with a NULL.
+ * @param[out] output - The captured output (to be freed by the caller).
+ * @param[out] output_length - The length of the captured output.
+ * \return int - The exit status of the program, or -1 if it couldn't be run.
+ */
+int run_program(char *const arguments[], char **output, size_t *output_length)
+{
+    int pipe_ends[2];
+    pid_t pid;
+    int status = -1;
+    posix_spawn_file_actions_t actions;
+    FILE *captured;
+
+    *output = NULL;
+    *output_length = 0;
+    captured = open_memstream(output, output_length);
+    if(captured == NULL){
+        return -1;
+    }
+    if(pipe(pipe_ends) != 0){
+        fclose(captured);
+        return -1;
+    }
+
+    // Send both standard output and standard error of the program into the pipe.
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addclose(&actions, pipe_ends[0]);
+    posix_spawn_file_actions_adddup2(&actions, pipe_ends[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipe_ends[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipe_ends[1]);
+
+    if(posix_spawnp(&pid, arguments[0], &actions, NULL, arguments, environ) == 0){
+        // Read everything the program outputs until it closes the pipe, then collect its exit status.
+        char buffer[4096];
+        ssize_t read_length;
+        close(pipe_ends[1]);
+        while((read_length = read(pipe_ends[0], buffer, sizeof(buffer))) != 0){
+            if(read_length > 0){
+                fwrite(buffer, 1, read_length, captured);
+            } else if(errno != EINTR){
+                break;
+            }
+        }
+        int wait_status;
+        while(waitpid(pid, &wait_status, 0) == -1 && errno == EINTR){}
+        status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : -1;
+    } else {
+        close(pipe_ends[1]);
+    }
+
+    close(pipe_ends[0]);
+    posix_spawn_file_actions_destroy(&actions);
+    fclose(captured);
+    return status;
+}
+
+/**
+ * This function finds the flags needed to compile against MySQL by running "mysql_config --cflags --libs".
+ * This is done once per run of the program and shared by every LHP File, rather than once for every gcc command.
+ *
+ * @author Iqra Haq
+ * @param[out] toolchain - The toolchain to store the flags in.
+ * @param[out] lhp_log - The log file to store any errors in.
+ */
+void resolve_toolchain(struct lhp_toolchain *toolchain, FILE *lhp_log)
+{
+    char *const arguments[] = { "mysql_config", "--cflags", "--libs", NULL };
+    size_t output_length;
+
+    memset(toolchain, 0, sizeof(*toolchain));
+    if(run_program(arguments, &toolchain->mysql_output, &output_length) != 0){
+        // Pages can still be compiled without MySQL, so this is only noted in the log.
+        log_message(lhp_log, LHP_WARNING, "%s\n", "mysql_config could not be run, so pages will be compiled without the MySQL flags.");
+        free(toolchain->mysql_output);
+        toolchain->mysql_output = NULL;
+        return;
+    }
+
+    // Split the output into separate flags, in place, wherever there is whitespace.
+    for(char *flag = strtok(toolchain->mysql_output, " \t\r\n"); flag != NULL; flag = strtok(NULL, " \t\r\n")){
+        char **flags = realloc(toolchain->mysql_flags, (toolchain->mysql_flag_count + 1) * sizeof(*flags));
+        if(flags == NULL){
+            break;
+        }
+        toolchain->mysql_flags = flags;
+        toolchain->mysql_flags[toolchain->mysql_flag_count++] = flag;
+    }
+}
+
+/**
+ * This function works out the severity of the output of gcc (or the linker) from its diagnostics: the output is an error
+ * if any line has the "error:" prefix (e.g. "page.c:3:1: error:", "fatal error:" or "collect2: error:"), a warning if any
+ * has "warning:", and otherwise information (e.g. notes).
+ *
+ * @author Iqra Haq
+ * @param[in] output - The output.
+ * @param[in] length - The length of the output.
+ * \return enum lhp_severity - The severity of the output.
+ */
+enum lhp_severity compiler_output_severity(const char *output, size_t length)
+{
+    enum lhp_severity severity = LHP_INFO;
+    const char *end = output + length;
+    while(output < end){
+        const char *line;
+        size_t line_length = next_line(&output, end, &line);
+        // The prefix follows the location (e.g. the file and line), or starts the line if there isn't one.
+        if(find_text(line, line_length, ": error:") != NULL || find_text(line, line_length, ": fatal error:") != NULL || (line_length >= 6 && strncmp(line, "error:", 6) == 0)){
+            return LHP_ERROR;
+        }
+        if(find_text(line, line_length, ": warning:") != NULL || (line_length >= 8 && strncmp(line, "warning:", 8) == 0)){
+            severity = LHP_WARNING;
+        }
+    }
+    return severity;
+}
+
+/**
+ * This function runs a program (see run_program) and adds anything it outputs to the LHP Log.
+ *
+ * @author Iqra Haq
+ * @param[in] arguments - The program and its argument parameters, ending with a NULL.
+ * @param[out] lhp_log - The log file to store the output and any errors in.
+ * \return int - The exit status of the program, or -1 if it couldn't be run.
+ */
+int run_logged_program(char *const arguments[], FILE *lhp_log)
+{
+    char *output = NULL;
+    size_t output_length = 0;
+    int result = run_program(arguments, &output, &output_length);
+
+    // Any errors or warnings are added to this file's records in the LHP Log.
+    if(output_length > 0){
+        log_message(lhp_log, compiler_output_severity(output, output_length), "%.*s%s", (int)output_length, output, (output[output_length - 1] == '\n') ? "" : "\n");
+    }
+    if(result == -1){
+        log_message(lhp_log, LHP_ERROR, "Error! %s could not be run.\n", arguments[0]);
+    }
+    free(output);
+    return result;
+}
+
+/**
+ * This function checks whether a flag is only needed when linking (libraries and linker options), so that it
+ * can be left out when a page is only being compiled.
+ *
+ * @author Iqra Haq
+ * @param[in] flag - The flag to check.
+ * \return int - 1 if the flag is only needed when linking, otherwise 0.
+ */
+int is_link_flag(const char *flag)
+{
+    return strncmp(flag, "-l", 2) == 0 || strncmp(flag, "-L", 2) == 0 || strncmp(flag, "-Wl,", 4) == 0;
+}
+
+/**
+ * This function is the final major function of the program with the main aim
+ * of compiling the C File (intermediary_file) with enough compatibility for interaction with
+ * SQL statements for database functionality and FastCGI for web server hosting.
+ * gcc is run directly with an argument list (no shell is involved) and anything it outputs
+ * is added to this file's records in the LHP Log.
+ * Pages that are part of a bundle are compiled to object files to be linked into the bundle, and pages loaded
+ * by a host are compiled to shared object modules (written under a temporary name and then renamed, so that
+ * the host never loads a module that is only partly written).
+ * 
+ * @author Iqra Haq
+ * @param[in] file_name - The name of the file to be used.
+ * @param[in] handler - The name of the page's handler if it is part of a bundle or a module (NULL for a page of its own).
+ * @param[in] extra_flag - A flag to add for this build only (e.g. for profile-guided optimisation), or NULL.
+ * @param[in] options - The options given by the user (including the build profile and the toolchain).
+ * @param[out] lhp_log - The log file to store any errors in. 
+ * \return int - Error status.
+ */
+int compilation(char *file_name, const char *handler, const char *extra_flag, struct lhp_options *options, FILE *lhp_log)
+{
+    struct lhp_toolchain *toolchain = &options->toolchain;
+    // Whether gcc can be used on this Operating System.
+    int supported = 0;
+    int status = 1;
+
+    // Conditional macro statements to check relevant Operating System is in use.
+    #ifdef _WIN32
+        // Output relevant log to lhp_log for Windows Operating System as being unusable for program.
+        log_message(lhp_log, LHP_ERROR, "%s\n", "Incorrect Operating System in use (OS: Windows).");
+        log_message(lhp_log, LHP_ERROR, "%s\n", "This program cannot be run on this OS.");
+        log_message(lhp_log, LHP_ERROR, "%s\n", "Please move to a Linux/Unix OS to use this.");
+        // Notification is outputted to user to check log file.
+    	printf("The program encountered an error. Please check LHP.log for further details!\n");
+
+    #elif __linux__
+        // Output relevant log to lhp_log for Linux Operating System in use.
+        fprintf(lhp_log, "%s\n", "Correct Operating System in use (OS: Linux).");
+        supported = 1;
+    #elif __unix__
+        // Output relevant log to lhp_log for Unix Operating System in use.
+        fprintf(lhp_log, "%s\n", "Correct Operating System in use (OS: Unix).");
+        supported = 1;
+    #else
+        // Output relevant log to lhp_log for Other Operating System as being unusable for program.
+        log_message(lhp_log, LHP_ERROR, "%s\n", "Incorrect Operating System in use (OS: Other).");
+        log_message(lhp_log, LHP_ERROR, "%s\n", "This program cannot be run on this OS.");
+        log_message(lhp_log, LHP_ERROR, "%s\n", "Please move to a Linux/Unix OS to use this.");
+        // Notification is outputted to user to check log file.
+    	printf("The program encountered an error. Please check LHP.log for further details!\n");
+    #endif
+
+    if(!supported){
+        return 1;
+    }
+
+    // Remove file extension so that the same name can be used for the outputted EXE file.
+    remove_file_extension(file_name);
+    // A page with a handler is either a module (linked as a shared object) or part of a bundle (only compiled to an object file).
+    int module = (handler != NULL && options->host_name != NULL);
+    int object = (handler != NULL && !module);
+
+    // Names of the output file (an EXE File, an object file for a bundled page or a module), the file a module is written to first and the C File.
+    size_t name_length = strlen(file_name) + 9;
+    char *output_file_name = malloc(name_length);
+    char *temporary_file_name = malloc(name_length);
+    char *c_file_name = malloc(name_length);
+    // Argument list: gcc, the flags, the output and input files, the libraries, the MySQL flags and a NULL.
+    size_t argument_count = 0;
+    char **arguments = malloc((20 + LHP_MAX_PROFILE_FLAGS + toolchain->mysql_flag_count) * sizeof(*arguments));
+    if(output_file_name == NULL || temporary_file_name == NULL || c_file_name == NULL || arguments == NULL){
+        log_message(lhp_log, LHP_ERROR, "Error compiling %s.c! Not enough memory to run gcc.\n", file_name);
+        free(output_file_name);
+        free(temporary_file_name);
+        free(c_file_name);
+        free(arguments);
+        return 1;
+    }
+    snprintf(output_file_name, name_length, module ? "%s.so" : (object ? "%s.o" : "%s.exe"), file_name);
+    snprintf(temporary_file_name, name_length, "%s.so.tmp", file_name);
+    snprintf(c_file_name, name_length, "%s.c", file_name);
+
+    // Construct the correct argument list by inserting file name with correctly appended file extensions and static command aspects.
+    arguments[argument_count++] = "gcc";
+    for(size_t i = 0; compiler_flags[i] != NULL; i++){
+        arguments[argument_count++] = (char *)compiler_flags[i];
+    }
+    // Add the flags of the build profile (leaving out any for the linker if the page isn't being linked).
+    const char *flags[LHP_MAX_PROFILE_FLAGS + 1];
+    profile_flags(options->profile, object, flags);
+    for(size_t i = 0; flags[i] != NULL; i++){
+        if(!object || !is_link_flag(flags[i])){
+            arguments[argument_count++] = (char *)flags[i];
+        }
+    }
+    if(extra_flag != NULL){
+        arguments[argument_count++] = (char *)extra_flag;
+    }
+    // Let gcc find the precompiled preamble (pages that don't use it don't include it, so it makes no difference to them).
+    if(options->preamble_directory != NULL){
+        arguments[argument_count++] = "-I";
+        arguments[argument_count++] = options->preamble_directory;
+    }
+    // A bundled page is only compiled (not linked), as it is linked into the bundle later.
+    if(object){
+        arguments[argument_count++] = "-c";
+    }
+    // A module is position-independent, with only its module descriptor visible to the host.
+    if(module){
+        for(size_t i = 0; module_flags[i] != NULL; i++){
+            arguments[argument_count++] = (char *)module_flags[i];
+        }
+    }
+    arguments[argument_count++] = "-o";
+    arguments[argument_count++] = module ? temporary_file_name : output_file_name;
+    arguments[argument_count++] = c_file_name;
+    // Include relevant compatibility. A module is linked without libfcgi, so that it uses the host's (which holds the current request).
+    if(!object){
+        for(size_t i = 0; compiler_libraries[i] != NULL; i++){
+            if(!module || strcmp(compiler_libraries[i], "-lfcgi") != 0){
+                arguments[argument_count++] = (char *)compiler_libraries[i];
+            }
+        }
+    }
+    for(size_t i = 0; i < toolchain->mysql_flag_count; i++){
+        if(!object || !is_link_flag(toolchain->mysql_flags[i])){
+            arguments[argument_count++] = toolchain->mysql_flags[i];
+        }
+    }
+    arguments[argument_count] = NULL;
+
+    // Run gcc and wrap with a check to make sure that it was successfully executed.
+    int result = run_logged_program(arguments, lhp_log);
+
+    // Every symbol of a bundled page apart from its handler and init function is made local, so that pages can't clash with each other in the bundle.
+    if(result == 0 && object){
+        char init_function[64];
+        snprintf(init_function, sizeof(init_function), "%s_init", handler);
+        char *const localise_arguments[] = { "objcopy", "-G", (char *)handler, "-G", init_function, output_file_name, NULL };
+        result = run_logged_program(localise_arguments, lhp_log);
+    }
+    // The finished module replaces the old one in a single step (as a new file), which is how the host knows to reload it.
+    if(module && (result != 0 || rename(temporary_file_name, output_file_name) != 0)){
+        if(result == 0){
+            log_message(lhp_log, LHP_ERROR, "Error replacing %s! %s\n", output_file_name, strerror(errno));
+            result = 1;
+        }
+        unlink(temporary_file_name);
+    }
+
+    if(result == 0){
+        // Output relevant log for successful execution to the LHP Log.
+        fprintf(lhp_log, "The file '%s' has been successfully compiled.\n", output_file_name);
+        status = 0;
+    }
+
+    // Free the allocated memory used for the argument list.
+    free(arguments);
+    free(output_file_name);
+    free(temporary_file_name);
+    free(c_file_name);
+    return status;
+}
+
+
+/**
+ * This function adds the name of an LHP File to the list of LHP Files to be compiled.
+ *
+ * @author Iqra Haq
+ * @param[in,out] list - The list of LHP Files.
+ * @param[in] file_name - The name of the LHP File (a copy of it is stored).
+ * @param[in] route_start - Where the route of the LHP File starts within its name.
+ * \return int - Error status.
+ */
+int add_lhp_file(struct lhp_file_list *list, const char *file_name, size_t route_start)
+{
+    // Grow the list (doubling its size) when it runs out of room.
+    if(list->count == list->capacity){
+        size_t capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+        char **names = realloc(list->names, capacity * sizeof(*names));
+        if(names == NULL){
+            return 1;
+        }
+        list->names = names;
+        size_t *route_starts = realloc(list->route_starts, capacity * sizeof(*route_starts));
+        if(route_starts == NULL){
+            return 1;
+        }
+        list->route_starts = route_starts;
+        list->capacity = capacity;
+    }
+
+    list->route_starts[list->count] = route_start;
+    list->names[list->count] = strdup(file_name);
+    if(list->names[list->count] == NULL){
+        return 1;
+    }
+    list->count++;
+    return 0;
+}
+
+/**
+ * This function empties a list of LHP Files, freeing everything in it.
+ *
+ * @author Iqra Haq
+ * @param[out] list - The list of LHP Files.
+ */
+void free_lhp_files(struct lhp_file_list *list)
+{
+    for(size_t i = 0; i < list->count; i++){
+        free(list->names[i]);
+    }
+    free(list->names);
+    free(list->route_starts);
+    list->names = NULL;
+    list->route_starts = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+/**
+ * This function searches a directory (and any directories within it) for LHP Files and adds them to the list of LHP Files to be compiled.
+ *
+ * @author Iqra Haq
+ * @param[in] directory_name - The name of the directory to search.
+ * @param[in] root_length - The length of the name of the directory given by the user (where the routes of the LHP Files start).
+ * @param[in,out] list - The list of LHP Files.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
+ */
+int find_lhp_files(const char *directory_name, size_t root_length, struct lhp_file_list *list, FILE *lhp_log)
+{
+    DIR *directory = opendir(directory_name);
+    struct dirent *entry;
+    int status = 0;
+
+    if(directory == NULL){
+        log_message(lhp_log, LHP_ERROR, "Error opening directory %s, please try again...\n", directory_name);
+        return 1;
+    }
+
+    // Loop through every entry of the directory (apart from itself, its parent and hidden entries).
+    while((entry = readdir(directory)) != NULL){
+        if(entry->d_name[0] == '.'){
+            continue;
+        }
+
+        // Build the full path to the entry.
+        size_t path_length = strlen(directory_name) + strlen(entry->d_name) + 2;
+        char *path = malloc(path_length);
+        struct stat entry_info;
+        if(path == NULL){
+            status = 1;
+            break;
+        }
+        snprintf(path, path_length, "%s/%s", directory_name, entry->d_name);
+
+        // Search inner directories too, and add any file ending with the LHP file extension.
+        size_t name_length = strlen(entry->d_name);
+        if(stat(path, &entry_info) == 0 && S_ISDIR(entry_info.st_mode)){
+            status |= find_lhp_files(path, root_length, list, lhp_log);
+        } else if(name_length > 4 && strcmp(entry->d_name + name_length - 4, ".lhp") == 0){
+            status |= add_lhp_file(list, path, root_length);
+        }
+        free(path);
+    }
+
+    closedir(directory);
+    return status;
+}
+
+// Starting value of the 64-bit FNV-1a hashes used by the build cache.
+#define HASH_START 0xcbf29ce484222325ULL
+
+/**
+ * This function adds data to a 64-bit FNV-1a hash. It is used to fingerprint everything that goes into an EXE File
+ * so that pages whose inputs haven't changed can be skipped.
+ *
+ * @author Iqra Haq
+ * @param[in] hash - The hash so far (HASH_START for a new hash).
+ * @param[in] data - The data to add to the hash.
+ * @param[in] length - The length of the data.
+ * \return unsigned long long - The updated hash.
+ */
+unsigned long long hash_data(unsigned long long hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < length; i++){
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * This function works out the ETag of an LHP File's responses, if they only depend on the build: either the page has a
+ * static tag, or it is fully static (its C code block holds nothing but the main function and its return statement).
+ * The ETag is a hash of every segment of the LHP File (after any minifying), so it changes whenever the page does.
+ *
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the LHP File.
+ * \return unsigned long long - The ETag (0 if the responses may change between requests).
+ */
+unsigned long long page_etag(struct lhp_source *source)
+{
+    unsigned long long hash = HASH_START;
+    int fully_static = 1;
+
+    for(size_t i = 0; i < source->segment_count; i++){
+        struct lhp_segment *segment = &source->segments[i];
+        hash = hash_data(hash, &segment->kind, sizeof(segment->kind));
+        hash = hash_data(hash, segment->start, segment->length);
+        // Look for anything in the C code block other than blank lines, comments, braces, main() and its return statement.
+        const char *cursor = segment->start;
+        const char *end = segment->start + segment->length;
+        while(segment->kind == LHP_C_BLOCK && fully_static && cursor < end){
+            const char *line;
+            size_t length = next_line(&cursor, end, &line);
+            while(length > 0 && isspace((unsigned char)*line)){
+                line++;
+                length--;
+            }
+            while(length > 0 && isspace((unsigned char)line[length - 1])){
+                length--;
+            }
+            int trivial = (length == 0 || (length == 1 && (*line == '{' || *line == '}')) || (length >= 2 && memcmp(line, "//", 2) == 0));
+            if(!trivial && find_text(line, length, "main(") == NULL && !(length >= 6 && memcmp(line, "return", 6) == 0)){
+                fully_static = 0;
+            }
+        }
+    }
+    if(source->static_counter == 0 && !fully_static){
+        return 0;
+    }
+    // 0 means there isn't an ETag, so a hash of 0 (however unlikely) is moved.
+    return (hash != 0) ? hash : 1;
+}
+
+/**
+ * This function adds a local header (i.e. one included with quotation marks) to the build cache record of an LHP File,
+ * along with any local headers that it includes itself. Headers that can't be read are recorded as missing,
+ * so that the record changes once they appear.
+ *
+ * @author Iqra Haq
+ * @param[in] directory - The directory that the header is included from.
+ * @param[in] name - The name of the header as it appears in the "#include" directive.
+ * @param[in] name_length - The length of the name.
+ * @param[in,out] visited - The headers that have already been recorded (so that each is only recorded once).
+ * @param[out] record - The build cache record being built.
+ */
+void record_local_header(const char *directory, const char *name, size_t name_length, struct lhp_file_list *visited, FILE *record)
+{
+    // Build the path to the header (relative to the file that includes it, as gcc does).
+    size_t path_length = strlen(directory) + name_length + 2;
+    char *path = malloc(path_length);
+    if(path == NULL){
+        return;
+    }
+    if(name[0] == '/'){
+        snprintf(path, path_length, "%.*s", (int)name_length, name);
+    } else {
+        snprintf(path, path_length, "%s/%.*s", directory, (int)name_length, name);
+    }
+
+    // Only record each header once (this also stops headers that include each other from looping forever).
+    for(size_t i = 0; i < visited->count; i++){
+        if(strcmp(visited->names[i], path) == 0){
+            free(path);
+            return;
+        }
+    }
+    add_lhp_file(visited, path, 0);
+
+    // Read the whole header into memory to hash it.
+    FILE *header = fopen(path, "rb");
+    char *contents = NULL;
+    size_t contents_length = 0;
+    if(header != NULL){
+        char buffer[8192];
+        size_t read;
+        FILE *copy = open_memstream(&contents, &contents_length);
+        while(copy != NULL && (read = fread(buffer, 1, sizeof(buffer), header)) > 0){
+            fwrite(buffer, 1, read, copy);
+        }
+        if(copy != NULL){
+            fclose(copy);
+        }
+        fclose(header);
+    }
+    if(contents == NULL){
+        fprintf(record, "header %s missing\n", path);
+        free(path);
+        return;
+    }
+    fprintf(record, "header %s %016llx\n", path, hash_data(HASH_START, contents, contents_length));
+
+    // Look for any local headers that this header includes, relative to its own directory.
+    char *header_directory = strdup(path);
+    char *slash = strrchr(header_directory, '/');
+    if(slash != NULL){
+        *slash = '\0';
+    }
+    const char *cursor = contents;
+    const char *end = contents + contents_length;
+    while(cursor < end){
+        const char *line;
+        size_t length = next_line(&cursor, end, &line);
+        const char *include = find_text(line, length, "#include \"");
+        if(include != NULL){
+            const char *included_name = include + strlen("#include \"");
+            const char *quote = memchr(included_name, '"', (line + length) - included_name);
+            if(quote != NULL){
+                record_local_header(header_directory, included_name, quote - included_name, visited, record);
+            }
+        }
+    }
+
+    free(header_directory);
+    free(contents);
+    free(path);
+}
+
+/**
+ * This function builds the build cache record of an LHP File. The record holds hashes of the LHP File,
+ * the C File generated from it, the command used to compile it and every local header it includes,
+ * so two records only match if the EXE File built from them would be the same.
+ *
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the LHP File.
+ * @param[in] generated - The contents of the C File generated from the LHP File.
+ * @param[in] generated_length - The length of the C File.
+ * @param[in] options - The options given by the user (including the build profile and the toolchain).
+ * @param[in] requests_file_name - The name of the requests file replayed for profile-guided optimisation (NULL if there isn't one).
+ * @param[out] record_length - The length of the record.
+ * \return char * - The record (to be freed by the caller), or NULL if there wasn't enough memory.
+ */
+char *build_cache_record(struct lhp_source *source, const char *generated, size_t generated_length, struct lhp_options *options, const char *requests_file_name, size_t *record_length)
+{
+    struct lhp_toolchain *toolchain = &options->toolchain;
+    char *record_data = NULL;
+    FILE *record = open_memstream(&record_data, record_length);
+    struct lhp_file_list visited = { NULL, NULL, 0, 0 };
+    if(record == NULL){
+        return NULL;
+    }
+
+    fprintf(record, "%s\n", "lhpCompiler build cache");
+    fprintf(record, "source %016llx\n", hash_data(HASH_START, source->data, source->size));
+    fprintf(record, "generated %016llx\n", hash_data(HASH_START, generated, generated_length));
+    // The flags include those found for MySQL, so the record changes if the MySQL installation does.
+    unsigned long long flags_hash = HASH_START;
+    for(size_t i = 0; compiler_flags[i] != NULL; i++){
+        flags_hash = hash_data(flags_hash, compiler_flags[i], strlen(compiler_flags[i]) + 1);
+    }
+    for(size_t i = 0; compiler_libraries[i] != NULL; i++){
+        flags_hash = hash_data(flags_hash, compiler_libraries[i], strlen(compiler_libraries[i]) + 1);
+    }
+    for(size_t i = 0; i < toolchain->mysql_flag_count; i++){
+        flags_hash = hash_data(flags_hash, toolchain->mysql_flags[i], strlen(toolchain->mysql_flags[i]) + 1);
+    }
+    const char *flags[LHP_MAX_PROFILE_FLAGS + 1];
+    profile_flags(options->profile, options->bundle_name != NULL, flags);
+    for(size_t i = 0; flags[i] != NULL; i++){
+        flags_hash = hash_data(flags_hash, flags[i], strlen(flags[i]) + 1);
+    }
+    fprintf(record, "flags %016llx\n", flags_hash);
+    // A page built with profile-guided optimisation depends on the requests it was profiled with too.
+    if(requests_file_name != NULL){
+        unsigned long long requests_hash = HASH_START;
+        FILE *requests_file = fopen(requests_file_name, "rb");
+        char buffer[4096];
+        size_t read_length;
+        while(requests_file != NULL && (read_length = fread(buffer, 1, sizeof(buffer), requests_file)) > 0){
+            requests_hash = hash_data(requests_hash, buffer, read_length);
+        }
+        if(requests_file != NULL){
+            fclose(requests_file);
+        }
+        fprintf(record, "requests %016llx\n", requests_hash);
+    }
+
+    // Local headers are found relative to the directory of the LHP File.
+    char *directory = strdup(source->file_name);
+    char *slash = strrchr(directory, '/');
+    if(slash != NULL){
+        *slash = '\0';
+    } else {
+        strcpy(directory, ".");
+    }
+    for(size_t i = 0; i < source->segment_count; i++){
+        struct lhp_segment *segment = &source->segments[i];
+        if(segment->kind != LHP_DIRECTIVE){
+            continue;
+        }
+        const char *cursor = segment->start;
+        const char *end = segment->start + segment->length;
+        while(cursor < end){
+            const char *line;
+            size_t length = next_line(&cursor, end, &line);
+            const char *quote = memchr(line, '"', length);
+            const char *closing_quote = (quote != NULL) ? memchr(quote + 1, '"', (line + length) - (quote + 1)) : NULL;
+            if(closing_quote != NULL){
+                record_local_header(directory, quote + 1, closing_quote - (quote + 1), &visited, record);
+            }
+        }
+    }
+
+    for(size_t i = 0; i < visited.count; i++){
+        free(visited.names[i]);
+    }
+    free(visited.names);
+    free(visited.route_starts);
+    free(directory);
+    fclose(record);
+    return record_data;
+}
+
+/**
+ * This function checks whether the build cache record saved for an LHP File matches the one just built for it
+ * and that its EXE File still exists, in which case the LHP File doesn't need compiling again.
+ *
+ * @author Iqra Haq
+ * @param[in] cache_file_name - The name of the saved build cache record.
+ * @param[in] exe_file_name - The name of the EXE File.
+ * @param[in] record - The build cache record just built.
+ * @param[in] record_length - The length of the record.
+ * \return int - 1 if the EXE File is up to date, otherwise 0.
+ */
+int cache_is_up_to_date(const char *cache_file_name, const char *exe_file_name, const char *record, size_t record_length)
+{
+    struct stat file_info;
+    int up_to_date = 0;
+
+    // There is nothing to reuse if the EXE File has gone.
+    if(stat(exe_file_name, &file_info) != 0){
+        return 0;
+    }
+
+    // Compare the saved record to the new one byte for byte.
+    FILE *cache_file = fopen(cache_file_name, "rb");
+    if(cache_file != NULL){
+        char *saved = malloc(record_length + 1);
+        if(saved != NULL && fread(saved, 1, record_length + 1, cache_file) == record_length && memcmp(saved, record, record_length) == 0){
+            up_to_date = 1;
+        }
+        free(saved);
+        fclose(cache_file);
+    }
+    return up_to_date;
+}
+
+/**
+ * This function saves the build cache record of an LHP File once its EXE File has been built.
+ * The record is written to a temporary file and renamed over the old one, so it is never left half written.
+ *
+ * @author Iqra Haq
+ * @param[in] cache_file_name - The name of the build cache record.
+ * @param[in] record - The build cache record.
+ * @param[in] record_length - The length of the record.
+ * @param[out] lhp_log - The log file to store any errors in.
+ */
+void save_cache_record(const char *cache_file_name, const char *record, size_t record_length, FILE *lhp_log)
+{
+    size_t temporary_length = strlen(cache_file_name) + 5;
+    char *temporary_name = malloc(temporary_length);
+    if(temporary_name == NULL){
+        return;
+    }
+    snprintf(temporary_name, temporary_length, "%s.tmp", cache_file_name);
+
+    FILE *cache_file = fopen(temporary_name, "wb");
+    int status = (cache_file == NULL);
+    if(cache_file != NULL){
+        status |= (fwrite(record, 1, record_length, cache_file) != record_length);
+        status |= (fclose(cache_file) != 0);
+    }
+    if(status == 0){
+        status = (rename(temporary_name, cache_file_name) != 0);
+    }
+    if(status != 0){
+        log_message(lhp_log, LHP_ERROR, "Error saving the build cache record %s.\n", cache_file_name);
+        remove(temporary_name);
+    }
+    free(temporary_name);
+}
+
+/**
+ * This function runs an EXE File once as a CGI program for every request recorded in a requests file, so that an instrumented
+ * build can collect profile data from realistic requests. Outside of a web server, the FastCGI library handles exactly one
+ * request (taken from the environment and the standard input) and then lets the page finish, which is when the profile data is saved.
+ * The requests file holds one request per block of "NAME=value" lines (the CGI variables), with blocks separated by an empty line.
+ * Lines starting with a "#" are ignored, and the value of LHP_BODY (if given) is sent as the body of the request.
+ *
+ * @author Iqra Haq
+ * @param[in] exe_file_name - The name of the EXE File to run.
+ * @param[in] requests_file_name - The name of the requests file.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return long - The number of requests replayed successfully, or -1 if the requests file couldn't be read.
+ */
+long replay_requests(const char *exe_file_name, const char *requests_file_name, FILE *lhp_log)
+{
+    FILE *requests_file = fopen(requests_file_name, "r");
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_length;
+    long replayed = 0;
+    int at_end = 0;
+    if(requests_file == NULL){
+        log_message(lhp_log, LHP_ERROR, "Error reading %s, please try again...\n", requests_file_name);
+        return -1;
+    }
+    // The EXE File is run by its path, so one in the current directory needs a "./" in front of it.
+    char *path = malloc(strlen(exe_file_name) + 3);
+    if(path == NULL){
+        fclose(requests_file);
+        return -1;
+    }
+    snprintf(path, strlen(exe_file_name) + 3, (strchr(exe_file_name, '/') != NULL) ? "%s" : "./%s", exe_file_name);
+
+    while(!at_end){
+        // Collect the CGI variables of the next request (a few are added if the recording left them out).
+        struct lhp_file_list environment = { NULL, NULL, 0, 0 };
+        char *body = NULL;
+        int has_method = 0;
+        int has_length = 0;
+        while(1){
+            line_length = getline(&line, &line_capacity, requests_file);
+            if(line_length < 0){
+                at_end = 1;
+                break;
+            }
+            while(line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r')){
+                line[--line_length] = '\0';
+            }
+            if(line_length == 0){
+                if(environment.count > 0 || body != NULL){
+                    break;
+                }
+                continue;
+            }
+            if(line[0] == '#' || strchr(line, '=') == NULL){
+                continue;
+            }
+            if(strncmp(line, "LHP_BODY=", 9) == 0){
+                free(body);
+                body = strdup(line + 9);
+                continue;
+            }
+            has_method |= (strncmp(line, "REQUEST_METHOD=", 15) == 0);
+            has_length |= (strncmp(line, "CONTENT_LENGTH=", 15) == 0);
+            add_lhp_file(&environment, line, 0);
+        }
+        if(environment.count == 0 && body == NULL){
+            free(environment.names);
+            free(environment.route_starts);
+            break;
+        }
+        add_lhp_file(&environment, "GATEWAY_INTERFACE=CGI/1.1", 0);
+        if(!has_method){
+            add_lhp_file(&environment, (body != NULL) ? "REQUEST_METHOD=POST" : "REQUEST_METHOD=GET", 0);
+        }
+        if(body != NULL && !has_length){
+            char content_length[64];
+            snprintf(content_length, sizeof(content_length), "CONTENT_LENGTH=%zu", strlen(body));
+            add_lhp_file(&environment, content_length, 0);
+        }
+        size_t inherited = 0;
+        while(environ[inherited] != NULL){
+            inherited++;
+        }
+        char **envp = malloc((inherited + environment.count + 1) * sizeof(*envp));
+
+        // The body is given to the page through a temporary file, so that a large one can't block on a pipe.
+        char body_file_name[] = "/tmp/lhpCompiler-body-XXXXXX";
+        int body_descriptor = -1;
+        if(body != NULL){
+            body_descriptor = mkstemp(body_file_name);
+            if(body_descriptor != -1){
+                unlink(body_file_name);
+                if(write(body_descriptor, body, strlen(body)) != (ssize_t)strlen(body)){
+                    log_message(lhp_log, LHP_ERROR, "Error writing the body of a recorded request for %s.\n", exe_file_name);
+                }
+                lseek(body_descriptor, 0, SEEK_SET);
+            }
+        }
+
+        if(envp != NULL){
+            // The page gets the compiler's environment (so that it still finds its libraries through LD_LIBRARY_PATH),
+            // with the variables of the request in place of any of the same name.
+            size_t count = 0;
+            for(size_t i = 0; i < inherited; i++){
+                size_t name_length = strcspn(environ[i], "=");
+                int replaced = 0;
+                for(size_t j = 0; j < environment.count && !replaced; j++){
+                    replaced = (strncmp(environment.names[j], environ[i], name_length) == 0 && environment.names[j][name_length] == '=');
+                }
+                if(!replaced){
+                    envp[count++] = environ[i];
+                }
+            }
+            for(size_t i = 0; i < environment.count; i++){
+                envp[count++] = environment.names[i];
+            }
+            envp[count] = NULL;
+
+            // Run the page with the request, throwing away its response.
+            posix_spawn_file_actions_t actions;
+            pid_t pid;
+            posix_spawn_file_actions_init(&actions);
+            if(body_descriptor != -1){
+                posix_spawn_file_actions_adddup2(&actions, body_descriptor, STDIN_FILENO);
+            } else {
+                posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+            }
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+            posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+            char *const arguments[] = { path, NULL };
+            if(posix_spawn(&pid, path, &actions, NULL, arguments, envp) == 0){
+                int wait_status;
+                pid_t waited;
+                while((waited = waitpid(pid, &wait_status, 0)) == -1 && errno == EINTR){}
+                // Only a page that finished normally has saved its profile data.
+                if(waited != pid){
+                    log_message(lhp_log, LHP_ERROR, "Error waiting for %s to replay a recorded request.\n", exe_file_name);
+                } else if(WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == 0){
+                    replayed++;
+                } else if(WIFEXITED(wait_status)){
+                    log_message(lhp_log, LHP_ERROR, "Error replaying a recorded request! %s exited with status %d.\n", exe_file_name, WEXITSTATUS(wait_status));
+                } else {
+                    log_message(lhp_log, LHP_ERROR, "Error replaying a recorded request! %s was killed by signal %d.\n", exe_file_name, WTERMSIG(wait_status));
+                }
+            } else {
+                log_message(lhp_log, LHP_ERROR, "Error running %s to replay a recorded request.\n", exe_file_name);
+            }
+            posix_spawn_file_actions_destroy(&actions);
+        }
+
+        if(body_descriptor != -1){
+            close(body_descriptor);
+        }
+        for(size_t i = 0; i < environment.count; i++){
+            free(environment.names[i]);
+        }
+        free(environment.names);
+        free(environment.route_starts);
+        free(envp);
+        free(body);
+    }
+
+    free(line);
+    free(path);
+    fclose(requests_file);
+    return replayed;
+}
+
+/**
+ * This function compiles a C File with profile-guided optimisation. An instrumented EXE File is built first and run with
+ * every request recorded for the page, then the C File is compiled again using the profile data that was collected,
+ * so that the code the requests actually run is the code that gets optimised.
+ *
+ * @author Iqra Haq
+ * @param[in] base_name - The name of the page without any file extension.
+ * @param[in] requests_file_name - The name of the file of recorded requests.
+ * @param[in] options - The options given by the user.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
+ */
+int profile_guided_compilation(const char *base_name, const char *requests_file_name, struct lhp_options *options, FILE *lhp_log)
+{
+    size_t name_length = strlen(base_name) + 32;
+    char *profile_directory = malloc(name_length);
+    char *exe_file_name = malloc(name_length);
+    char *c_file_name = malloc(name_length);
+    char *flag = malloc(name_length + 32);
+    int status = 1;
+    if(profile_directory == NULL || exe_file_name == NULL || c_file_name == NULL || flag == NULL){
+        log_message(lhp_log, LHP_ERROR, "Error compiling %s.c! Not enough memory.\n", base_name);
+        free(profile_directory);
+        free(exe_file_name);
+        free(c_file_name);
+        free(flag);
+        return 1;
+    }
+    snprintf(profile_directory, name_length, "%s.lhpprofile", base_name);
+    snprintf(exe_file_name, name_length, "%s.exe", base_name);
+
+    // Start with an empty profile directory, as profile data from an older version of the page can't be used with this one.
+    mkdir(profile_directory, 0777);
+    DIR *directory = opendir(profile_directory);
+    if(directory != NULL){
+        struct dirent *entry;
+        while((entry = readdir(directory)) != NULL){
+            size_t entry_length = strlen(entry->d_name);
+            if(entry_length > 5 && strcmp(entry->d_name + entry_length - 5, ".gcda") == 0){
+                char *path = malloc(strlen(profile_directory) + entry_length + 2);
+                if(path != NULL){
+                    sprintf(path, "%s/%s", profile_directory, entry->d_name);
+                    unlink(path);
+                    free(path);
+                }
+            }
+        }
+        closedir(directory);
+    }
+
+    // Build the instrumented EXE File and replay the recorded requests with it.
+    snprintf(c_file_name, name_length, "%s.c", base_name);
+    snprintf(flag, name_length + 32, "-fprofile-generate=%s", profile_directory);
+    if(compilation(c_file_name, NULL, flag, options, lhp_log) == 0){
+        long replayed = replay_requests(exe_file_name, requests_file_name, lhp_log);
+        fprintf(lhp_log, "Replayed %ld recorded requests for %s to collect profile data.\n", replayed, exe_file_name);
+
+        // Build the final EXE File with the profile data. Without any, gcc would only warn and build an unprofiled EXE File,
+        // which the build cache would then take to be up to date.
+        int profiled = 0;
+        directory = (replayed > 0) ? opendir(profile_directory) : NULL;
+        if(directory != NULL){
+            struct dirent *entry;
+            while(!profiled && (entry = readdir(directory)) != NULL){
+                size_t entry_length = strlen(entry->d_name);
+                profiled = (entry_length > 5 && strcmp(entry->d_name + entry_length - 5, ".gcda") == 0);
+            }
+            closedir(directory);
+        }
+        if(profiled){
+            snprintf(c_file_name, name_length, "%s.c", base_name);
+            snprintf(flag, name_length + 32, "-fprofile-use=%s", profile_directory);
+            status = compilation(c_file_name, NULL, flag, options, lhp_log);
+        } else if(replayed > 0){
+            log_message(lhp_log, LHP_ERROR, "Error with %s! Replaying its recorded requests collected no profile data in %s.\n", requests_file_name, profile_directory);
+        } else {
+            log_message(lhp_log, LHP_ERROR, "Error with %s! No recorded requests could be replayed to collect profile data.\n", requests_file_name);
+        }
+    }
+
+    free(profile_directory);
+    free(exe_file_name);
+    free(c_file_name);
+    free(flag);
+    return status;
+}
+
+// The names of the phases, as used in the metrics file.
+const char *const phase_names[LHP_PHASE_COUNT] = { "load", "check", "minify", "directives", "html", "c", "init", "cache", "write", "compile" };
+
+/**
+ * This function returns the time from a monotonic clock, for timing the phases of the compiler.
+ *
+ * @author Iqra Haq
+ * \return unsigned long long - The time in nanoseconds.
+ */
+unsigned long long now_nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+// The names of the severities, as written to the LHP Log.
+const char *const severity_names[] = { "info", "warning", "error" };
+
+/**
+ * This function sets the phase that the records written to the LHP Log from now on belong to.
+ *
+ * @author Iqra Haq
+ * @param[in] phase - The name of the phase.
+ */
+void set_log_phase(const char *phase)
+{
+    log_context.phase = phase;
+    log_context.phase_start = now_nanoseconds();
+}
+
+/**
+ * This function records the end of a phase, so that the next phase can start from where it finished.
+ *
+ * @author Iqra Haq
+ * @param[out] metrics - The metrics of the LHP File.
+ * @param[in] phase - The phase that has finished.
+ * @param[in] start - When the phase started.
+ * @param[in] bytes - The number of bytes the phase dealt with.
+ * @param[in] lines - The number of lines the phase dealt with.
+ * \return unsigned long long - When the phase finished.
+ */
+unsigned long long end_phase(struct lhp_file_metrics *metrics, enum lhp_phase phase, unsigned long long start, unsigned long long bytes, unsigned long long lines)
+{
+    unsigned long long now = now_nanoseconds();
+    metrics->phases[phase].nanoseconds += now - start;
+    metrics->phases[phase].bytes += bytes;
+    metrics->phases[phase].lines += lines;
+    // Anything written to the LHP Log from now on belongs to the next phase.
+    if(phase + 1 < LHP_PHASE_COUNT){
+        set_log_phase(phase_names[phase + 1]);
+    }
+    return now;
+}
+
+/**
+ * This function counts the lines of the LHP File in segments of a kind.
+ *
+ * @author Iqra Haq
+ * @param[in] source - The LHP File's segment table.
+ * @param[in] kind - The kind of segment to count (LHP_HEADER_HTML counts every kind of HTML).
+ * \return size_t - The number of lines.
+ */
+size_t count_segment_lines(struct lhp_source *source, enum lhp_segment_kind kind)
+{
+    size_t lines = 0;
+    for(size_t i = 0; i < source->segment_count; i++){
+        enum lhp_segment_kind segment_kind = source->segments[i].kind;
+        if(segment_kind == kind || (kind == LHP_HEADER_HTML && (segment_kind == LHP_INNER_HTML || segment_kind == LHP_FOOTER_HTML))){
+            lines += source->segments[i].line_count;
+        }
+    }
+    return lines;
+}
+
+/**
+ * This function prints a JSON string, escaping any characters that need it.
+ *
+ * @author Iqra Haq
+ * @param[in] text - The string to print.
+ * @param[out] metrics_file - The file to print it to.
+ */
+void print_json_string(const char *text, FILE *metrics_file)
+{
+    fputc('"', metrics_file);
+    for(const unsigned char *character = (const unsigned char *)text; *character != '\0'; character++){
+        if(*character == '"' || *character == '\\'){
+            fprintf(metrics_file, "\\%c", *character);
+        } else if(*character < 0x20){
+            fprintf(metrics_file, "\\u%04x", *character);
+        } else {
+            fputc(*character, metrics_file);
+        }
+    }
+    fputc('"', metrics_file);
+}
+
+/**
+ * This function prints the name of an LHP File as a CSV field, quoting it (and doubling any quotes) if it needs it.
+ *
+ * @author Iqra Haq
+ * @param[in] name - The name to print.
+ * @param[out] metrics_file - The file to print it to.
+ */
+void print_csv_name(const char *name, FILE *metrics_file)
+{
+    if(strpbrk(name, ",\"\n") == NULL){
+        fputs(name, metrics_file);
+        return;
+    }
+    fputc('"', metrics_file);
+    for(const char *character = name; *character != '\0'; character++){
+        if(*character == '"'){
+            fputc('"', metrics_file);
+        }
+        fputc(*character, metrics_file);
+    }
+    fputc('"', metrics_file);
+}
+
+/**
+ * This function prints the metrics of one LHP File (or of the whole run) to the metrics file.
+ *
+ * @author Iqra Haq
+ * @param[in] name - The name of the LHP File (NULL for the whole run).
+ * @param[in] status - Its status ("ok", "failed" or "up to date"), or NULL for the whole run.
+ * @param[in] metrics - Its metrics.
+ * @param[in] csv - Whether to print CSV rows rather than a JSON object.
+ * @param[out] metrics_file - The file to print them to.
+ */
+void print_file_metrics(const char *name, const char *status, struct lhp_file_metrics *metrics, int csv, FILE *metrics_file)
+{
+    if(csv){
+        // A row for every phase, then one for the LHP File as a whole (with the memory use).
+        for(int phase = 0; phase <= LHP_PHASE_COUNT; phase++){
+            struct lhp_phase_metrics *phase_metrics = (phase < LHP_PHASE_COUNT) ? &metrics->phases[phase] : NULL;
+            print_csv_name((name != NULL) ? name : "*", metrics_file);
+            fprintf(metrics_file, ",%s,%s,", (status != NULL) ? status : "", (phase < LHP_PHASE_COUNT) ? phase_names[phase] : "total");
+            if(phase_metrics != NULL){
+                fprintf(metrics_file, "%.3f,%llu,%llu,,\n", phase_metrics->nanoseconds / 1e6, phase_metrics->bytes, phase_metrics->lines);
+            } else {
+                fprintf(metrics_file, "%.3f,,,%ld,%ld\n", metrics->total_nanoseconds / 1e6, metrics->peak_memory, metrics->peak_child_memory);
+            }
+        }
+        return;
+    }
+    fprintf(metrics_file, "{");
+    if(name != NULL){
+        fprintf(metrics_file, "\"file\":");
+        print_json_string(name, metrics_file);
+        fprintf(metrics_file, ",\"status\":\"%s\",", status);
+    }
+    fprintf(metrics_file, "\"milliseconds\":%.3f,\"peak_memory_kb\":%ld,\"peak_child_memory_kb\":%ld,\"phases\":{",
+            metrics->total_nanoseconds / 1e6, metrics->peak_memory, metrics->peak_child_memory);
+    for(int phase = 0; phase < LHP_PHASE_COUNT; phase++){
+        fprintf(metrics_file, "%s\"%s\":{\"milliseconds\":%.3f,\"bytes\":%llu,\"lines\":%llu}", (phase > 0) ? "," : "", phase_names[phase],
+                metrics->phases[phase].nanoseconds / 1e6, metrics->phases[phase].bytes, metrics->phases[phase].lines);
+    }
+    fprintf(metrics_file, "}}");
+}
+
+/**
+ * This function writes the metrics recorded for every LHP File, and for the whole run, to the metrics file.
+ * A metrics file ending in ".csv" gets a row for every phase of every LHP File (with "*" in place of the name
+ * for the whole run), otherwise a single JSON document is written.
+ *
+ * @author Iqra Haq
+ * @param[in] metrics_file_name - The name of the metrics file.
+ * @param[in] names - The names of the LHP Files.
+ * @param[in] metrics - The metrics recorded for each LHP File.
+ * @param[in] count - The number of LHP Files.
+ * @param[in] wall_nanoseconds - How long the whole run took.
+ * @param[in] bundle_nanoseconds - How long linking the bundle took (0 if there isn't a bundle).
+ * @param[out] lhp_log - The log file to store any errors in.
+ */
+void write_metrics(const char *metrics_file_name, char *const names[], struct lhp_file_metrics *metrics, size_t count, unsigned long long wall_nanoseconds, unsigned long long bundle_nanoseconds, FILE *lhp_log)
+{
+    const char *extension = strrchr(metrics_file_name, '.');
+    int csv = (extension != NULL && strcmp(extension, ".csv") == 0);
+    FILE *metrics_file = fopen(metrics_file_name, "w");
+    if(metrics_file == NULL){
+        log_message(lhp_log, LHP_ERROR, "Error writing the metrics to %s.\n", metrics_file_name);
+        return;
+    }
+
+    // Add up the phases of every LHP File for the whole run, keeping the highest memory use.
+    struct lhp_file_metrics total = { 0 };
+    struct rusage usage;
+    size_t recorded = 0;
+    for(size_t i = 0; i < count; i++){
+        if(!metrics[i].recorded){
+            continue;
+        }
+        recorded++;
+        for(int phase = 0; phase < LHP_PHASE_COUNT; phase++){
+            total.phases[phase].nanoseconds += metrics[i].phases[phase].nanoseconds;
+            total.phases[phase].bytes += metrics[i].phases[phase].bytes;
+            total.phases[phase].lines += metrics[i].phases[phase].lines;
+        }
+        total.peak_memory = (metrics[i].peak_memory > total.peak_memory) ? metrics[i].peak_memory : total.peak_memory;
+        total.peak_child_memory = (metrics[i].peak_child_memory > total.peak_child_memory) ? metrics[i].peak_child_memory : total.peak_child_memory;
+    }
+    if(getrusage(RUSAGE_SELF, &usage) == 0 && usage.ru_maxrss > total.peak_memory){
+        total.peak_memory = usage.ru_maxrss;
+    }
+    // The whole run is timed from start to finish, as LHP Files compiled at once overlap.
+    total.total_nanoseconds = wall_nanoseconds;
+
+    if(csv){
+        fprintf(metrics_file, "file,status,phase,milliseconds,bytes,lines,peak_memory_kb,peak_child_memory_kb\n");
+    } else {
+        fprintf(metrics_file, "{\"files\":[");
+    }
+    const char *separator = "";
+    for(size_t i = 0; i < count; i++){
+        if(!metrics[i].recorded){
+            continue;
+        }
+        const char *status = (metrics[i].status == 0) ? "ok" : (metrics[i].status == LHP_UP_TO_DATE) ? "up to date" : "failed";
+        fputs(separator, metrics_file);
+        print_file_metrics(names[i], status, &metrics[i], csv, metrics_file);
+        separator = csv ? "" : ",\n";
+    }
+    if(csv){
+        print_file_metrics(NULL, NULL, &total, csv, metrics_file);
+        if(bundle_nanoseconds > 0){
+            fprintf(metrics_file, "*,,bundle,%.3f,,,,\n", bundle_nanoseconds / 1e6);
+        }
+    } else {
+        fprintf(metrics_file, "],\n\"total\":");
+        print_file_metrics(NULL, NULL, &total, csv, metrics_file);
+        fprintf(metrics_file, ",\n\"file_count\":%zu,\"bundle_milliseconds\":%.3f}\n", recorded, bundle_nanoseconds / 1e6);
+    }
+    fclose(metrics_file);
+}
+
+/**
+ * This function formats a record of the LHP Log and commits it with a single write(). As the LHP Log is opened for appending,
+ * every record lands whole at the end of the file, however many worker processes (or runs of the program) are writing at once.
+ *
+ * @author Iqra Haq
+ * @param[in] message - The message of the record (null terminated, without its final new line).
+ * @param[in] length - The length of the message.
+ * @param[in] severity - The severity of the message.
+ */
+void commit_log_record(const char *message, size_t length, enum lhp_severity severity)
+{
+    char *record = NULL;
+    size_t record_length = 0;
+    FILE *record_file = open_memstream(&record, &record_length);
+    if(record_file == NULL || log_context.descriptor == -1){
+        if(record_file != NULL){
+            fclose(record_file);
+            free(record);
+        }
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    unsigned long long duration = now_nanoseconds() - log_context.phase_start;
+    const char *file = (log_context.file != NULL) ? log_context.file : "";
+
+    if(log_context.format == LHP_LOG_BINARY){
+        struct lhp_log_record header = { 0 };
+        header.magic = LHP_LOG_MAGIC;
+        header.time = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+        header.duration = duration;
+        header.job = (uint32_t)log_context.job;
+        header.pid = (uint32_t)getpid();
+        header.severity = (uint16_t)severity;
+        header.file_length = (uint16_t)strnlen(file, UINT16_MAX);
+        header.phase_length = (uint16_t)strlen(log_context.phase);
+        header.message_length = (uint32_t)length;
+        header.length = (uint32_t)(sizeof(header) + header.file_length + header.phase_length + length);
+        fwrite(&header, sizeof(header), 1, record_file);
+        fwrite(file, 1, header.file_length, record_file);
+        fwrite(log_context.phase, 1, header.phase_length, record_file);
+        fwrite(message, 1, length, record_file);
+    } else if(log_context.format == LHP_LOG_JSON){
+        fprintf(record_file, "{\"time\":%lld.%06ld,\"job\":%lu,\"pid\":%ld,\"file\":", (long long)now.tv_sec, now.tv_nsec / 1000, log_context.job, (long)getpid());
+        print_json_string(file, record_file);
+        fprintf(record_file, ",\"severity\":\"%s\",\"phase\":\"%s\",\"duration_ms\":%.3f,\"message\":", severity_names[severity], log_context.phase, duration / 1e6);
+        print_json_string(message, record_file);
+        fprintf(record_file, "}\n");
+    } else {
+        char time_text[32];
+        struct tm time_info;
+        localtime_r(&now.tv_sec, &time_info);
+        strftime(time_text, sizeof(time_text), "%Y-%m-%d %H:%M:%S", &time_info);
+        fprintf(record_file, "%s.%03ld [job %lu, pid %ld] %s %s %s%s(+%.3f ms): ", time_text, now.tv_nsec / 1000000, log_context.job, (long)getpid(),
+                severity_names[severity], log_context.phase, file, (file[0] != '\0') ? " " : "", duration / 1e6);
+        // Further lines of the message (e.g. the output of gcc) are indented so that each record still starts a line of its own.
+        for(size_t i = 0; i < length; i++){
+            fputc(message[i], record_file);
+            if(message[i] == '\n'){
+                fputc('\t', record_file);
+            }
+        }
+        fputc('\n', record_file);
+    }
+    fclose(record_file);
+
+    // Commit the record in one go.
+    size_t written = 0;
+    while(written < record_length){
+        ssize_t result = write(log_context.descriptor, record + written, record_length - written);
+        if(result < 0 && errno == EINTR){
+            continue;
+        }
+        if(result <= 0){
+            break;
+        }
+        written += (size_t)result;
+    }
+    free(record);
+}
+
+/**
+ * This function takes the text written to the LHP Log (through the lhp_log stream, which is unbuffered so that each fprintf()
+ * arrives in one go) and commits every finished message as a record of its own.
+ *
+ * @author Iqra Haq
+ * @param[in] cookie - Unused.
+ * @param[in] data - The text written.
+ * @param[in] size - The length of the text.
+ * \return ssize_t - The length of the text (all of it is always taken).
+ */
+ssize_t log_stream_write(void *cookie, const char *data, size_t size)
+{
+    (void)cookie;
+    if(log_context.pending_length + size + 1 > log_context.pending_capacity){
+        size_t capacity = (log_context.pending_capacity > 0) ? log_context.pending_capacity : 1024;
+        while(capacity < log_context.pending_length + size + 1){
+            capacity *= 2;
+        }
+        char *pending = realloc(log_context.pending, capacity);
+        if(pending == NULL){
+            return (ssize_t)size;
+        }
+        log_context.pending = pending;
+        log_context.pending_capacity = capacity;
+    }
+    memcpy(log_context.pending + log_context.pending_length, data, size);
+    log_context.pending_length += size;
+
+    // A message is finished once it ends with a new line (which is left out of the record); blank lines are dropped.
+    if(log_context.pending_length > 0 && log_context.pending[log_context.pending_length - 1] == '\n'){
+        size_t length = log_context.pending_length;
+        while(length > 0 && (log_context.pending[length - 1] == '\n' || log_context.pending[length - 1] == '\r')){
+            length--;
+        }
+        size_t start = 0;
+        while(start < length && log_context.pending[start] == '\n'){
+            start++;
+        }
+        log_context.pending[length] = '\0';
+        if(length > start){
+            commit_log_record(log_context.pending + start, length - start, log_context.severity);
+        }
+        log_context.pending_length = 0;
+    }
+    return (ssize_t)size;
+}
+
+/**
+ * This function commits anything left unfinished in the LHP Log when it is closed.
+ *
+ * @author Iqra Haq
+ * @param[in] cookie - Unused.
+ * \return int - Error status.
+ */
+int log_stream_close(void *cookie)
+{
+    if(log_context.pending_length > 0){
+        log_stream_write(cookie, "\n", 1);
+    }
+    free(log_context.pending);
+    log_context.pending = NULL;
+    log_context.pending_capacity = 0;
+    if(log_context.descriptor != -1){
+        close(log_context.descriptor);
+        log_context.descriptor = -1;
+    }
+    return 0;
+}
+
+/**
+ * This function opens the LHP Log for appending, as a stream that the rest of the program writes its messages to
+ * with fprintf() as usual. Each message becomes a record with the job, file, severity, phase and how far into the phase it is.
+ *
+ * @author Iqra Haq
+ * @param[in] file_name - The name of the LHP Log.
+ * \return FILE * - The stream, or NULL if the LHP Log couldn't be opened.
+ */
+FILE *open_log(const char *file_name)
+{
+    cookie_io_functions_t functions = { NULL, log_stream_write, NULL, log_stream_close };
+    log_context.descriptor = open(file_name, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(log_context.descriptor == -1){
+        return NULL;
+    }
+    log_context.phase_start = now_nanoseconds();
+    FILE *stream = fopencookie(NULL, "w", functions);
+    if(stream == NULL){
+        close(log_context.descriptor);
+        log_context.descriptor = -1;
+        return NULL;
+    }
+    setvbuf(stream, NULL, _IONBF, 0);
+    return stream;
+}
+
+/**
+ * This function works out whether an LHP File can use the precompiled preamble. The headers in the preamble are included
+ * before any of the page's own directives, so a page with another directive before one of its includes (e.g. a line such as
+ * "#define _GNU_SOURCE // before #include <string.h>", which changes what the headers declare) must include its headers
+ * itself to keep its meaning.
+ *
+ * @author Iqra Haq
+ * @param[in] source - The segment table of the LHP File.
+ * \return int - 1 if every directive before the page's last "#include" is an "#include" itself, otherwise 0.
+ */
+int shares_preamble(struct lhp_source *source)
+{
+    int other_directive = 0;
+    for(size_t i = 0; i < source->segment_count; i++){
+        if(source->segments[i].kind != LHP_DIRECTIVE){
+            continue;
+        }
+        const char *cursor = source->segments[i].start;
+        const char *end = cursor + source->segments[i].length;
+        while(cursor < end){
+            const char *line;
+            size_t length = next_line(&cursor, end, &line);
+            while(length > 0 && isspace((unsigned char)line[length - 1])){
+                length--;
+            }
+            if(length >= 8 && strncmp(line, "#include", 8) == 0){
+                if(other_directive){
+                    return 0;
+                }
+            } else if(length > 0){
+                other_directive = 1;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * This function runs the whole pipeline of the program for a single LHP File: the front end, validation,
+ * the 3 major analysis functions and the compilation of the C File (intermediary_file) into an EXE File.
+ * The C File is generated in memory first so that, if the build cache record shows nothing has changed,
+ * the existing EXE File can be reused without writing anything at all.
+ * In batch mode this is run by each worker process, one LHP File at a time.
+ *
+ * @author Iqra Haq
+ * @param[in] argument - The name of the LHP File as given by the user (the ".lhp" extension is optional).
+ * @param[in] index - The position of the LHP File in the list of LHP Files (which names its handler if it is bundled).
+ * @param[in] options - The options given by the user.
+ * @param[out] metrics - Where to record the time taken by each phase (NULL if the metrics aren't needed).
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status (0 if compiled, 1 if an error occured, LHP_UP_TO_DATE if the existing EXE File was reused).
+ */
+int compile_lhp_file(const char *argument, size_t index, struct lhp_options *options, struct lhp_file_metrics *metrics, FILE *lhp_log)
+{
+    // The phases are timed whether or not the metrics are needed, as doing so costs next to nothing.
+    struct lhp_file_metrics unused_metrics;
+    if(metrics == NULL){
+        metrics = &unused_metrics;
+    }
+    memset(metrics, 0, sizeof(*metrics));
+    // Everything written to the LHP Log from now on is part of this LHP File's job.
+    log_context.job = index + 1;
+    log_context.file = argument;
+    set_log_phase(phase_names[LHP_PHASE_LOAD]);
+    unsigned long long start = now_nanoseconds();
+    unsigned long long phase_start = start;
+
+    // Name of the page's handler if it is part of a bundle, called by responder threads or loaded by a host as a module.
+    char handler[32];
+    if(options->bundle_name != NULL){
+        snprintf(handler, sizeof(handler), "lhp_page_%zu", index);
+    } else {
+        snprintf(handler, sizeof(handler), "%s", "lhp_page");
+    }
+    int has_handler = (options->bundle_name != NULL || options->threads > 0 || options->host_name != NULL);
+
+    // Relevant FILE variables created. (Note: EXE File is created when compilation function runs gcc)
+    // The LHP File itself is memory-mapped by the front end rather than opened as a FILE.
+    struct lhp_source source;
+    FILE *intermediary_file = NULL;
+    // Contents of the C File, generated in memory.
+    char *generated = NULL;
+    size_t generated_length = 0;
+
+    // Calculate and store the length of the file name.
+    size_t file_name_length = ((strlen(argument))+1);
+    // Dynamic memory allocation used as the file name will always vary.
+    char *lhp_file_name = (char *)malloc(file_name_length);
+    char *base_name = (char *)malloc(file_name_length);
+    // Store the file name into variables for both the LHP file (lhp_file) and the outputs (keep file name consistent throughout to avoid confusion.)
+    strcpy(lhp_file_name, argument);
+    strcpy(base_name, lhp_file_name);
+
+
+    // Check to see if extension is not included within the file name.
+    if(strstr(lhp_file_name, ".lhp") == NULL){
+        // Allocate memory for the extension and null terminator also.
+        lhp_file_name = realloc(lhp_file_name, file_name_length+5);
+        // Append the file extension to the file name if not included.
+        strcat(lhp_file_name, ".lhp");
+    }
+
+    // Use source_loader function to map the input file and build its segment table in a single pass.
+    if(source_loader(lhp_file_name, &source, lhp_log) != 0){
+        source_unloader(&source);
+        free(lhp_file_name);
+        free(base_name);
+        metrics->total_nanoseconds = now_nanoseconds() - start;
+        metrics->status = 1;
+        metrics->recorded = 1;
+        return 1;
+    }
+    phase_start = end_phase(metrics, LHP_PHASE_LOAD, phase_start, source.size, source.line_count);
+
+
+    // Remove the LHP file extension if the base name includes it so that the correct file extensions can be applied.
+    if(strstr(base_name, ".lhp") != NULL){
+        remove_file_extension(base_name);
+    }
+    // Names of the C File, EXE File (or object file or module) and build cache record (allowing for the longest extension and null terminator).
+    size_t output_name_length = strlen(base_name) + 10;
+    char *intermediary_file_name = malloc(output_name_length);
+    char *output_file_name = malloc(output_name_length);
+    char *cache_file_name = malloc(output_name_length);
+    snprintf(intermediary_file_name, output_name_length, "%s.c", base_name);
+    snprintf(output_file_name, output_name_length, (options->host_name != NULL) ? "%s.so" : ((options->bundle_name != NULL) ? "%s.o" : "%s.exe"), base_name);
+    snprintf(cache_file_name, output_name_length, "%s.lhpcache", base_name);
+    // Profile-guided optimisation replays the requests recorded for the page, if there are any.
+    char *requests_file_name = malloc(output_name_length);
+    snprintf(requests_file_name, output_name_length, "%s.requests", base_name);
+    if(options->profile != LHP_PGO || access(requests_file_name, R_OK) != 0){
+        if(options->profile == LHP_PGO){
+            log_message(lhp_log, LHP_WARNING, "No recorded requests found for %s (%s), so it is built without profile-guided optimisation.\n", lhp_file_name, requests_file_name);
+        }
+        free(requests_file_name);
+        requests_file_name = NULL;
+    }
+
+
+
+    // Call file_checker function to make sure that the content structure of the input file is suitable for the program.
+    int status = file_checker(&source, lhp_log);
+    phase_start = end_phase(metrics, LHP_PHASE_CHECK, phase_start, source.size, source.segment_count);
+
+    // Minify the HTML before anything is generated from it, recording the bytes saved.
+    size_t html_saved = 0;
+    if(status == 0 && options->minify){
+        html_saved = minify_html(&source, lhp_log);
+    }
+    phase_start = end_phase(metrics, LHP_PHASE_MINIFY, phase_start, html_saved, options->minify ? count_segment_lines(&source, LHP_HEADER_HTML) : 0);
+    // Pages whose responses only depend on the build are given an ETag.
+    if(status == 0){
+        source.etag = page_etag(&source);
+    }
+
+    // Only carry on to the analysis and compilation if no errors were encountered.
+    if(status == 0){
+        // The C File (intermediary_file) is generated in memory rather than written straight to disk.
+        intermediary_file = open_memstream(&generated, &generated_length);
+        if(intermediary_file == NULL){
+            log_message(lhp_log, LHP_ERROR, "Error with %s file! Not enough memory to process this file.\n", lhp_file_name);
+            status = 1;
+        }
+    }
+    if(status == 0){
+        // The bytes of each phase are the number of bytes of the C File it generated (which fflush brings up to date).
+        size_t generated_before = 0;
+        // Call analyse_preprocessor_directives function to copy the relevant Pre-Processor Directives from the segment table to the C File (intermediary_file).
+        analyse_preprocessor_directives(&source, options->threads, options->runtime_metrics ? argument : NULL, options->preamble_directory != NULL && shares_preamble(&source), options->supervise && options->bundle_name == NULL && options->host_name == NULL, intermediary_file);
+        fflush(intermediary_file);
+        phase_start = end_phase(metrics, LHP_PHASE_DIRECTIVES, phase_start, generated_length - generated_before, count_segment_lines(&source, LHP_DIRECTIVE));
+        generated_before = generated_length;
+        // Call analyse_html functon to copy the HTML segments (as they are and compressed) to the C File (intermediary_file).
+        if(analyse_html(&source, options->stream, intermediary_file) != 0){
+            log_message(lhp_log, LHP_ERROR, "Error with %s file! The HTML could not be compressed.\n", lhp_file_name);
+            status = 1;
+        }
+        fflush(intermediary_file);
+        phase_start = end_phase(metrics, LHP_PHASE_HTML, phase_start, generated_length - generated_before, count_segment_lines(&source, LHP_HEADER_HTML));
+        generated_before = generated_length;
+        // Call analyse_c to copy the C code block to the C File (intermediary_file).
+        if(analyse_c(&source, has_handler ? handler : NULL, intermediary_file) != 0){
+            log_message(lhp_log, LHP_ERROR, "Error with %s file! The main function of a bundled, threaded or module page can't take any argument parameters.\n", lhp_file_name);
+            status = 1;
+        }
+        fflush(intermediary_file);
+        phase_start = end_phase(metrics, LHP_PHASE_C, phase_start, generated_length - generated_before, count_segment_lines(&source, LHP_C_BLOCK));
+        generated_before = generated_length;
+        // Call analyse_init to copy the init block to the C File (intermediary_file) as a function of its own.
+        analyse_init(&source, has_handler ? handler : NULL, intermediary_file);
+        // A threaded page's main function starts the responder threads, which call the handler for each request.
+        if(options->threads > 0){
+            print_lines(threaded_main_code, intermediary_file);
+        }
+        // A module ends with the descriptor its host looks up to find the handler and init function.
+        if(options->host_name != NULL){
+            print_lines(module_abi_code, intermediary_file);
+            fprintf(intermediary_file, "%s\n", "__attribute__((visibility(\"default\"))) const struct lhp_module lhp_module = { LHP_MODULE_ABI, lhp_page, lhp_page_init };");
+        }
+        fclose(intermediary_file);
+        phase_start = end_phase(metrics, LHP_PHASE_INIT, phase_start, generated_length - generated_before, count_segment_lines(&source, LHP_INIT_BLOCK));
+    }
+    if(status == 0){
+        // Build the build cache record and compare it to the one saved when the EXE File was last built.
+        size_t record_length = 0;
+        char *record = build_cache_record(&source, generated, generated_length, options, requests_file_name, &record_length);
+        int up_to_date = (record != NULL && !options->force && cache_is_up_to_date(cache_file_name, output_file_name, record, record_length));
+        phase_start = end_phase(metrics, LHP_PHASE_CACHE, phase_start, record_length, 0);
+        if(up_to_date){
+            // Nothing has changed, so the existing EXE File (or object file) is reused and nothing is written.
+            fprintf(lhp_log, "The file '%s' is up to date.\n", output_file_name);
+            status = LHP_UP_TO_DATE;
+        } else {
+            // Write the C File and call the final user-defined function: compilation to compile it.
+            intermediary_file = file_opener(intermediary_file_name, "w", lhp_log);
+            if(intermediary_file == NULL || fwrite(generated, 1, generated_length, intermediary_file) != generated_length){
+                status = 1;
+            }
+            if(intermediary_file != NULL && fclose(intermediary_file) != 0){
+                status = 1;
+            }
+            size_t generated_lines = 0;
+            for(size_t i = 0; i < generated_length; i++){
+                generated_lines += (generated[i] == '\n');
+            }
+            phase_start = end_phase(metrics, LHP_PHASE_WRITE, phase_start, generated_length, generated_lines);
+            if(status == 0 && requests_file_name != NULL){
+                status = profile_guided_compilation(base_name, requests_file_name, options, lhp_log);
+            } else if(status == 0){
+                status = compilation(intermediary_file_name, (options->bundle_name != NULL || options->host_name != NULL) ? handler : NULL, NULL, options, lhp_log);
+            }
+            // The bytes of the compile phase are the size of the EXE File (or object file) it made.
+            struct stat output_info;
+            phase_start = end_phase(metrics, LHP_PHASE_COMPILE, phase_start, (status == 0 && stat(output_file_name, &output_info) == 0) ? (unsigned long long)output_info.st_size : 0, 0);
+            // Save the build cache record once the EXE File has been built successfully.
+            if(status == 0 && record != NULL){
+                save_cache_record(cache_file_name, record, record_length, lhp_log);
+            }
+        }
+        free(record);
+    }
+
+    // Close any opened files and free any allocated memory as the LHP File has been processed.
+    source_unloader(&source);
+    free(generated);
+    free(lhp_file_name);
+    free(base_name);
+    free(intermediary_file_name);
+    free(output_file_name);
+    free(cache_file_name);
+    free(requests_file_name);
+
+    // Finish the metrics with the total time and the peak memory use (of the front end and of gcc).
+    struct rusage usage;
+    metrics->total_nanoseconds = now_nanoseconds() - start;
+    if(getrusage(RUSAGE_SELF, &usage) == 0){
+        metrics->peak_memory = usage.ru_maxrss;
+    }
+    if(getrusage(RUSAGE_CHILDREN, &usage) == 0){
+        metrics->peak_child_memory = usage.ru_maxrss;
+    }
+    metrics->status = status;
+    metrics->recorded = 1;
+    return status;
+}
+
+/**
+ * This function finds the system headers (those included with "#include <...>") that every LHP File in a list includes
+ * (leaving out those that can't use the precompiled preamble), so that they can be put in the precompiled preamble along with the standard libraries that every C File needs.
+ *
+ * @author Iqra Haq
+ * @param[in] list - The list of LHP Files.
+ * @param[out] common - The "#include" lines found in every LHP File (a list of names, to be freed with free_lhp_files()).
+ * @param[out] lhp_log - The log file to store any errors in.
+ */
+void find_common_includes(struct lhp_file_list *list, struct lhp_file_list *common, FILE *lhp_log)
+{
+    // Whether no page using the preamble has been read yet.
+    int first = 1;
+    for(size_t i = 0; i < list->count; i++){
+        // The ".lhp" extension is optional, as it is for compile_lhp_file.
+        size_t name_length = strlen(list->names[i]);
+        char *lhp_file_name = malloc(name_length + 5);
+        struct lhp_source source;
+        if(lhp_file_name == NULL){
+            free_lhp_files(common);
+            return;
+        }
+        snprintf(lhp_file_name, name_length + 5, (strstr(list->names[i], ".lhp") == NULL) ? "%s.lhp" : "%s", list->names[i]);
+        // A page that can't be read will fail to compile anyway, and has no headers in common with the others.
+        if(source_loader(lhp_file_name, &source, lhp_log) != 0){
+            source_unloader(&source);
+            free(lhp_file_name);
+            free_lhp_files(common);
+            return;
+        }
+
+        // Pages that can't use the preamble are compiled without it, so they don't limit what is in it.
+        if(!shares_preamble(&source)){
+            source_unloader(&source);
+            free(lhp_file_name);
+            continue;
+        }
+
+        // Mark which of the headers found so far this page includes as well (or, for the first page, take all of them).
+        int *found = calloc(common->count + 1, sizeof(*found));
+        for(size_t j = 0; j < source.segment_count && found != NULL; j++){
+            if(source.segments[j].kind != LHP_DIRECTIVE){
+                continue;
+            }
+            const char *cursor = source.segments[j].start;
+            const char *end = cursor + source.segments[j].length;
+            while(cursor < end){
+                const char *line;
+                size_t length = next_line(&cursor, end, &line);
+                while(length > 0 && isspace((unsigned char)line[length - 1])){
+                    length--;
+                }
+                if(length < 10 || strncmp(line, "#include <", 10) != 0 || line[length - 1] != '>'){
+                    continue;
+                }
+                for(size_t k = 0; k < common->count; k++){
+                    if(strlen(common->names[k]) == length && strncmp(common->names[k], line, length) == 0){
+                        found[k] = 1;
+                    }
+                }
+                if(first){
+                    char *include = strndup(line, length);
+                    if(include != NULL){
+                        add_lhp_file(common, include, 0);
+                        free(include);
+                    }
+                }
+            }
+        }
+        // Drop the headers that this page doesn't include.
+        for(size_t k = common->count; !first && k > 0; k--){
+            if(found == NULL || !found[k - 1]){
+                free(common->names[k - 1]);
+                common->names[k - 1] = common->names[--common->count];
+            }
+        }
+        free(found);
+        source_unloader(&source);
+        free(lhp_file_name);
+        first = 0;
+    }
+}
+
+/**
+ * This function builds the precompiled preamble for a list of LHP Files that are about to be compiled together, so that
+ * gcc parses the standard libraries (and any other system headers that every page includes) once rather than for every page.
+ * The preamble is kept in a directory of its own within ".lhppch", named after a hash of its contents and the flags it
+ * is compiled with (which must be the same as those of the pages), so it is only built once for each toolchain and
+ * build profile and reused by later runs. If it can't be built, the pages are compiled without it.
+ * The preamble only holds headers that each page using it includes anyway, before any other directive of its own, so it
+ * doesn't change what those pages compile to. Pages that define something before an include (see shares_preamble) are
+ * compiled without it (and gcc falls back to reading lhp_preamble.h itself for a page it can't use the precompiled header for).
+ *
+ * @author Iqra Haq
+ * @param[in] list - The list of LHP Files.
+ * @param[in,out] options - The options given by the user, which are given the directory of the preamble.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status (1 if the pages are compiled without a preamble).
+ */
+int build_preamble(struct lhp_file_list *list, struct lhp_options *options, FILE *lhp_log)
+{
+    struct lhp_toolchain *toolchain = &options->toolchain;
+    struct lhp_file_list common = { NULL, NULL, 0, 0 };
+    char *preamble = NULL;
+    size_t preamble_length = 0;
+    char directory[64];
+    char header_file_name[96];
+    char pch_file_name[96];
+    char temporary_file_name[96];
+    struct stat file_info;
+    int status = 0;
+    log_context.job = 0;
+    log_context.file = NULL;
+    set_log_phase("preamble");
+
+    // Put together the preamble: the standard libraries, then the system headers every page includes.
+    find_common_includes(list, &common, lhp_log);
+    FILE *preamble_file = open_memstream(&preamble, &preamble_length);
+    if(preamble_file == NULL){
+        free_lhp_files(&common);
+        return 1;
+    }
+    fprintf(preamble_file, "%s\n", "// Precompiled preamble of the pages compiled together (generated by lhpCompiler).");
+    print_lines(preamble_code, preamble_file);
+    for(size_t i = 0; i < common.count; i++){
+        int in_preamble = 0;
+        for(size_t j = 0; preamble_code[j] != NULL; j++){
+            in_preamble |= (strcmp(preamble_code[j], common.names[i]) == 0);
+        }
+        if(!in_preamble){
+            fprintf(preamble_file, "%s\n", common.names[i]);
+        }
+    }
+    fclose(preamble_file);
+
+    // The flags are those each page is compiled with (leaving out any for the linker), which gcc needs to match.
+    size_t argument_count = 0;
+    char **arguments = malloc((16 + LHP_MAX_PROFILE_FLAGS + toolchain->mysql_flag_count) * sizeof(*arguments));
+    if(arguments == NULL){
+        free_lhp_files(&common);
+        free(preamble);
+        return 1;
+    }
+    arguments[argument_count++] = "gcc";
+    for(size_t i = 0; compiler_flags[i] != NULL; i++){
+        arguments[argument_count++] = (char *)compiler_flags[i];
+    }
+    const char *flags[LHP_MAX_PROFILE_FLAGS + 1];
+    profile_flags(options->profile, options->bundle_name != NULL, flags);
+    for(size_t i = 0; flags[i] != NULL; i++){
+        if(!is_link_flag(flags[i])){
+            arguments[argument_count++] = (char *)flags[i];
+        }
+    }
+    if(options->host_name != NULL){
+        for(size_t i = 0; module_flags[i] != NULL; i++){
+            if(strcmp(module_flags[i], "-shared") != 0){
+                arguments[argument_count++] = (char *)module_flags[i];
+            }
+        }
+    }
+    for(size_t i = 0; i < toolchain->mysql_flag_count; i++){
+        if(!is_link_flag(toolchain->mysql_flags[i])){
+            arguments[argument_count++] = toolchain->mysql_flags[i];
+        }
+    }
+    size_t flag_count = argument_count;
+
+    // Name the preamble's directory after a hash of the preamble and its flags.
+    unsigned long long hash = hash_data(HASH_START, preamble, preamble_length);
+    for(size_t i = 0; i < flag_count; i++){
+        hash = hash_data(hash, arguments[i], strlen(arguments[i]) + 1);
+    }
+    snprintf(directory, sizeof(directory), ".lhppch/%016llx", hash);
+    snprintf(header_file_name, sizeof(header_file_name), "%s/lhp_preamble.h", directory);
+    snprintf(pch_file_name, sizeof(pch_file_name), "%s/lhp_preamble.h.gch", directory);
+    snprintf(temporary_file_name, sizeof(temporary_file_name), "%s/lhp_preamble.h.gch.%ld", directory, (long)getpid());
+
+    if(stat(pch_file_name, &file_info) == 0 && !options->force){
+        fprintf(lhp_log, "The precompiled preamble '%s' is up to date.\n", pch_file_name);
+    } else if((mkdir(".lhppch", 0755) != 0 && errno != EEXIST) || (mkdir(directory, 0755) != 0 && errno != EEXIST)){
+        log_message(lhp_log, LHP_ERROR, "Error creating %s! %s\n", directory, strerror(errno));
+        status = 1;
+    } else {
+        // Write the header, then compile it under a temporary name so that another run never sees it half written.
+        FILE *header_file = file_opener(header_file_name, "w", lhp_log);
+        if(header_file == NULL || fwrite(preamble, 1, preamble_length, header_file) != preamble_length){
+            status = 1;
+        }
+        if(header_file != NULL && fclose(header_file) != 0){
+            status = 1;
+        }
+        arguments[argument_count++] = "-x";
+        arguments[argument_count++] = "c-header";
+        arguments[argument_count++] = header_file_name;
+        arguments[argument_count++] = "-o";
+        arguments[argument_count++] = temporary_file_name;
+        arguments[argument_count] = NULL;
+        if(status == 0 && (run_logged_program(arguments, lhp_log) != 0 || rename(temporary_file_name, pch_file_name) != 0)){
+            unlink(temporary_file_name);
+            status = 1;
+        }
+        if(status == 0){
+            fprintf(lhp_log, "The precompiled preamble '%s' has been successfully compiled (with %zu common headers).\n", pch_file_name, common.count);
+        } else {
+            log_message(lhp_log, LHP_WARNING, "The precompiled preamble could not be built, so the pages are compiled without it.\n");
+        }
+    }
+
+    if(status == 0){
+        options->preamble_directory = strdup(directory);
+        status = (options->preamble_directory == NULL);
+    }
+    free(arguments);
+    free(preamble);
+    free_lhp_files(&common);
+    return status;
+}
+
+/**
+ * This function outputs the status of an LHP File compiled in batch mode as soon as it has finished, and counts it.
+ *
+ * @author Iqra Haq
+ * @param[in] file_name - The name of the LHP File.
+ * @param[in] exit_status - The status compile_lhp_file returned for it.
+ * @param[out] compiled - The number of LHP Files compiled so far.
+ * @param[out] up_to_date - The number of LHP Files found to be up to date so far.
+ * \return int - Error status (1 if the LHP File failed to compile).
+ */
+int report_batch_file(const char *file_name, int exit_status, size_t *compiled, size_t *up_to_date)
+{
+    if(exit_status == 0){
+        printf("[ok] %s\n", file_name);
+        (*compiled)++;
+    } else if(exit_status == LHP_UP_TO_DATE){
+        printf("[up to date] %s\n", file_name);
+        (*up_to_date)++;
+    } else {
+        printf("[failed] %s\n", file_name);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * This function compiles a list of LHP Files in parallel. Each LHP File is compiled in its own worker process
+ * (front end and gcc alike), with up to "jobs" worker processes running at once.
+ * LHP Files whose EXE Files are already up to date are reported as such.
+ * If not even one worker process can be started, the LHP File is compiled by this process instead.
+ * The status of each LHP File is outputted to the user as soon as it has finished.
+ *
+ * @author Iqra Haq
+ * @param[in] list - The list of LHP Files.
+ * @param[in] options - The options given by the user (including the maximum number of worker processes to run at once).
+ * @param[out] metrics - The metrics of each LHP File, in memory shared with the worker processes (NULL if they aren't needed).
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status (1 if any of the LHP Files failed to compile).
+ */
+int batch_compilation(struct lhp_file_list *list, struct lhp_options *options, struct lhp_file_metrics *metrics, FILE *lhp_log)
+{
+    // The worker process running in each slot of the pool, and the LHP File that it is compiling.
+    long jobs = options->jobs;
+    pid_t *workers = calloc(jobs, sizeof(*workers));
+    size_t *worker_files = calloc(jobs, sizeof(*worker_files));
+    size_t next_file = 0;
+    size_t compiled = 0;
+    size_t up_to_date = 0;
+    long running = 0;
+    int status = 0;
+
+    if(workers == NULL || worker_files == NULL){
+        log_message(lhp_log, LHP_ERROR, "%s\n", "Not enough memory to start the worker processes.");
+        free(workers);
+        free(worker_files);
+        return 1;
+    }
+    // Pages compiled together share a precompiled preamble (a single page would take longer to build it than it saves).
+    if(list->count > 1){
+        build_preamble(list, options, lhp_log);
+    }
+
+    // Keep going until every LHP File has been handed out and every worker process has finished.
+    while(next_file < list->count || running > 0){
+        // Fill any free slots in the pool with a worker process for the next LHP File.
+        for(long i = 0; i < jobs && next_file < list->count; i++){
+            if(workers[i] != 0){
+                continue;
+            }
+
+            // Anything buffered must be written before forking so that it isn't written twice.
+            fflush(stdout);
+            fflush(lhp_log);
+            pid_t pid = fork();
+            if(pid == 0){
+                // The worker process compiles its LHP File and exits with the result.
+                int worker_status = compile_lhp_file(list->names[next_file], next_file, options, (metrics != NULL) ? &metrics[next_file] : NULL, lhp_log);
+                fflush(lhp_log);
+                exit(worker_status);
+            } else if(pid == -1){
+                log_message(lhp_log, LHP_WARNING, "Error starting a worker process for %s.\n", list->names[next_file]);
+                if(running > 0){
+                    // If no more processes can be started, compile this LHP File once one of the others has finished.
+                    break;
+                }
+                // With no worker process to wait for, compile this LHP File in this process instead.
+                int exit_status = compile_lhp_file(list->names[next_file], next_file, options, (metrics != NULL) ? &metrics[next_file] : NULL, lhp_log);
+                fflush(lhp_log);
+                log_context.job = 0;
+                log_context.file = NULL;
+                set_log_phase("run");
+                status |= report_batch_file(list->names[next_file++], exit_status, &compiled, &up_to_date);
+                continue;
+            }
+            workers[i] = pid;
+            worker_files[i] = next_file++;
+            running++;
+        }
+
+        // Wait for any of the worker processes to finish.
+        if(running == 0){
+            continue;
+        }
+        int worker_status;
+        pid_t pid = wait(&worker_status);
+        if(pid == -1){
+            // Nothing left to wait for (no worker process could be started at all).
+            status = 1;
+            break;
+        }
+        for(long i = 0; i < jobs; i++){
+            if(workers[i] == pid){
+                // Output the status of the LHP File and add it to the overall status.
+                int exit_status = WIFEXITED(worker_status) ? WEXITSTATUS(worker_status) : 1;
+                status |= report_batch_file(list->names[worker_files[i]], exit_status, &compiled, &up_to_date);
+                workers[i] = 0;
+                running--;
+                break;
+            }
+        }
+    }
+
+    // Output a summary for the whole batch.
+    printf("Compiled %zu of %zu LHP files (%zu already up to date).\n", compiled, list->count, up_to_date);
+    if(status != 0){
+        printf("Some files could not be compiled. Please check LHP.log for further details!\n");
+    }
+
+    free(workers);
+    free(worker_files);
+    free(options->preamble_directory);
+    options->preamble_directory = NULL;
+    return status;
+}
+
+
+/**
+ * This function finds the route of a bundled page, i.e. the path that requests for it are sent to.
+ * The route is the path of the LHP File relative to the directory it was found in (or as given by the user),
+ * without the ".lhp" extension, e.g. "pages/shop/basket.lhp" found in "pages" has the route "/shop/basket".
+ *
+ * @author Iqra Haq
+ * @param[in] list - The list of LHP Files.
+ * @param[in] index - The position of the LHP File in the list.
+ * \return char * - The route (to be freed by the caller).
+ */
+char *page_route(struct lhp_file_list *list, size_t index)
+{
+    const char *path = list->names[index] + list->route_starts[index];
+
+    // Leave out any "./" or "/" at the start of the path, as a single "/" is added to every route.
+    while(strncmp(path, "./", 2) == 0 || path[0] == '/'){
+        path += (path[0] == '/') ? 1 : 2;
+    }
+    size_t path_length = strlen(path);
+    if(path_length > 4 && strcmp(path + path_length - 4, ".lhp") == 0){
+        path_length -= 4;
+    }
+
+    char *route = malloc(path_length + 2);
+    if(route != NULL){
+        snprintf(route, path_length + 2, "/%.*s", (int)path_length, path);
+    }
+    return route;
+}
+
+/**
+ * This function compares two entries of the route table by their routes, so that the table can be sorted with qsort().
+ * The bundle searches the table with strcmp() as well, so both must order routes in the same way.
+ *
+ * @author Iqra Haq
+ * @param[in] first - The first entry.
+ * @param[in] second - The second entry.
+ * \return int - Less than, equal to or greater than 0 as with strcmp().
+ */
+int compare_routes(const void *first, const void *second)
+{
+    return strcmp(((const struct bundle_route *)first)->route, ((const struct bundle_route *)second)->route);
+}
+
+// Code shared by a bundle and a host for finding the page of a request in the route table.
+const char *const route_search_code[] = {
+    "",
+    "// Compares a path to an entry of the route table.",
+    "static int lhp_route_compare(const void *path, const void *route)",
+    "{",
+    "\treturn strcmp((const char *)path, ((const struct lhp_route *)route)->path);",
+    "}",
+    "",
+    "// Finds the page for a request path, ignoring any \".exe\" extension and leaving out leading directories",
+    "// (e.g. \"/cgi-bin\") one at a time until a route matches.",
+    "static const struct lhp_route *lhp_find_route(const char *path)",
+    "{",
+    "\tchar key[1024];",
+    "\tsize_t length;",
+    "\tif (path == NULL || (length = strlen(path)) >= sizeof(key)) {",
+    "\t\treturn NULL;",
+    "\t}",
+    "\tmemcpy(key, path, length + 1);",
+    "\tif (length > 4 && strcmp(key + length - 4, \".exe\") == 0) {",
+    "\t\tkey[length - 4] = '\\0';",
+    "\t}",
+    "\tfor (const char *suffix = key; suffix != NULL; suffix = strchr(suffix + 1, '/')) {",
+    "\t\tconst struct lhp_route *route = bsearch(suffix, lhp_routes, sizeof(lhp_routes) / sizeof(lhp_routes[0]), sizeof(lhp_routes[0]), lhp_route_compare);",
+    "\t\tif (route != NULL) {",
+    "\t\t\treturn route;",
+    "\t\t}",
+    "\t}",
+    "\treturn NULL;",
+    "}",
+    NULL
+};
+
+// Code for the bundle's own main function, which sends each request to the page found for it in the route table.
+const char *const bundle_dispatch_code[] = {
+    "",
+    "int main(void)",
+    "{",
+    "\tlhp_supervise();",
+    "\tlhp_init_pages();",
+    "\twhile (FCGI_Accept() >= 0) {",
+    "\t\t// The page is chosen by PATH_INFO (e.g. /bundle.exe/shop/basket) or, without one, by SCRIPT_NAME.",
+    "\t\tconst char *path_info = getenv(\"PATH_INFO\");",
+    "\t\tconst struct lhp_route *route = lhp_find_route((path_info != NULL && path_info[0] != '\\0') ? path_info : getenv(\"SCRIPT_NAME\"));",
+    "\t\tif (route != NULL) {",
+    "\t\t\troute->handler();",
+    "\t\t} else {",
+    "\t\t\tprintf(\"Status: 404 Not Found\\nContent-type: text/html\\n\\n<h1>404 Not Found</h1>\\n\");",
+    "\t\t}",
+    "\t}",
+    "\treturn 0;",
+    "}",
+    NULL
+};
+
+// Code for a host's main function, which loads the module of each page with dlopen() and sends each request to the
+// module found for it in the route table. A module is opened through a descriptor of its own (/proc/self/fd/N), so that
+// a new version of it is loaded as a new library even though its path hasn't changed.
+const char *const host_dispatch_code[] = {
+    "",
+    "// The loaded version of the module of each route, and the file it was loaded from.",
+    "struct lhp_loaded_module {",
+    "\tconst struct lhp_module *module;",
+    "\tvoid *library;",
+    "\tint descriptor;",
+    "\tdev_t device;",
+    "\tino_t inode;",
+    "\ttime_t checked;",
+    "};",
+    "",
+    "static struct lhp_loaded_module lhp_modules[sizeof(lhp_routes) / sizeof(lhp_routes[0])];",
+    "",
+    "// Loads the module of a route if its file has been replaced since it was last loaded (lhpCompiler renames each new",
+    "// version over the old one). The new version's init function is run before it is swapped in and the old version is",
+    "// only closed afterwards, so a module that fails to load leaves the old one serving requests.",
+    "static void lhp_load_module(size_t index)",
+    "{",
+    "\tstruct lhp_loaded_module *loaded = &lhp_modules[index];",
+    "\tstruct stat info;",
+    "\tchar name[32];",
+    "\tif (stat(lhp_routes[index].module, &info) == -1 || (info.st_dev == loaded->device && info.st_ino == loaded->inode)) {",
+    "\t\treturn;",
+    "\t}",
+    "\tint descriptor = open(lhp_routes[index].module, O_RDONLY | O_CLOEXEC);",
+    "\tif (descriptor == -1) {",
+    "\t\treturn;",
+    "\t}",
+    "\tif (fstat(descriptor, &info) == -1) {",
+    "\t\tclose(descriptor);",
+    "\t\treturn;",
+    "\t}",
+    "\t// Whether or not it loads, this version isn't tried again.",
+    "\tloaded->device = info.st_dev;",
+    "\tloaded->inode = info.st_ino;",
+    "\tsnprintf(name, sizeof(name), \"/proc/self/fd/%d\", descriptor);",
+    "\tvoid *library = dlopen(name, RTLD_NOW | RTLD_LOCAL);",
+    "\tconst struct lhp_module *module = (library != NULL) ? dlsym(library, \"lhp_module\") : NULL;",
+    "\tif (module == NULL || module->abi != LHP_MODULE_ABI) {",
+    "\t\tfprintf(stderr, \"lhp host: %s could not be loaded (%s)\\n\", lhp_routes[index].module, (module == NULL) ? dlerror() : \"built for a different host\");",
+    "\t\tif (library != NULL) {",
+    "\t\t\tdlclose(library);",
+    "\t\t}",
+    "\t\tclose(descriptor);",
+    "\t\treturn;",
+    "\t}",
+    "\tmodule->init();",
+    "\tif (loaded->library != NULL) {",
+    "\t\tdlclose(loaded->library);",
+    "\t\tclose(loaded->descriptor);",
+    "\t}",
+    "\tloaded->module = module;",
+    "\tloaded->library = library;",
+    "\tloaded->descriptor = descriptor;",
+    "}",
+    "",
+    "int main(void)",
+    "{",
+    "\tlhp_supervise();",
+    "\tfor (size_t i = 0; i < sizeof(lhp_modules) / sizeof(lhp_modules[0]); i++) {",
+    "\t\tlhp_load_module(i);",
+    "\t}",
+    "\twhile (FCGI_Accept() >= 0) {",
+    "\t\t// The page is chosen by PATH_INFO (e.g. /host.exe/shop/basket) or, without one, by SCRIPT_NAME.",
+    "\t\tconst char *path_info = getenv(\"PATH_INFO\");",
+    "\t\tconst struct lhp_route *route = lhp_find_route((path_info != NULL && path_info[0] != '\\0') ? path_info : getenv(\"SCRIPT_NAME\"));",
+    "\t\tstruct lhp_loaded_module *loaded = (route != NULL) ? &lhp_modules[route - lhp_routes] : NULL;",
+    "\t\t// A module is checked for a new version at most once a second, between requests.",
+    "\t\ttime_t now = time(NULL);",
+    "\t\tif (loaded != NULL && loaded->checked != now) {",
+    "\t\t\tloaded->checked = now;",
+    "\t\t\tlhp_load_module((size_t)(route - lhp_routes));",
+    "\t\t}",
+    "\t\tif (loaded != NULL && loaded->module != NULL) {",
+    "\t\t\tloaded->module->handler();",
+    "\t\t} else {",
+    "\t\t\tprintf(\"Status: 404 Not Found\\nContent-type: text/html\\n\\n<h1>404 Not Found</h1>\\n\");",
+    "\t\t}",
+    "\t}",
+    "\treturn 0;",
+    "}",
+    NULL
+};
+
+/**
+ * This function links every page of a bundle into a single FastCGI EXE File. A C File for the bundle is generated
+ * with a route table (sorted at compile time so that it can be binary searched) and a main function that sends each
+ * request to the handler of the right page. It is then compiled and linked with the object files of the pages.
+ * If neither the bundle's C File nor any of the pages have changed since the EXE File was last linked, nothing is done.
+ * A host is built in the same way, but its route table names the module of each page (by its full path, so that the
+ * host can be run from any directory) rather than its handler. The host loads the modules itself when it starts, so it
+ * only needs building again when pages are added or removed.
+ *
+ * @author Iqra Haq
+ * @param[in] list - The list of LHP Files in the bundle (all already compiled to object files, or to modules for a host).
+ * @param[in] options - The options given by the user (including the name of the bundle or host).
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
+ */
+int bundle_compilation(struct lhp_file_list *list, struct lhp_options *options, FILE *lhp_log)
+{
+    struct bundle_route *routes = calloc(list->count, sizeof(*routes));
+    char *generated = NULL;
+    size_t generated_length = 0;
+    int status = 0;
+    int up_to_date = !options->force;
+    struct stat file_info;
+    int host = (options->host_name != NULL);
+    const char *bundle_name = host ? options->host_name : options->bundle_name;
+    const char *kind = host ? "host" : "bundle";
+    log_context.job = 0;
+    log_context.file = bundle_name;
+    set_log_phase(kind);
+
+    // Names of the bundle's C File and EXE File.
+    size_t name_length = strlen(bundle_name) + 5;
+    char *c_file_name = malloc(name_length);
+    char *exe_file_name = malloc(name_length);
+    if(routes == NULL || c_file_name == NULL || exe_file_name == NULL){
+        log_message(lhp_log, LHP_ERROR, "Error building the %s! Not enough memory.\n", kind);
+        free(routes);
+        free(c_file_name);
+        free(exe_file_name);
+        return 1;
+    }
+    snprintf(c_file_name, name_length, "%s.c", bundle_name);
+    snprintf(exe_file_name, name_length, "%s.exe", bundle_name);
+    // The bundle only needs linking again if any page's object file is newer than its EXE File.
+    time_t exe_time = (stat(exe_file_name, &file_info) == 0) ? file_info.st_mtime : 0;
+    if(exe_time == 0){
+        up_to_date = 0;
+    }
+
+    // Build the route table, finding the object file (or module) of each page.
+    for(size_t i = 0; i < list->count; i++){
+        routes[i].route = page_route(list, i);
+        routes[i].index = i;
+        routes[i].object_file_name = strdup(list->names[i]);
+        if(routes[i].route == NULL || routes[i].object_file_name == NULL){
+            status = 1;
+            continue;
+        }
+        remove_file_extension(routes[i].object_file_name);
+        char *object_file_name = realloc(routes[i].object_file_name, strlen(routes[i].object_file_name) + 4);
+        if(object_file_name == NULL){
+            status = 1;
+            continue;
+        }
+        routes[i].object_file_name = strcat(object_file_name, host ? ".so" : ".o");
+        if(host){
+            // The host finds each module by its full path. Newer modules don't change the host, as it reloads them itself.
+            char *module_path = realpath(routes[i].object_file_name, NULL);
+            if(module_path == NULL){
+                log_message(lhp_log, LHP_ERROR, "Error building the host! The module %s could not be found.\n", routes[i].object_file_name);
+                status = 1;
+                continue;
+            }
+            free(routes[i].object_file_name);
+            routes[i].object_file_name = module_path;
+        } else if(stat(routes[i].object_file_name, &file_info) != 0 || file_info.st_mtime > exe_time){
+            up_to_date = 0;
+        }
+    }
+
+    // Sort the route table and make sure no two pages have the same route.
+    if(status == 0){
+        qsort(routes, list->count, sizeof(*routes), compare_routes);
+        for(size_t i = 1; i < list->count; i++){
+            if(strcmp(routes[i - 1].route, routes[i].route) == 0){
+                log_message(lhp_log, LHP_ERROR, "Error building the %s! %s and %s both have the route %s.\n", kind, list->names[routes[i - 1].index], list->names[routes[i].index], routes[i].route);
+                status = 1;
+            }
+        }
+    }
+
+    // Generate the bundle's C File in memory.
+    FILE *bundle_file = (status == 0) ? open_memstream(&generated, &generated_length) : NULL;
+    if(bundle_file != NULL && host){
+        fprintf(bundle_file, "%s\n", "#define _POSIX_C_SOURCE 200809L");
+        fprintf(bundle_file, "%s\n", "#include \"fcgi_stdio.h\"");
+        fprintf(bundle_file, "%s\n", "#include <dlfcn.h>");
+        fprintf(bundle_file, "%s\n", "#include <fcntl.h>");
+        fprintf(bundle_file, "%s\n", "#include <stdlib.h>");
+        fprintf(bundle_file, "%s\n", "#include <string.h>");
+        fprintf(bundle_file, "%s\n", "#include <time.h>");
+        fprintf(bundle_file, "%s\n", "#include <unistd.h>");
+        fprintf(bundle_file, "%s\n", "#include <sys/stat.h>");
+        print_lines(options->supervise ? supervisor_code : supervisor_stub_code, bundle_file);
+        print_lines(module_abi_code, bundle_file);
+        fprintf(bundle_file, "\n%s\n", "// Route table, sorted at compile time so that it can be searched with bsearch().");
+        fprintf(bundle_file, "%s\n", "struct lhp_route {\n\tconst char *path;\n\tconst char *module;\n};");
+        fprintf(bundle_file, "%s\n", "static const struct lhp_route lhp_routes[] = {");
+        for(size_t i = 0; i < list->count; i++){
+            fprintf(bundle_file, "%s\n", "\t{ .module =");
+            print_string_literal(routes[i].object_file_name, strlen(routes[i].object_file_name), bundle_file);
+            fprintf(bundle_file, "%s\n", "\t, .path =");
+            print_string_literal(routes[i].route, strlen(routes[i].route), bundle_file);
+            fprintf(bundle_file, "%s\n", "\t},");
+        }
+        fprintf(bundle_file, "%s\n", "};");
+        print_lines(route_search_code, bundle_file);
+        print_lines(host_dispatch_code, bundle_file);
+        fclose(bundle_file);
+    } else if(bundle_file != NULL){
+        // The supervisor needs the POSIX functions, as the host always does.
+        if(options->supervise){
+            fprintf(bundle_file, "%s\n", "#define _POSIX_C_SOURCE 200809L");
+        }
+        fprintf(bundle_file, "%s\n", "#include \"fcgi_stdio.h\"");
+        fprintf(bundle_file, "%s\n", "#include <stdlib.h>");
+        fprintf(bundle_file, "%s\n", "#include <string.h>");
+        print_lines(options->supervise ? supervisor_code : supervisor_stub_code, bundle_file);
+        fprintf(bundle_file, "\n%s\n", "// Handlers of the bundled pages.");
+        for(size_t i = 0; i < list->count; i++){
+            fprintf(bundle_file, "int lhp_page_%zu(void);\n", i);
+            fprintf(bundle_file, "void lhp_page_%zu_init(void);\n", i);
+        }
+        // Run the init block of every page once, before the first request is accepted.
+        fprintf(bundle_file, "\n%s\n", "static void lhp_init_pages(void)\n{");
+        for(size_t i = 0; i < list->count; i++){
+            fprintf(bundle_file, "\tlhp_page_%zu_init();\n", i);
+        }
+        fprintf(bundle_file, "%s\n", "}");
+        fprintf(bundle_file, "\n%s\n", "// Route table, sorted at compile time so that it can be searched with bsearch().");
+        fprintf(bundle_file, "%s\n", "struct lhp_route {\n\tconst char *path;\n\tint (*handler)(void);\n};");
+        fprintf(bundle_file, "%s\n", "static const struct lhp_route lhp_routes[] = {");
+        for(size_t i = 0; i < list->count; i++){
+            fprintf(bundle_file, "\t{ .handler = lhp_page_%zu, .path =\n", routes[i].index);
+            print_string_literal(routes[i].route, strlen(routes[i].route), bundle_file);
+            fprintf(bundle_file, "%s\n", "\t},");
+        }
+        fprintf(bundle_file, "%s\n", "};");
+        print_lines(route_search_code, bundle_file);
+        print_lines(bundle_dispatch_code, bundle_file);
+        fclose(bundle_file);
+    } else if(status == 0){
+        log_message(lhp_log, LHP_ERROR, "Error building the %s! Not enough memory.\n", kind);
+        status = 1;
+    }
+
+    // Leave the bundle alone if its C File is the same as before and none of the pages have changed.
+    if(status == 0 && up_to_date){
+        FILE *existing = fopen(c_file_name, "rb");
+        char *saved = malloc(generated_length + 1);
+        if(existing == NULL || saved == NULL || fread(saved, 1, generated_length + 1, existing) != generated_length || memcmp(saved, generated, generated_length) != 0){
+            up_to_date = 0;
+        }
+        if(existing != NULL){
+            fclose(existing);
+        }
+        free(saved);
+    }
+
+    if(status == 0 && up_to_date){
+        fprintf(lhp_log, "The %s '%s' is up to date.\n", kind, exe_file_name);
+        printf("[up to date] %s\n", exe_file_name);
+    } else if(status == 0){
+        // Write the bundle's C File and link it with every page into a single EXE File.
+        FILE *intermediary_file = file_opener(c_file_name, "w", lhp_log);
+        if(intermediary_file == NULL || fwrite(generated, 1, generated_length, intermediary_file) != generated_length){
+            status = 1;
+        }
+        if(intermediary_file != NULL && fclose(intermediary_file) != 0){
+            status = 1;
+        }
+
+        // Nothing is linked if the C File couldn't be written.
+        size_t argument_count = 0;
+        char **arguments = (status == 0) ? malloc((16 + LHP_MAX_PROFILE_FLAGS + list->count + options->toolchain.mysql_flag_count) * sizeof(*arguments)) : NULL;
+        if(arguments == NULL){
+            status = 1;
+        } else {
+            arguments[argument_count++] = "gcc";
+            for(size_t i = 0; compiler_flags[i] != NULL; i++){
+                arguments[argument_count++] = (char *)compiler_flags[i];
+            }
+            const char *flags[LHP_MAX_PROFILE_FLAGS + 1];
+            profile_flags(options->profile, 1, flags);
+            for(size_t i = 0; flags[i] != NULL; i++){
+                arguments[argument_count++] = (char *)flags[i];
+            }
+            arguments[argument_count++] = "-o";
+            arguments[argument_count++] = exe_file_name;
+            arguments[argument_count++] = c_file_name;
+            if(host){
+                // The host is linked with the whole of libfcgi and exports it, as the modules use it rather than a copy of their own.
+                for(size_t i = 0; host_libraries[i] != NULL; i++){
+                    arguments[argument_count++] = (char *)host_libraries[i];
+                }
+            } else {
+                for(size_t i = 0; i < list->count; i++){
+                    arguments[argument_count++] = routes[i].object_file_name;
+                }
+                for(size_t i = 0; compiler_libraries[i] != NULL; i++){
+                    arguments[argument_count++] = (char *)compiler_libraries[i];
+                }
+                for(size_t i = 0; i < options->toolchain.mysql_flag_count; i++){
+                    arguments[argument_count++] = options->toolchain.mysql_flags[i];
+                }
+            }
+            arguments[argument_count] = NULL;
+            status = (run_logged_program(arguments, lhp_log) == 0) ? 0 : 1;
+            free(arguments);
+        }
+
+        if(status == 0){
+            fprintf(lhp_log, "The %s '%s' has been successfully linked with %zu pages.\n", kind, exe_file_name, list->count);
+            printf("[ok] %s (%zu pages)\n", exe_file_name, list->count);
+        }
+    }
+    if(status != 0){
+        printf("[failed] %s\n", exe_file_name);
+    }
+
+    // Free the route table and any allocated memory.
+    for(size_t i = 0; i < list->count; i++){
+        free(routes[i].route);
+        free(routes[i].object_file_name);
+    }
+    free(routes);
+    free(generated);
+    free(c_file_name);
+    free(exe_file_name);
+    return status;
+}
+
+/**
+ * This function reads the runtime metrics of a page from its shared memory segment and prints them as a line of JSON,
+ * adding up the slots of every process that has served the page since the segment was made.
+ * The percentiles are the upper bound of the histogram bucket they fall in.
+ *
+ * @author Iqra Haq
+ * @param[in] segment_name - The name of the page's segment.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
+ */
+int print_runtime_metrics(const char *segment_name, FILE *lhp_log)
+{
+    int descriptor = shm_open(segment_name, O_RDONLY, 0);
+    struct stat info;
+    if(descriptor == -1 || fstat(descriptor, &info) == -1 || (size_t)info.st_size < sizeof(struct lhp_metrics_segment)){
+        log_message(lhp_log, LHP_ERROR, "No runtime metrics found for %s (the page must be built with -s and have served a request).\n", segment_name);
+        if(descriptor != -1){
+            close(descriptor);
+        }
+        return 1;
+    }
+    struct lhp_metrics_segment *segment = mmap(NULL, sizeof(*segment), PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if(segment == MAP_FAILED){
+        log_message(lhp_log, LHP_ERROR, "Error reading the runtime metrics in %s.\n", segment_name);
+        return 1;
+    }
+    if(segment->magic != LHP_METRICS_MAGIC || segment->slot_size != sizeof(struct lhp_metrics_slot)){
+        log_message(lhp_log, LHP_ERROR, "The runtime metrics in %s were recorded by a different version of the lhpCompiler.\n", segment_name);
+        munmap(segment, sizeof(*segment));
+        return 1;
+    }
+
+    // Add up the counters of every process (the pages keep adding to them while they are read, so each is read once).
+    unsigned long long requests = 0;
+    unsigned long long nanoseconds[3] = { 0 };
+    unsigned long long max_nanoseconds = 0;
+    unsigned long long histogram[LHP_METRICS_BUCKETS] = { 0 };
+    int processes = 0;
+    int live_processes = 0;
+    for(int i = 0; i < LHP_METRICS_SLOTS; i++){
+        struct lhp_metrics_slot *slot = &segment->slots[i];
+        int pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+        if(pid == 0){
+            continue;
+        }
+        processes++;
+        live_processes += (kill(pid, 0) == 0 || errno == EPERM);
+        requests += __atomic_load_n(&slot->requests, __ATOMIC_RELAXED);
+        for(int phase = 0; phase < 3; phase++){
+            nanoseconds[phase] += __atomic_load_n(&slot->nanoseconds[phase], __ATOMIC_RELAXED);
+        }
+        unsigned long long slot_max = __atomic_load_n(&slot->max_nanoseconds, __ATOMIC_RELAXED);
+        max_nanoseconds = (slot_max > max_nanoseconds) ? slot_max : max_nanoseconds;
+        for(int bucket = 0; bucket < LHP_METRICS_BUCKETS; bucket++){
+            histogram[bucket] += __atomic_load_n(&slot->histogram[bucket], __ATOMIC_RELAXED);
+        }
+    }
+
+    // Find the percentiles from the histogram.
+    const double fractions[] = { 0.5, 0.9, 0.99, 0.999 };
+    unsigned long long percentiles[4] = { 0 };
+    unsigned long long histogram_total = 0;
+    for(int bucket = 0; bucket < LHP_METRICS_BUCKETS; bucket++){
+        histogram_total += histogram[bucket];
+    }
+    for(int i = 0; i < 4; i++){
+        unsigned long long seen = 0;
+        for(int bucket = 0; bucket < LHP_METRICS_BUCKETS && histogram_total > 0; bucket++){
+            seen += histogram[bucket];
+            if((double)seen >= fractions[i] * (double)histogram_total){
+                percentiles[i] = 1ULL << bucket;
+                break;
+            }
+        }
+    }
+
+    char page[sizeof(segment->page) + 1];
+    memcpy(page, segment->page, sizeof(segment->page));
+    page[sizeof(segment->page)] = '\0';
+    double divisor = (requests > 0) ? (double)requests * 1000.0 : 1.0;
+    printf("{\"page\":");
+    print_json_string(page, stdout);
+    printf(",\"segment\":");
+    print_json_string(segment_name, stdout);
+    printf(",\"processes\":%d,\"live_processes\":%d,\"requests\":%llu,", processes, live_processes, requests);
+    printf("\"mean_us\":{\"header\":%.1f,\"body\":%.1f,\"footer\":%.1f,\"total\":%.1f},", nanoseconds[0] / divisor, nanoseconds[1] / divisor, nanoseconds[2] / divisor,
+           (nanoseconds[0] + nanoseconds[1] + nanoseconds[2]) / divisor);
+    printf("\"latency_us\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%.1f},", percentiles[0], percentiles[1], percentiles[2], percentiles[3], max_nanoseconds / 1000.0);
+    printf("\"histogram_us\":[");
+    const char *separator = "";
+    for(int bucket = 0; bucket < LHP_METRICS_BUCKETS; bucket++){
+        if(histogram[bucket] > 0){
+            printf("%s[%llu,%llu]", separator, 1ULL << bucket, histogram[bucket]);
+            separator = ",";
+        }
+    }
+    printf("]}\n");
+    munmap(segment, sizeof(*segment));
+    return 0;
+}
+
+/**
+ * This function prints the runtime metrics of the pages given, or of every page that has recorded any if none are given.
+ *
+ * @author Iqra Haq
+ * @param[in] count - The number of pages given.
+ * @param[in] page_names - The names of the pages, as they were given to the lhpCompiler.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status (1 if the metrics of any page couldn't be read).
+ */
+int read_runtime_metrics(int count, char *page_names[], FILE *lhp_log)
+{
+    // Room for a "/" before the longest name of a file in /dev/shm.
+    char segment_name[NAME_MAX + 2];
+    int status = 0;
+    for(int i = 0; i < count; i++){
+        metrics_segment_name(page_names[i], segment_name, sizeof(segment_name));
+        status |= print_runtime_metrics(segment_name, lhp_log);
+    }
+    if(count > 0){
+        return status;
+    }
+
+    // Shared memory segments are kept in /dev/shm on Linux.
+    DIR *directory = opendir("/dev/shm");
+    struct dirent *entry;
+    if(directory == NULL){
+        log_message(lhp_log, LHP_ERROR, "%s\n", "Error listing the shared memory segments in /dev/shm.");
+        return 1;
+    }
+    while((entry = readdir(directory)) != NULL){
+        if(strncmp(entry->d_name, "lhp.", 4) == 0){
+            snprintf(segment_name, sizeof(segment_name), "/%s", entry->d_name);
+            status |= print_runtime_metrics(segment_name, lhp_log);
+        }
+    }
+    closedir(directory);
+    return status;
+}
+
+/**
+ * This function builds up the list of LHP Files from the files and directories given by the user.
+ *
+ * @author Iqra Haq
+ * @param[in] count - The number of files and directories.
+ * @param[in] arguments - The files and directories.
+ * @param[out] list - The list of LHP Files.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
+ */
+int collect_lhp_files(int count, char *arguments[], struct lhp_file_list *list, FILE *lhp_log)
+{
+    struct stat argument_info;
+    int status = 0;
+    for(int i = 0; i < count; i++){
+        if(stat(arguments[i], &argument_info) == 0 && S_ISDIR(argument_info.st_mode)){
+            status |= find_lhp_files(arguments[i], strlen(arguments[i]), list, lhp_log);
+        } else {
+            status |= add_lhp_file(list, arguments[i], 0);
+        }
+    }
+    return status;
+}
+
+/**
+ * This function joins the name of a directory and the name of an entry in it (a directory named "" is the current directory,
+ * so that the paths of LHP Files given without a directory match the names given by the user).
+ *
+ * @author Iqra Haq
+ * @param[in] directory_name - The name of the directory.
+ * @param[in] entry_name - The name of the entry.
+ * \return char * - The path (to be freed by the caller), or NULL if there wasn't enough memory.
+ */
+char *join_path(const char *directory_name, const char *entry_name)
+{
+    size_t path_length = strlen(directory_name) + strlen(entry_name) + 2;
+    char *path = malloc(path_length);
+    if(path != NULL){
+        snprintf(path, path_length, (directory_name[0] == '\0') ? "%s%s" : "%s/%s", directory_name, entry_name);
+    }
+    return path;
+}
+
+/**
+ * This function watches a directory for changes, along with every directory inside it if asked to.
+ *
+ * @author Iqra Haq
+ * @param[in] inotify_descriptor - The inotify instance to add the watches to.
+ * @param[in] directory_name - The name of the directory ("" for the current directory).
+ * @param[in] recursive - Whether to watch the directories inside it too.
+ * @param[out] watches - The list of watched directories.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
+ */
+int add_watches(int inotify_descriptor, const char *directory_name, int recursive, struct lhp_watch_list *watches, FILE *lhp_log)
+{
+    const char *watched_name = (directory_name[0] == '\0') ? "." : directory_name;
+    int watch_descriptor = inotify_add_watch(inotify_descriptor, watched_name, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR);
+    if(watch_descriptor == -1){
+        log_message(lhp_log, LHP_ERROR, "Error watching directory %s for changes.\n", watched_name);
+        return 1;
+    }
+    // Grow the list (doubling its size) when it runs out of room.
+    if(watches->count == watches->capacity){
+        size_t capacity = (watches->capacity == 0) ? 16 : watches->capacity * 2;
+        struct lhp_watch *new_watches = realloc(watches->watches, capacity * sizeof(*new_watches));
+        if(new_watches == NULL){
+            return 1;
+        }
+        watches->watches = new_watches;
+        watches->capacity = capacity;
+    }
+    watches->watches[watches->count].descriptor = watch_descriptor;
+    watches->watches[watches->count].directory = strdup(directory_name);
+    watches->count++;
+    if(!recursive){
+        return 0;
+    }
+
+    // Watch the directories inside it too (apart from hidden ones, which are skipped when searching for LHP Files).
+    DIR *directory = opendir(watched_name);
+    struct dirent *entry;
+    int status = 0;
+    if(directory == NULL){
+        return 1;
+    }
+    while((entry = readdir(directory)) != NULL){
+        struct stat entry_info;
+        if(entry->d_name[0] == '.'){
+            continue;
+        }
+        char *path = join_path(directory_name, entry->d_name);
+        if(path != NULL && stat(path, &entry_info) == 0 && S_ISDIR(entry_info.st_mode)){
+            status |= add_watches(inotify_descriptor, path, 1, watches, lhp_log);
+        }
+        free(path);
+    }
+    closedir(directory);
+    return status;
+}
+
+/**
+ * This function finds whether a changed LHP File is one of the pages being watched, i.e. it was given by the user
+ * or is inside one of the directories given.
+ *
+ * @author Iqra Haq
+ * @param[in] path - The path of the changed LHP File.
+ * @param[in] count - The number of files and directories given by the user.
+ * @param[in] arguments - The files and directories given by the user.
+ * @param[out] route_start - Where the route of the page starts within its path.
+ * \return int - Whether the LHP File is being watched.
+ */
+int is_watched_page(const char *path, int count, char *arguments[], size_t *route_start)
+{
+    struct stat argument_info;
+    for(int i = 0; i < count; i++){
+        size_t length = strlen(arguments[i]);
+        if(stat(arguments[i], &argument_info) == 0 && S_ISDIR(argument_info.st_mode)){
+            if(strncmp(path, arguments[i], length) == 0 && path[length] == '/'){
+                *route_start = length;
+                return 1;
+            }
+        } else if(strcmp(path, arguments[i]) == 0 || (strncmp(path, arguments[i], length) == 0 && strcmp(path + length, ".lhp") == 0)){
+            *route_start = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function watches the files and directories given by the user and recompiles pages as soon as they change,
+ * so that the toolchain (and everything else set up when the program starts) is only found once.
+ * Changes are collected until none have been made for LHP_WATCH_DEBOUNCE milliseconds, so that saving many files at once
+ * (or an editor writing a file in several steps) leads to one compilation. Only the LHP Files that changed are compiled,
+ * in parallel; a change to anything else they might use (a local header or recorded requests) compiles every page,
+ * leaving the build cache to skip those that aren't affected. A bundle is linked again after any change.
+ * This function only returns if the directories can't be watched.
+ *
+ * @author Iqra Haq
+ * @param[in] count - The number of files and directories given by the user.
+ * @param[in] arguments - The files and directories given by the user.
+ * @param[in] options - The options given by the user.
+ * @param[out] lhp_log - The log file to store any errors in.
+ * \return int - Error status.
+ */
+int watch_lhp_files(int count, char *arguments[], struct lhp_options *options, FILE *lhp_log)
+{
+    struct lhp_watch_list watches = { NULL, 0, 0 };
+    struct stat argument_info;
+    int status = 0;
+    int inotify_descriptor = inotify_init1(IN_CLOEXEC);
+    if(inotify_descriptor == -1){
+        log_message(lhp_log, LHP_ERROR, "%s\n", "Error starting inotify to watch for changes.");
+        return 1;
+    }
+
+    // Watch each directory given (and everything in it), and the directory of each LHP File given.
+    for(int i = 0; i < count && status == 0; i++){
+        if(stat(arguments[i], &argument_info) == 0 && S_ISDIR(argument_info.st_mode)){
+            status |= add_watches(inotify_descriptor, arguments[i], 1, &watches, lhp_log);
+        } else {
+            char *directory_name = strdup(arguments[i]);
+            char *slash = (directory_name != NULL) ? strrchr(directory_name, '/') : NULL;
+            if(directory_name == NULL){
+                status = 1;
+                break;
+            }
+            if(slash == NULL){
+                directory_name[0] = '\0';
+            } else {
+                // A file in the root directory keeps its "/".
+                slash[(slash == directory_name) ? 1 : 0] = '\0';
+            }
+            status |= add_watches(inotify_descriptor, directory_name, 0, &watches, lhp_log);
+            free(directory_name);
+        }
+    }
+    if(status != 0){
+        printf("The program encountered an error. Please check LHP.log for further details!\n");
+    } else {
+        printf("Watching %zu directories for changes...\n", watches.count);
+    }
+    fflush(stdout);
+    fflush(lhp_log);
+
+    // The events are read into a buffer aligned for struct inotify_event.
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(status == 0){
+        struct lhp_file_list changed = { NULL, NULL, 0, 0 };
+        int compile_all = 0;
+        struct pollfd poll_descriptor = { inotify_descriptor, POLLIN, 0 };
+
+        // Wait for the first change, then keep collecting changes until the directories have been quiet for a while.
+        int timeout = -1;
+        int ready;
+        while((ready = poll(&poll_descriptor, 1, timeout)) != 0){
+            if(ready < 0){
+                if(errno == EINTR){
+                    continue;
+                }
+                status = 1;
+                break;
+            }
+            ssize_t length = read(inotify_descriptor, buffer, sizeof(buffer));
+            if(length <= 0){
+                if(length < 0 && errno == EINTR){
+                    continue;
+                }
+                status = 1;
+                break;
+            }
+            timeout = LHP_WATCH_DEBOUNCE;
+
+            for(char *cursor = buffer; cursor < buffer + length; cursor += sizeof(struct inotify_event) + ((struct inotify_event *)cursor)->len){
+                struct inotify_event *event = (struct inotify_event *)cursor;
+                const char *directory_name = NULL;
+                for(size_t i = 0; i < watches.count; i++){
+                    if(watches.watches[i].descriptor == event->wd){
+                        directory_name = watches.watches[i].directory;
+                        break;
+                    }
+                }
+                // Anything the lhpCompiler writes itself (C Files, EXE Files, build cache records...) is ignored, as are hidden files.
+                if(directory_name == NULL || event->len == 0 || event->name[0] == '.'){
+                    continue;
+                }
+                size_t name_length = strlen(event->name);
+                int is_lhp_file = (name_length > 4 && strcmp(event->name + name_length - 4, ".lhp") == 0);
+                int is_dependency = ((name_length > 2 && strcmp(event->name + name_length - 2, ".h") == 0) ||
+                                     (name_length > 9 && strcmp(event->name + name_length - 9, ".requests") == 0));
+                char *path = join_path(directory_name, event->name);
+                size_t route_start = 0;
+                if(path == NULL){
+                    continue;
+                }
+
+                if(event->mask & IN_ISDIR){
+                    // A new directory inside a watched directory is watched too, and any pages already in it compiled.
+                    if((event->mask & (IN_CREATE | IN_MOVED_TO)) && is_watched_page(path, count, arguments, &route_start)){
+                        add_watches(inotify_descriptor, path, 1, &watches, lhp_log);
+                        compile_all = 1;
+                    }
+                } else if(is_lhp_file && (event->mask & (IN_DELETE | IN_MOVED_FROM))){
+                    // A page that has gone only matters to a bundle or host, which is built from every page there is.
+                    compile_all |= (options->bundle_name != NULL || options->host_name != NULL);
+                } else if(is_lhp_file && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && is_watched_page(path, count, arguments, &route_start)){
+                    int already_changed = 0;
+                    for(size_t i = 0; i < changed.count; i++){
+                        already_changed |= (strcmp(changed.names[i], path) == 0);
+                    }
+                    if(!already_changed){
+                        add_lhp_file(&changed, path, route_start);
+                    }
+                } else if(is_dependency && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM))){
+                    compile_all = 1;
+                }
+                free(path);
+            }
+        }
+        if(status != 0 || (changed.count == 0 && !compile_all)){
+            free_lhp_files(&changed);
+            continue;
+        }
+
+        // A bundle's handlers are numbered by their place in the list of every page, so the whole list is used for a bundle.
+        log_context.job = 0;
+        log_context.file = NULL;
+        set_log_phase("watch");
+        fprintf(lhp_log, "Compiling the pages changed since the last build.\n");
+        if(compile_all || options->bundle_name != NULL){
+            free_lhp_files(&changed);
+            collect_lhp_files(count, arguments, &changed, lhp_log);
+        }
+        int round_status = batch_compilation(&changed, options, NULL, lhp_log);
+        if(round_status == 0 && options->bundle_name != NULL){
+            bundle_compilation(&changed, options, lhp_log);
+        }
+        // A running host reloads the changed modules itself, so the host is only built again if a page has been added or removed.
+        if(round_status == 0 && options->host_name != NULL){
+            struct lhp_file_list pages = { NULL, NULL, 0, 0 };
+            collect_lhp_files(count, arguments, &pages, lhp_log);
+            bundle_compilation(&pages, options, lhp_log);
+            free_lhp_files(&pages);
+        }
+        free_lhp_files(&changed);
+        fflush(stdout);
+        fflush(lhp_log);
+    }
+
+    printf("The program encountered an error. Please check LHP.log for further details!\n");
+    log_message(lhp_log, LHP_ERROR, "%s\n", "Error reading the changes to the watched directories.");
+    for(size_t i = 0; i < watches.count; i++){
+        free(watches.watches[i].directory);
+    }
+    free(watches.watches);
+    close(inotify_descriptor);
+    return 1;
+}
+
+/**
+* This is main function of the program. This is where all the functions will be called.
+* The order of the statements within the main function matter as all statements are 
+* essentially global statements and have effects on the user-defined functions.
+* Argument variable parameters passed at run-time have been used rather than continuous
+* user interaction for ease of use and essential interaction only.
+* Any number of LHP Files and directories of LHP Files can be given, along with "-j [jobs]"
+* to choose how many are compiled at once (by default, one per processor).
+*
+* @author Iqra Haq
+* @param[in] argc - Number of argument parameters supplied by user.
+* @param[in] argv - List of arguments supplied by user.
+* \return int - Error status.
+*/
+int main (int argc, char* argv[])
+{
+
+    // Relevant FILE variables created.
+    FILE *lhp_log = NULL;
+    // List of LHP Files to compile.
+    struct lhp_file_list list = { NULL, NULL, 0, 0 };
+    // Options given by the user. LHP Files are compiled one per processor at once unless specified otherwise.
+    struct lhp_options options = { 0 };
+    options.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int status = 0;
+    int option;
 
     // lhp_log is not opened with file_opener function as the function requires lhp_log to independantly exist.
-    lhp_log = fopen("LHP.log", "a+");
+    // Each message written to it is added to LHP.log as a record of its own, stamped with the time (in place of a banner for each run).
+    lhp_log = open_log("LHP.log");
     if(lhp_log == NULL){
         fprintf(stderr, "Error opening LHP.log, please try again...\n");
         // Independant existence means the program will exit with an error if there is an issue opening LHP.Log.
         exit(1);
-    } else {
-        // Insert the Date & Time at the top of the LHP.Log file.
-        fprintf(lhp_log,"\n%s\n", "========================");
-        fprintf(lhp_log, "%s", date_and_time);
-        fprintf(lhp_log, "%s\n", "========================");
-         
-    
-        // Check to see if wrong number of argument parameters were specified for validation purposes.
-        if (argc != 2){
-	    	printf("The program encountered an error. Please check LHP.log for further details!\n");
-            // Inform the user via LHP.Log accordingly if wrong number of parameters specified.
-            fprintf(lhp_log, "%s\n", "Insufficient number of argument parameters supplied!");
-            if (argc <= 1){
-                // Inform the user via LHP.Log if LHP File (Necessary Input File) hasn't been included.
-                fprintf(lhp_log, "%s\n", "No LHP file specified. Please specify the LHP file as an argument parameter.");
-            }
-            // End the program noting an error occured for incorrect number of argument parameters.
+    }
+
+    // Read any options given before the LHP Files.
+    unsigned long long run_start = now_nanoseconds();
+    unsigned long long bundle_nanoseconds = 0;
+    while((option = getopt(argc, argv, "b:cd:efj:kl:m:p:rst:w")) != -1){
+        if(option == 'b'){
+            // Link every page into a single bundle with this name rather than an EXE File each.
+            options.bundle_name = optarg;
+        } else if(option == 'c'){
+            // Minify the HTML of every page.
+            options.minify = 1;
+        } else if(option == 'd'){
+            // Compile every page to a module loaded by a host with this name, which reloads pages as they are compiled again.
+            options.host_name = optarg;
+        } else if(option == 'e'){
+            // Stream each response, sending the header HTML before the C code blocks run.
+            options.stream = 1;
+        } else if(option == 'f'){
+            // Compile every LHP File even if its EXE File is up to date.
+            options.force = 1;
+        } else if(option == 'j'){
+            options.jobs = strtol(optarg, NULL, 10);
+        } else if(option == 'k'){
+            // Give every page (or the bundle or host) a supervisor that runs a pool of worker processes.
+            options.supervise = 1;
+        } else if(option == 'l' && strcmp(optarg, "text") == 0){
+            log_context.format = LHP_LOG_TEXT;
+        } else if(option == 'l' && strcmp(optarg, "json") == 0){
+            // Write the LHP Log as JSON lines.
+            log_context.format = LHP_LOG_JSON;
+        } else if(option == 'l' && strcmp(optarg, "binary") == 0){
+            // Write the LHP Log as binary records.
+            log_context.format = LHP_LOG_BINARY;
+        } else if(option == 'm'){
+            // Record how long each phase of compiling each LHP File takes (as JSON, or CSV if the file name ends in ".csv").
+            options.metrics_file_name = optarg;
+        } else if(option == 'p' && strcmp(optarg, "debug") == 0){
+            options.profile = LHP_DEBUG;
+        } else if(option == 'p' && strcmp(optarg, "release") == 0){
+            // Optimise the pages.
+            options.profile = LHP_RELEASE;
+        } else if(option == 'p' && strcmp(optarg, "pgo") == 0){
+            // Optimise the pages using profile data from replaying the requests recorded for them.
+            options.profile = LHP_PGO;
+        } else if(option == 'r'){
+            // Print the runtime metrics recorded by the pages given rather than compiling them.
+            options.read_metrics = 1;
+        } else if(option == 's'){
+            // Have the pages record runtime metrics into shared memory.
+            options.runtime_metrics = 1;
+        } else if(option == 't'){
+            // Give each page a pool of responder threads rather than handling one request at a time.
+            options.threads = strtol(optarg, NULL, 10);
+        } else if(option == 'w'){
+            // Keep watching the LHP Files for changes once they have been compiled.
+            options.watch = 1;
+        } else {
+            printf("The program encountered an error. Please check LHP.log for further details!\n");
+            log_message(lhp_log, LHP_ERROR, "%s\n", "Unknown option supplied! Usage: lhpCompiler [-b bundle] [-c] [-d host] [-e] [-f] [-j jobs] [-k] [-l text|json|binary] [-m metricsFile] [-p debug|release|pgo] [-s] [-t threads] [-w] lhpFile|directory... or lhpCompiler -r [page...]");
             exit(1);
-        } 
+        }
+    }
+    if(options.jobs < 1){
+        options.jobs = 1;
+    }
+    if(options.threads < 0){
+        options.threads = 0;
+    }
+    // The bundle's dispatcher uses the FastCGI Standard I/O library, so bundled pages can't have threads of their own.
+    if(options.threads > 0 && options.bundle_name != NULL){
+        printf("The program encountered an error. Please check LHP.log for further details!\n");
+        log_message(lhp_log, LHP_ERROR, "%s\n", "The -b and -t options can't be used together.");
+        exit(1);
+    }
+    // The host is single-threaded and calls its modules through the FastCGI Standard I/O library, so modules can't be threaded or bundled.
+    if(options.host_name != NULL && (options.threads > 0 || options.bundle_name != NULL)){
+        printf("The program encountered an error. Please check LHP.log for further details!\n");
+        log_message(lhp_log, LHP_ERROR, "%s\n", "The -d option can't be used with the -b or -t options.");
+        exit(1);
+    }
+    // Recorded requests are replayed by running each page as a CGI program, which only single-threaded pages of their own can do.
+    if(options.profile == LHP_PGO && (options.threads > 0 || options.bundle_name != NULL || options.host_name != NULL)){
+        printf("The program encountered an error. Please check LHP.log for further details!\n");
+        log_message(lhp_log, LHP_ERROR, "%s\n", "Profile-guided optimisation (-p pgo) can't be used with the -b, -d or -t options.");
+        exit(1);
+    }
+
+    // Reading the runtime metrics of pages doesn't compile anything.
+    if(options.read_metrics){
+        status = read_runtime_metrics(argc - optind, argv + optind, lhp_log);
+        if(status != 0){
+            printf("The program encountered an error. Please check LHP.log for further details!\n");
+        }
+        fclose(lhp_log);
+        return status;
+    }
 
-        // Calculate and store the length of the file name.
-        size_t file_name_length = ((strlen(argv[1]))+1);
-        // Dynamic memory allocation used as the file name will always vary.
-        char *lhp_file_name = (char *)malloc(file_name_length);
-        char *intermediary_file_name = (char *)malloc(file_name_length);
-        // Store the file name into variables for both the LHP file (lhp_file) and the C File (intermediary_file) (keep file name consistent throughout to avoid confusion.)
-        strcpy(lhp_file_name, argv[1]);
-        strcpy(intermediary_file_name, lhp_file_name);
+    // Check to see if wrong number of argument parameters were specified for validation purposes.
+    if (optind >= argc){
+        printf("The program encountered an error. Please check LHP.log for further details!\n");
+        // Inform the user via LHP.Log accordingly if wrong number of parameters specified.
+        log_message(lhp_log, LHP_ERROR, "%s\n", "Insufficient number of argument parameters supplied!");
+        // Inform the user via LHP.Log if LHP File (Necessary Input File) hasn't been included.
+        log_message(lhp_log, LHP_ERROR, "%s\n", "No LHP file specified. Please specify the LHP file as an argument parameter.");
+        // End the program noting an error occured for incorrect number of argument parameters.
+        exit(1);
+    }
 
+    // Find the toolchain flags once, before any LHP File is compiled.
+    resolve_toolchain(&options.toolchain, lhp_log);
 
-        // Check to see if extension is not included within the file name.
-        if(strstr(lhp_file_name, ".lhp") == NULL){
-            // Allocate memory for the extension and null terminator also.
-            lhp_file_name = realloc(lhp_file_name, file_name_length+5);
-            // Append the file extension to the file name if not included.
-            strcat(lhp_file_name, ".lhp");
+    // A single LHP File is compiled straight away, exactly as it always has been (unless it is being bundled or loaded by a host).
+    struct stat argument_info;
+    if (optind == argc - 1 && options.bundle_name == NULL && options.host_name == NULL && !options.watch && !(stat(argv[optind], &argument_info) == 0 && S_ISDIR(argument_info.st_mode))){
+        struct lhp_file_metrics metrics;
+        status = compile_lhp_file(argv[optind], 0, &options, &metrics, lhp_log);
+        if(options.metrics_file_name != NULL){
+            write_metrics(options.metrics_file_name, &argv[optind], &metrics, 1, now_nanoseconds() - run_start, 0, lhp_log);
+        }
+        if(status == LHP_UP_TO_DATE){
+            // Reusing the existing EXE File is a success.
+            status = 0;
+        } else if(status != 0){
+            // If errors encountered, notify user to check LHP.Log.
+            printf("There was an error processing this file. Please check LHP.log for further details!\n");
+        }
+    } else {
+        // Otherwise, build up the list of LHP Files from the files and directories given and compile them in parallel.
+        status |= collect_lhp_files(argc - optind, argv + optind, &list, lhp_log);
+        // The worker processes record their metrics in memory shared with this process.
+        struct lhp_file_metrics *metrics = NULL;
+        size_t metrics_size = (list.count > 0 ? list.count : 1) * sizeof(*metrics);
+        if(options.metrics_file_name != NULL){
+            metrics = mmap(NULL, metrics_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if(metrics == MAP_FAILED){
+                log_message(lhp_log, LHP_ERROR, "%s\n", "Not enough memory to record the metrics.");
+                metrics = NULL;
+            }
+        }
+        status |= batch_compilation(&list, &options, metrics, lhp_log);
+        // Once every page has been compiled, link them all into the bundle (or build the host that loads them).
+        if(status == 0 && (options.bundle_name != NULL || options.host_name != NULL)){
+            unsigned long long bundle_start = now_nanoseconds();
+            status = bundle_compilation(&list, &options, lhp_log);
+            bundle_nanoseconds = now_nanoseconds() - bundle_start;
         }
+        if(metrics != NULL){
+            write_metrics(options.metrics_file_name, list.names, metrics, list.count, now_nanoseconds() - run_start, bundle_nanoseconds, lhp_log);
+            munmap(metrics, metrics_size);
+        }
+    }
 
-        // Use file_opener function to open the input file as a read only (avoid accidental file modifications)
-        lhp_file = file_opener(lhp_file_name, "r", lhp_log);
-        
+    // In watch mode, carry on recompiling pages whenever they change (whether or not they all compiled to begin with).
+    if(options.watch){
+        fflush(lhp_log);
+        status = watch_lhp_files(argc - optind, argv + optind, &options, lhp_log);
+    }
 
-        // Remove the LHP file extension if the C File (intermediary_file) variable includes it so that the correct file extension can be applied.
-        if(strstr(intermediary_file_name, ".lhp") != NULL){
-            remove_file_extension(intermediary_file_name);
-        }
-        // Allocate memory for the extension and null terminator also.
-        intermediary_file_name = realloc(intermediary_file_name, file_name_length+3);
-        intermediary_file_name = strcat(intermediary_file_name, ".c");
-        // Use file_opener function to open the intermediary file with write permission (as this file needs modification abilities enabled)
-        intermediary_file = file_opener(intermediary_file_name, "w", lhp_log);
-
-
-
-        // Call file_checker function to make sure that the content structure of the input file is suitable for the program.
-        int status = file_checker(lhp_file, lhp_log, line, lhp_file_name);
-        // Status returned from file_checker is checked to see if any errors encountered.
-        if(status == 1){
-        	// If errors encountered, notify user to check LHP.Log and exit program.
-        	printf("There was an error processing this file. Please check LHP.log for further details!\n");
-        	exit(1);
-        }
-
-        // Call analyse_preprocessor_directives function to analyse relevant Pre-Processor Directives in LHP File line by line and copy them to the C File (intermediary_file).
-        analyse_preprocessor_directives(lhp_file, intermediary_file, line);
-        // Call analyse_html functon to analyse any HTML in the LHP File line by line and copy them to the C File (intermediary_file).
-        analyse_html(lhp_file, intermediary_file, line);
-        // Call analyse_c to analyse any C in the LHP File line by line and copy them to the C File (intermediary_file).
-        analyse_c(lhp_file, intermediary_file, line);
-
-        //Rewind the files that were analysed or modified so that the compilation command can process these accordingly as well as future program reruns.
-        rewind(lhp_file);
-        rewind(intermediary_file);
-
-        // Call the final user-defined function: compilation to compile the C File (intermediary_file).
-        compilation(intermediary_file_name, command, lhp_log);
-        
-        // Close any opened files and free any allocated memory as the program has completed.
-        fclose(lhp_file);
-        fclose(intermediary_file);
-        fclose(lhp_log);
-        free(lhp_file_name);
-        free(intermediary_file_name);      
-    }   
+    // Close any opened files and free any allocated memory as the program has completed.
+    free_lhp_files(&list);
+    free(options.toolchain.mysql_flags);
+    free(options.toolchain.mysql_output);
+    fclose(lhp_log);
 
     // Main's return function to signify end of program.
-    return 0;
+    return status;
 }